@@ -0,0 +1,1282 @@
+#define _GNU_SOURCE
+
+#include "agent.h"
+
+#include <stdio.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+
+/**
+ * A message from the rpsserver or an opponent, as a frame or as a line split
+ * into its fields, which point into the buffer the line was read into
+ *
+ * binary (bool): the message is a frame
+ * message (Message): the frame
+ * fields (Fields): the fields of the line
+ *
+ */
+typedef struct Input {
+    bool binary;
+    Message message;
+    Fields fields;
+} Input;
+
+/**
+ * Close the streams to a server, if they are open
+ *
+ * server (Server*): the server to disconnect from
+ *
+ */
+void close_server(Server* server) {
+    if (server->to != NULL) {
+        // closes the socket the scanner reads from as well
+        fclose(server->to);
+        server->to = NULL;
+    }
+}
+
+/**
+ * Free all the memory associated with an server
+ *
+ * info (Server*): the server to free
+ *
+ */
+void free_server(Server* server) {
+    close_server(server);
+    destroy_scanner(&server->from);
+}
+
+/**
+ * Free all the memory associated with a match
+ *
+ * info (Match*): the match to free
+ *
+ */
+void free_match(Match* match) {
+    free(match->opponentName);
+    free(match->port);
+    free_server(&match->server);
+}
+
+/**
+ * Free all the memory associated with an agent
+ *
+ * info (AgentInfo*): the agent to free
+ *
+ */
+void free_agent(AgentInfo* info) {
+    free(info->name);
+    for (int i = 0; i < info->numMatches; i++) {
+        free_match(&info->matches[i]);
+    }
+    free(info->matches);
+    free_names(&info->names);
+    free_names(&info->sentNames);
+    free_server(&info->server);
+    destroy_scanner(&info->opponent);
+}
+
+/**
+ * Initialises a server struct.
+ *
+ * Returns a new server struct.
+ *
+ */
+Server init_server() {
+    Server server;
+    server.port = NULL;
+    server.to = NULL;
+    init_scanner(&server.from, -1);
+    server.addressLength = 0;
+
+    return server;
+}
+
+/**
+ * Initialises an agent struct
+ *
+ * Returns a new agent struct.
+ *
+ */
+AgentInfo init_agent() {
+    AgentInfo info;
+    info.name = NULL;
+    info.matches = malloc(0);
+    info.numMatches = 0;
+    info.port = 0;
+    info.server = init_server();
+    info.features = 0;
+    init_names(&info.names);
+    init_names(&info.sentNames);
+    init_scanner(&info.opponent, -1);
+    info.numMoves = 0;
+    info.ownSeed = false;
+    info.stage = STAGE_IDLE;
+
+    return info;
+}
+
+/**
+ * Resolve the address of a port on localhost, unless it already has been.
+ *
+ * info (Server*): store the address of this server here
+ * port (char*): the port to resolve
+ *
+ * Returns SUCCESS if successful, otherwise the appropriate error.
+ *
+ */
+static ClientError resolve_server(Server* info, char* port) {
+    if (info->addressLength != 0) {
+        return SUCCESS;
+    }
+
+    // get the address info on localhost
+    struct addrinfo* ai = 0;
+    struct addrinfo hints;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET; // IPv4
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE; // use the localhost
+    
+    if (getaddrinfo(NULL, port, &hints, &ai) != 0) {
+        freeaddrinfo(ai);
+        return INVALID_PORT; // failed to getaddrinfo
+    }
+
+    memcpy(&info->address, ai->ai_addr, ai->ai_addrlen);
+    info->addressLength = ai->ai_addrlen;
+    freeaddrinfo(ai);
+    return SUCCESS;
+}
+
+/**
+ * Connect to the server on localhost at the given port.
+ *
+ * info (Server*): store the information about this server here
+ * port (char*): the port to connect to
+ *
+ * Returns SUCCESS if successful, otherwise the appropriate error.
+ *
+ */
+ClientError connect_to_server(Server* info, char* port) {
+    if (resolve_server(info, port) != SUCCESS) {
+        return INVALID_PORT;
+    }
+
+    // get the socket descriptor
+    int sockfd;
+    if ((sockfd = socket(info->address.ss_family, SOCK_STREAM, 0)) == -1) {
+        return INVALID_PORT;
+    }
+
+    // connect to the socket
+    if (connect(sockfd, (struct sockaddr*) &info->address,
+            info->addressLength)) {
+        close(sockfd);
+        return INVALID_PORT;
+    }
+
+    // lines are flushed as soon as they are complete, so do not let Nagle
+    // hold one back waiting on the ACK for the one before
+    int noDelay = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    info->to = fdopen(sockfd, "w");
+    reset_scanner(&info->from, sockfd);
+    info->port = port;
+    return SUCCESS;
+}
+
+/**
+ * Send a HELLO to the rpsserver, asking for CLIENT_FEATURES
+ *
+ * info (AgentInfo*): the agent, connected to the rpsserver
+ * binary (bool): switch to frames first
+ *
+ */
+static void send_hello(AgentInfo* info, bool binary) {
+    if (binary) {
+        Message message = {.type = MESSAGE_HELLO, .value = CLIENT_FEATURES};
+        write_magic(info->server.to);
+        write_message(info->server.to, &message);
+    } else {
+        char hello[MAX_HELLO_LENGTH];
+        format_hello(hello, CLIENT_FEATURES);
+        fputs(hello, info->server.to);
+    }
+    fflush(info->server.to);
+}
+
+/**
+ * Connect to the rpsserver and try to switch to frames, asking for the same
+ * features as a text HELLO would
+ *
+ * info (AgentInfo*): the agent, info->features is set to what was agreed
+ *
+ * Returns SUCCESS if the server agreed to frames and a session, otherwise
+ * the connection is closed again
+ *
+ */
+static ClientError open_binary_session(AgentInfo* info) {
+    ClientError err;
+    if ((err = connect_to_server(&info->server, info->server.port))
+            != SUCCESS) {
+        return err;
+    }
+
+    send_hello(info, true);
+
+    // frames are only worth it if we keep the connection
+    Message message;
+    if (scan_message(&info->server.from, &message)
+            && message.type == MESSAGE_HELLO
+            && (message.value & FEATURE_SESSION)) {
+        info->features = message.value | FEATURE_BINARY;
+        return SUCCESS;
+    }
+    close_server(&info->server);
+    return UNSPECIFIED;
+}
+
+/**
+ * Connect to the rpsserver and ask for a session, so that every match can be
+ * played over the one connection, in frames if the server can read them. If
+ * the server does not understand (and hangs up), the agent tries again with
+ * text, and then goes back to connecting for every match.
+ *
+ * info (AgentInfo*): the agent, info->features is set to what was agreed
+ *
+ * Returns SUCCESS if successful, otherwise the appropriate error.
+ *
+ */
+ClientError open_session(AgentInfo* info) {
+    ClientError err;
+    if ((err = open_binary_session(info)) != UNSPECIFIED) {
+        return err;
+    }
+    if ((err = connect_to_server(&info->server, info->server.port))
+            != SUCCESS) {
+        return err;
+    }
+
+    send_hello(info, false);
+
+    Slice line;
+    Fields fields;
+    int features = -1;
+    if (scan_line(&info->server.from, &line)) {
+        split_line(line.start, line.length, &fields);
+        features = parse_hello(&fields);
+    }
+    if (features == -1) {
+        close_server(&info->server);
+        features = 0;
+    }
+    info->features = features;
+    return SUCCESS;
+}
+
+/**
+ * Listen on an ephemeral port on localhost.
+ *
+ * port (int*): store the listened to port here
+ *
+ * Returns SUCCESS if successful, otherwise the appropriate error.
+ *
+ */
+ClientError listen_on_ephemeral(int* port, int* socketFd) {
+    // get the address info on localhost
+    struct addrinfo* ai = 0;
+    struct addrinfo hints;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET; // IPv4
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE; // use the localhost
+
+    if (getaddrinfo(NULL, "0", &hints, &ai)) {
+        freeaddrinfo(ai);
+        return INVALID_PORT;
+    }
+
+    // get the socket descriptor
+    int sockfd;
+    if ((sockfd = socket(ai->ai_family, ai->ai_socktype, 0)) == -1) {
+        return INVALID_PORT;
+    }
+    *socketFd = sockfd;
+
+    // bind the socket to the port from the getaddrinfo
+    bool bound = !bind(sockfd, (struct sockaddr*)ai->ai_addr,
+            sizeof(struct sockaddr));
+    freeaddrinfo(ai);
+    if (!bound) {
+        return INVALID_PORT;
+    }
+
+    struct sockaddr_in ad;
+    memset(&ad, 0, sizeof(struct sockaddr_in));
+    socklen_t len = sizeof(struct sockaddr_in);
+    if (getsockname(sockfd, (struct sockaddr*)&ad, &len)) {
+        return INVALID_PORT;
+    }
+
+    if (listen(sockfd, 10)) {
+        //
+    }
+
+    *port = ntohs(ad.sin_port);
+    return SUCCESS;
+}
+
+/**
+ * Send a match request to the server.
+ *
+ * info (AgentInfo*): the info to be sent, also holds the file descriptor
+ *
+ */
+void send_match_request(AgentInfo* info) {
+    if (!(info->features & FEATURE_BINARY)) {
+        fprintf(info->server.to, "MR:%s:%d\n", info->name, info->port);
+        fflush(info->server.to);
+        return;
+    }
+
+    Message message = {.type = MESSAGE_MR, .port = info->port};
+    message.id = find_name(&info->sentNames, info->name);
+    if (message.id == 0) {
+        // the server only needs to be told our name once
+        Message name = {.type = MESSAGE_NAME,
+                .id = add_name(&info->sentNames, info->name)};
+        strncpy(name.name, info->name, MAX_FRAME_NAME);
+        write_message(info->server.to, &name);
+        message.id = name.id;
+    }
+    write_message(info->server.to, &message);
+    fflush(info->server.to);
+}
+
+/**
+ * Send the result of a match to the server.
+ *
+ * info (AgentInfo*): the info of the current agent
+ * match (Match*): the finished match
+ *
+ */
+void send_match_result(AgentInfo* info, Match* match) {
+    if (info->features & FEATURE_BINARY) {
+        Message message = {.type = MESSAGE_RESULT, .id = match->id,
+                .value = match->result};
+        write_message(info->server.to, &message);
+    } else if (match->result == TIE) {
+        fprintf(info->server.to, "RESULT:%d:TIE\n", match->id);
+    } else {
+        fprintf(info->server.to, "RESULT:%d:%s\n", match->id,
+                match->result == WIN ? info->name : match->opponentName);
+    }
+    fflush(info->server.to);
+}
+
+/**
+ * Set up a match once it has been parsed
+ *
+ * match (Match*): the match
+ *
+ */
+static void prepare_match(Match* match) {
+    match->server = init_server();
+    match->playerScore = 0;
+    match->opponentScore = 0;
+    match->round = match->sent = 0;
+    match->opponentBinary = match->magicChecked = false;
+}
+
+/**
+ * Read the next message from a peer, waiting until all of it has arrived
+ *
+ * scanner (Scanner*): what the peer sent
+ * binary (bool): the peer sends frames
+ * input (Input*): set to the message
+ *
+ * Returns false on EOF, an error or a bad frame
+ *
+ */
+static bool scan_input(Scanner* scanner, bool binary, Input* input) {
+    input->binary = binary;
+    if (binary) {
+        return scan_message(scanner, &input->message);
+    }
+    Slice line;
+    if (!scan_line(scanner, &line)) {
+        return false;
+    }
+    split_line(line.start, line.length, &input->fields);
+    return true;
+}
+
+/**
+ * Take the next message from a peer if all of it has been read in already
+ *
+ * scanner (Scanner*): what the peer sent
+ * binary (bool): the peer sends frames
+ * input (Input*): set to the message
+ *
+ * Returns 1 if a message was taken, 0 if not all of it has been read in, or
+ * -1 if it is not a valid frame
+ *
+ */
+static int take_buffered_input(Scanner* scanner, bool binary, Input* input) {
+    input->binary = binary;
+    if (binary) {
+        return take_message(scanner, &input->message);
+    }
+    Slice line;
+    if (!take_line(scanner, &line)) {
+        return 0;
+    }
+    split_line(line.start, line.length, &input->fields);
+    return 1;
+}
+
+/**
+ * Take the next message from a peer without waiting for it, reading in
+ * whatever has arrived if what was read in before is not enough
+ *
+ * scanner (Scanner*): what the peer sent
+ * binary (bool): the peer sends frames
+ * input (Input*): set to the message
+ *
+ * Returns 1 if a message was taken, 0 if not all of it has arrived yet, or
+ * -1 if it never will (the peer hung up) or it is not a valid frame
+ *
+ */
+static int take_input(Scanner* scanner, bool binary, Input* input) {
+    int taken = take_buffered_input(scanner, binary, input);
+    if (taken != 0) {
+        return taken;
+    }
+    bool open = read_available(scanner);
+    taken = take_buffered_input(scanner, binary, input);
+    return taken == 0 && !open ? -1 : taken;
+}
+
+/**
+ * Set up a match from the rpsserver's answer to a match request, remembering
+ * the name if the answer is a NAME frame.
+ *
+ * info (AgentInfo*): the agent, holds the names the server has sent
+ * input (Input*): the answer
+ * match (Match*): the match to be initialised
+ *
+ * Returns SUCCESS if the answer was a MATCH, otherwise the appropriate error
+ * (UNSPECIFIED if it was anything else, a name included).
+ *
+ */
+static ClientError match_from_input(AgentInfo* info, Input* input,
+        Match* match) {
+    if (input->binary) {
+        Message* message = &input->message;
+        if (message->type == MESSAGE_NAME) {
+            return learn_name(&info->names, message->id, message->name)
+                    ? UNSPECIFIED : INVALID_PORT;
+        }
+
+        char* name = lookup_name(&info->names, message->nameId);
+        if (message->type != MESSAGE_MATCH || name == NULL
+                || asprintf(&match->port, "%u", message->port) == -1) {
+            return UNSPECIFIED;
+        }
+        match->id = message->id;
+        match->opponentName = strdup(name);
+        match->ready = message->value & MATCH_FLAG_READY;
+        match->binary = message->value & MATCH_FLAG_BINARY;
+        match->pipeline = message->value & MATCH_FLAG_PIPELINE;
+        match->refereed = message->value & MATCH_FLAG_REFEREE;
+        prepare_match(match);
+        return SUCCESS;
+    }
+
+    // MATCH:id:name:port, optionally followed by :READY and :PIPELINE or by
+    // :REFEREE
+    Fields* fields = &input->fields;
+    switch (fields->tag) {
+        case TAG_BADNAME:
+            return INVALID_NAME;
+        case TAG_MATCH:
+            if (fields->count >= 3) {
+                break;
+            }
+            // fall through
+        default:
+            return UNSPECIFIED;
+    }
+
+    match->id = atoi(fields->field[0].start);
+    match->opponentName = strndup(fields->field[1].start,
+            fields->field[1].length);
+    match->port = strndup(fields->field[2].start, fields->field[2].length);
+    match->ready = match->pipeline = match->binary = false;
+    match->refereed = false;
+    for (int i = 3; i < fields->count; i++) {
+        if (!strcmp(fields->field[i].start, "READY")) {
+            match->ready = true;
+        } else if (!strcmp(fields->field[i].start, "PIPELINE")) {
+            match->pipeline = true;
+        } else if (!strcmp(fields->field[i].start, "REFEREE")) {
+            match->refereed = true;
+        }
+    }
+    prepare_match(match);
+    return SUCCESS;
+}
+
+/**
+ * Read a match message recieved from the server, along with any names sent
+ * ahead of it.
+ *
+ * info (AgentInfo*): the agent, holds the stream to read from
+ * match (Match*): the match to be initialised
+ *
+ * Returns SUCCESS if successful, otherwise the appropriate error.
+ *
+ */
+ClientError read_match_message(AgentInfo* info, Match* match) {
+    Input input;
+    ClientError err;
+    do {
+        if (!scan_input(&info->server.from, info->features & FEATURE_BINARY,
+                &input)) {
+            return INVALID_PORT;
+        }
+        err = match_from_input(info, &input, match);
+    } while (err == UNSPECIFIED && input.binary
+            && input.message.type == MESSAGE_NAME);
+    return err;
+}
+
+/**
+ * Send a READY or MOVE to the opponent, as a frame if they read frames. The
+ * message is not flushed.
+ *
+ * match (Match*): the match, holds the stream to the opponent
+ * type (MessageType): MESSAGE_READY or MESSAGE_MOVE
+ * move (MoveType): the move, for a MOVE
+ *
+ */
+static void send_to_opponent(Match* match, MessageType type, MoveType move) {
+    if (match->binary) {
+        Message message = {.type = type, .value = move};
+        write_message(match->server.to, &message);
+    } else if (type == MESSAGE_READY) {
+        fprintf(match->server.to, "READY\n");
+    } else {
+        fprintf(match->server.to, "MOVE:%s\n", move_as_string(move));
+    }
+}
+
+/**
+ * Check whether a message from the opponent is a READY
+ *
+ * input (Input*): the message
+ *
+ * Returns true if the opponent is ready.
+ *
+ */
+static bool is_ready(Input* input) {
+    return input->binary ? input->message.type == MESSAGE_READY
+            : input->fields.tag == TAG_READY;
+}
+
+/**
+ * Get the move from a move message from the opponent.
+ *
+ * input (Input*): the message
+ *
+ * Returns the move made by the opponent, SCISSORS if the message is not a
+ * valid move.
+ *
+ */
+static MoveType move_from_input(Input* input) {
+    if (input->binary) {
+        if (input->message.type == MESSAGE_MOVE
+                && input->message.value <= SCISSORS) {
+            return (MoveType) input->message.value;
+        }
+        return SCISSORS;
+    }
+
+    Fields* fields = &input->fields;
+    MoveType move;
+    if (fields->tag == TAG_MOVE && fields->count == 1
+            && parse_move(fields->field[0].start, &move)) {
+        return move;
+    }
+    return SCISSORS;
+}
+
+/**
+ * Read a move message from the opponent.
+ *
+ * stream (Scanner*): what the opponent sent
+ * binary (bool): the opponent sends frames
+ *
+ * Returns the move made by the opponent.
+ *
+ */
+static MoveType read_move_message(Scanner* stream, bool binary) {
+    Input input;
+    return scan_input(stream, binary, &input) ? move_from_input(&input)
+            : SCISSORS;
+}
+
+/**
+ * Look ahead at a move, drawing it (and any before it) if it has not been
+ * drawn yet. Moves are drawn in the order they are played, so looking ahead
+ * does not change the moves of later matches.
+ *
+ * info (AgentInfo*): the info of the current agent
+ * round (int): the round of the current match
+ *
+ * Returns the move for that round.
+ *
+ */
+static MoveType upcoming_move(AgentInfo* info, int round) {
+    while (info->numMoves <= round) {
+        int drawn = info->ownSeed ? rand_r(&info->seed) : rand();
+        info->moves[info->numMoves++] = (MoveType) (drawn % 3);
+    }
+    return info->moves[round];
+}
+
+/**
+ * Drop the moves played in a match, keeping any drawn after them for the
+ * next match.
+ *
+ * info (AgentInfo*): the info of the current agent
+ * played (int): the number of rounds played
+ *
+ */
+static void use_moves(AgentInfo* info, int played) {
+    memmove(info->moves, info->moves + played,
+            sizeof(MoveType) * (info->numMoves - played));
+    info->numMoves -= played;
+}
+
+/**
+ * Make sense of what the server made of a round of a refereed match: the
+ * opponent's MOVE if the match goes on, or the RESULT once it is over.
+ *
+ * info (AgentInfo*): the info of the current agent
+ * input (Input*): what the server sent
+ * match (Match*): the match, whose result is set once it is over
+ * over (bool*): set to true if the match is over
+ *
+ * Returns false if the server sent anything else.
+ *
+ */
+static bool referee_call_from_input(AgentInfo* info, Input* input,
+        Match* match, bool* over) {
+    *over = false;
+    if (input->binary) {
+        Message* message = &input->message;
+        if (message->type == MESSAGE_MOVE) {
+            return message->value <= SCISSORS;
+        }
+        *over = true;
+        match->result = (GameResult) message->value;
+        return message->type == MESSAGE_RESULT && message->value <= TIE;
+    }
+
+    Fields* fields = &input->fields;
+    MoveType move;
+    switch (fields->tag) {
+        case TAG_MOVE:
+            return fields->count == 1
+                    && parse_move(fields->field[0].start, &move);
+        case TAG_RESULT:
+            // RESULT:id:winner, as we would have reported it ourselves
+            if (fields->count != 2) {
+                return false;
+            }
+            *over = true;
+            if (!strcmp(fields->field[1].start, "TIE")) {
+                match->result = TIE;
+            } else if (!strcmp(fields->field[1].start, info->name)) {
+                match->result = WIN;
+            } else {
+                match->result = LOSE;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Send the move for the next round of a refereed match to the server
+ *
+ * info (AgentInfo*): the info of the current agent
+ * match (Match*): the match, whose round is moved on
+ *
+ */
+static void send_referee_move(AgentInfo* info, Match* match) {
+    MoveType move = upcoming_move(info, match->round++);
+    if (info->features & FEATURE_BINARY) {
+        Message message = {.type = MESSAGE_MOVE, .value = move};
+        write_message(info->server.to, &message);
+    } else {
+        fprintf(info->server.to, "MOVE:%s\n", move_as_string(move));
+    }
+    fflush(info->server.to);
+}
+
+/**
+ * Play a refereed match. Each move goes to the server, which scores the
+ * rounds and records the result itself, so there is no connection to the
+ * opponent and no RESULT to send.
+ *
+ * info (AgentInfo*): the info of the current agent
+ * match (Match*): the info with the current match
+ *
+ * Returns SUCCESS if successful.
+ *
+ */
+static ClientError play_refereed_match(AgentInfo* info, Match* match) {
+    bool over = false;
+    while (!over) {
+        send_referee_move(info, match);
+
+        Input input;
+        if (!scan_input(&info->server.from, info->features & FEATURE_BINARY,
+                &input)
+                || !referee_call_from_input(info, &input, match, &over)) {
+            return INVALID_PORT;
+        }
+    }
+    use_moves(info, match->round);
+    return SUCCESS;
+}
+
+/**
+ * Send the opponent the moves of the next window of rounds in one write.
+ * Without pipelining every round is a round trip of its own.
+ *
+ * info (AgentInfo*): the info of the current agent
+ * match (Match*): the match, whose sent rounds are moved on
+ *
+ */
+static void send_window(AgentInfo* info, Match* match) {
+    int window = match->pipeline ? PIPELINE_WINDOW : 1;
+    for (; match->sent < match->round + window && match->sent < MAX_ROUNDS;
+            match->sent++) {
+        send_to_opponent(match, MESSAGE_MOVE,
+                upcoming_move(info, match->sent));
+    }
+    fflush(match->server.to);
+}
+
+/**
+ * Score the next round of a match once the opponent's move for it is known
+ *
+ * info (AgentInfo*): the info of the current agent
+ * match (Match*): the match, whose round is moved on
+ * opponentMove (MoveType): the opponent's move
+ *
+ * Returns true if the match is decided.
+ *
+ */
+static bool score_round(AgentInfo* info, Match* match,
+        MoveType opponentMove) {
+    GameResult result = compare_moves(info->moves[match->round++],
+            opponentMove);
+    if (result == WIN) {
+        match->playerScore++;
+    } else if (result == LOSE) {
+        match->opponentScore++;
+    }
+    return match_decided(match->round, match->playerScore,
+            match->opponentScore);
+}
+
+/**
+ * Settle the result of a decided match and report it to the server
+ *
+ * info (AgentInfo*): the info of the current agent
+ * match (Match*): the decided match
+ *
+ */
+static void finish_match(AgentInfo* info, Match* match) {
+    match->result = match->playerScore > match->opponentScore ? WIN
+            : match->playerScore < match->opponentScore ? LOSE : TIE;
+    // moves sent after the deciding round were never played
+    use_moves(info, match->round);
+    send_match_result(info, match);
+}
+
+/**
+ * Play a single match with the opponent at the next port.
+ * 
+ * info (AgentInfo*): the info of the current agent
+ * match (Match*): the info with the current match
+ *
+ * Returns SUCCESS if successful.
+ *
+ */
+ClientError play_match(AgentInfo* info, Match* match) {
+    if (match->refereed) {
+        return play_refereed_match(info, match);
+    }
+
+    ClientError err;
+    if ((err = connect_to_server(&match->server, match->port)) != SUCCESS) {
+        return INVALID_PORT;
+    }
+    if (match->binary) {
+        // goes out with our first message
+        write_magic(match->server.to);
+    }
+
+    int opponentFd = accept(info->socketFd, 0, 0);
+    Scanner* opponent = &info->opponent;
+    reset_scanner(opponent, opponentFd);
+    // the opponent always writes before reading, so by the time we read
+    // their first message their magic byte (if any) has been sent
+    bool binary = false;
+
+    if (match->ready) {
+        // tell the opponent we are connected to them, then wait until they
+        // say the same before any moves flow
+        send_to_opponent(match, MESSAGE_READY, ROCK);
+        fflush(match->server.to);
+        binary = scan_magic(opponent);
+        Input input;
+        if (!scan_input(opponent, binary, &input) || !is_ready(&input)) {
+            close(opponentFd);
+            close_server(&match->server);
+            return INVALID_PORT;
+        }
+    }
+
+    bool decided = false;
+    while (!decided) {
+        send_window(info, match);
+
+        // and score each round as the opponent's moves for it arrive
+        while (!decided && match->round < match->sent) {
+            if (match->round == 0 && !match->ready) {
+                binary = scan_magic(opponent);
+            }
+            decided = score_round(info, match,
+                    read_move_message(opponent, binary));
+        }
+    }
+    finish_match(info, match);
+    close(opponentFd);
+    close_server(&match->server);
+    return SUCCESS;
+}
+
+/**
+ * Request, wait for and play the agent's next match
+ *
+ * info (AgentInfo*): the info of the current agent
+ * match (Match*): the match to be played
+ *
+ * Returns SUCCESS if successful, otherwise the appropriate error.
+ *
+ */
+ClientError play_next_match(AgentInfo* info, Match* match) {
+    ClientError err;
+    if (!(info->features & FEATURE_SESSION)) {
+        close_server(&info->server);
+        if ((err = connect_to_server(&info->server, info->server.port)) 
+                != SUCCESS) {
+            return err;
+        }
+    }
+
+    send_match_request(info);
+
+    err = UNSPECIFIED;
+    while (err != SUCCESS) {
+        err = read_match_message(info, match);
+
+        if (err == INVALID_PORT) {
+            return err;
+        }
+    }
+
+    return play_match(info, match);
+}
+
+/**
+ * Close the connections an agent holds for the match it is playing, if any
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match
+ *
+ */
+static void end_play(AgentInfo* info, Match* match) {
+    if (info->opponent.fd != -1) {
+        close(info->opponent.fd);
+        reset_scanner(&info->opponent, -1);
+    }
+    close_server(&match->server);
+}
+
+/**
+ * Give up on an agent, closing its connections to the server and opponent
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match it was playing, if any
+ *
+ */
+static void fail_agent(AgentInfo* info, Match* match) {
+    end_play(info, match);
+    close_server(&info->server);
+    info->stage = STAGE_FAILED;
+}
+
+/**
+ * Wait for the next match request, hanging up on the server as
+ * play_next_match would if there is no session
+ *
+ * info (AgentInfo*): the agent
+ *
+ */
+static void become_idle(AgentInfo* info) {
+    if (!(info->features & FEATURE_SESSION)) {
+        close_server(&info->server);
+    }
+    info->stage = STAGE_IDLE;
+}
+
+/**
+ * Start playing a match the server sent, by sending the first move to the
+ * server if it referees, otherwise by connecting to the opponent and sending
+ * them a READY or the first window of moves.
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match
+ *
+ */
+static void begin_match(AgentInfo* info, Match* match) {
+    if (match->refereed) {
+        send_referee_move(info, match);
+        info->stage = STAGE_REFEREED;
+        return;
+    }
+
+    if (connect_to_server(&match->server, match->port) != SUCCESS) {
+        fail_agent(info, match);
+        return;
+    }
+    if (match->binary) {
+        write_magic(match->server.to);
+    }
+    if (match->ready) {
+        send_to_opponent(match, MESSAGE_READY, ROCK);
+        fflush(match->server.to);
+    } else {
+        send_window(info, match);
+    }
+    info->stage = STAGE_ACCEPTING;
+}
+
+/**
+ * Read the server's answer to a HELLO, falling back to text and then to no
+ * session as open_session does
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match, which there is none of yet
+ *
+ */
+static void advance_greeting(AgentInfo* info, Match* match) {
+    Input input;
+    bool binary = info->stage == STAGE_GREETING;
+    int taken = take_input(&info->server.from, binary, &input);
+    if (taken == 0) {
+        return;
+    }
+
+    if (binary) {
+        if (taken == 1 && input.message.type == MESSAGE_HELLO
+                && (input.message.value & FEATURE_SESSION)) {
+            info->features = input.message.value | FEATURE_BINARY;
+            info->stage = STAGE_IDLE;
+            return;
+        }
+        close_server(&info->server);
+        if (connect_to_server(&info->server, info->server.port)
+                != SUCCESS) {
+            fail_agent(info, match);
+            return;
+        }
+        send_hello(info, false);
+        info->stage = STAGE_GREETING_TEXT;
+        return;
+    }
+
+    int features = taken == 1 ? parse_hello(&input.fields) : -1;
+    if (features == -1) {
+        close_server(&info->server);
+        features = 0;
+    }
+    info->features = features;
+    info->stage = STAGE_IDLE;
+}
+
+/**
+ * Read the server's answer to a match request, skipping anything but the
+ * MATCH as play_next_match does
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match to be initialised
+ *
+ */
+static void advance_matching(AgentInfo* info, Match* match) {
+    Input input;
+    int taken;
+    while ((taken = take_input(&info->server.from,
+            info->features & FEATURE_BINARY, &input)) == 1) {
+        ClientError err = match_from_input(info, &input, match);
+        if (err == SUCCESS) {
+            begin_match(info, match);
+            return;
+        }
+        if (err == INVALID_PORT) {
+            break;
+        }
+    }
+    if (taken != 0) {
+        fail_agent(info, match);
+    }
+}
+
+/**
+ * Read the server's calls on a refereed match, sending the next move for
+ * each round that goes on
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match
+ *
+ */
+static void advance_refereed(AgentInfo* info, Match* match) {
+    Input input;
+    int taken;
+    while ((taken = take_input(&info->server.from,
+            info->features & FEATURE_BINARY, &input)) == 1) {
+        bool over;
+        if (!referee_call_from_input(info, &input, match, &over)) {
+            break;
+        }
+        if (over) {
+            use_moves(info, match->round);
+            become_idle(info);
+            return;
+        }
+        send_referee_move(info, match);
+    }
+    if (taken != 0) {
+        fail_agent(info, match);
+    }
+}
+
+/**
+ * Accept the opponent's connection, if it has arrived. socketFd should not
+ * block.
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match
+ *
+ */
+static void advance_accepting(AgentInfo* info, Match* match) {
+    int opponentFd = accept(info->socketFd, 0, 0);
+    if (opponentFd == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            fail_agent(info, match);
+        }
+        return;
+    }
+    reset_scanner(&info->opponent, opponentFd);
+    info->stage = match->ready ? STAGE_READYING : STAGE_PLAYING;
+}
+
+/**
+ * Find out whether the opponent switched to frames, from the first bytes
+ * they sent
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match
+ *
+ * Returns false if not enough has arrived to tell yet
+ *
+ */
+static bool check_opponent_magic(AgentInfo* info, Match* match) {
+    if (match->magicChecked) {
+        return true;
+    }
+    bool open = read_available(&info->opponent);
+    int magic = take_magic(&info->opponent);
+    if (magic == 0 && open) {
+        return false;
+    }
+    match->opponentBinary = magic == 1;
+    match->magicChecked = true;
+    return true;
+}
+
+/**
+ * Read the opponent's READY, then send them the first window of moves
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match
+ *
+ */
+static void advance_readying(AgentInfo* info, Match* match) {
+    if (!check_opponent_magic(info, match)) {
+        return;
+    }
+    Input input;
+    int taken = take_input(&info->opponent, match->opponentBinary, &input);
+    if (taken == 0) {
+        return;
+    }
+    if (taken == -1 || !is_ready(&input)) {
+        fail_agent(info, match);
+        return;
+    }
+    send_window(info, match);
+    info->stage = STAGE_PLAYING;
+}
+
+/**
+ * Score each round as the opponent's move for it arrives, sending the next
+ * window of moves once a window has been scored, and report the result once
+ * the match is decided
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match
+ *
+ */
+static void advance_playing(AgentInfo* info, Match* match) {
+    if (!check_opponent_magic(info, match)) {
+        return;
+    }
+    while (match->round < match->sent) {
+        Input input;
+        int taken = take_input(&info->opponent, match->opponentBinary,
+                &input);
+        if (taken == 0) {
+            return;
+        }
+        // a move that never comes is SCISSORS, as with read_move_message
+        MoveType move = taken == 1 ? move_from_input(&input) : SCISSORS;
+        if (score_round(info, match, move)) {
+            finish_match(info, match);
+            end_play(info, match);
+            become_idle(info);
+            return;
+        }
+        if (match->round == match->sent) {
+            send_window(info, match);
+        }
+    }
+}
+
+/**
+ * Connect to the rpsserver and send it a HELLO in frames, leaving the answer
+ * for advance_agent.
+ *
+ * info (AgentInfo*): the agent
+ *
+ * Returns SUCCESS if successful, otherwise the appropriate error.
+ *
+ */
+ClientError start_session(AgentInfo* info) {
+    ClientError err;
+    if ((err = connect_to_server(&info->server, info->server.port))
+            != SUCCESS) {
+        return err;
+    }
+    send_hello(info, true);
+    info->stage = STAGE_GREETING;
+    return SUCCESS;
+}
+
+/**
+ * Send an idle agent's next match request, leaving the MATCH for
+ * advance_agent.
+ *
+ * info (AgentInfo*): the agent
+ *
+ * Returns SUCCESS if successful, otherwise the appropriate error.
+ *
+ */
+ClientError request_match(AgentInfo* info) {
+    ClientError err;
+    if (!(info->features & FEATURE_SESSION)
+            && (err = connect_to_server(&info->server, info->server.port))
+            != SUCCESS) {
+        return err;
+    }
+    send_match_request(info);
+    info->stage = STAGE_MATCHING;
+    return SUCCESS;
+}
+
+/**
+ * Take an agent as far as what has arrived allows. The server only ever
+ * answers the agent, so if it sends anything while the agent is not waiting
+ * on it, all there is to do is to notice it hanging up.
+ *
+ * info (AgentInfo*): the agent
+ * match (Match*): the match it is playing, or will be
+ * fromServer (bool): the server sent something, rather than the opponent
+ *
+ * Returns the stage the agent is at now
+ *
+ */
+AgentStage advance_agent(AgentInfo* info, Match* match, bool fromServer) {
+    AgentStage stage;
+    do {
+        stage = info->stage;
+        switch (stage) {
+            case STAGE_GREETING:
+            case STAGE_GREETING_TEXT:
+                advance_greeting(info, match);
+                break;
+            case STAGE_MATCHING:
+                advance_matching(info, match);
+                break;
+            case STAGE_REFEREED:
+                advance_refereed(info, match);
+                break;
+            case STAGE_ACCEPTING:
+                advance_accepting(info, match);
+                break;
+            case STAGE_READYING:
+                advance_readying(info, match);
+                break;
+            case STAGE_PLAYING:
+                advance_playing(info, match);
+                break;
+            default:
+                break;
+        }
+    } while (info->stage != stage);
+
+    bool waiting = stage == STAGE_GREETING || stage == STAGE_GREETING_TEXT
+            || stage == STAGE_MATCHING || stage == STAGE_REFEREED;
+    if (fromServer && !waiting && info->server.to != NULL
+            && !read_available(&info->server.from)) {
+        fail_agent(info, match);
+    }
+    return info->stage;
+}
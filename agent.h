@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "shared.h"
+#include "frame.h"
+
+#ifndef AGENT_H
+#define AGENT_H
+
+// The rounds sent in each write when pipelining. At least five rounds are
+// always played, so the first window is never wasted.
+#define PIPELINE_WINDOW 5
+// The Features the client asks the server for
+#define CLIENT_FEATURES (FEATURE_SESSION | FEATURE_READY | FEATURE_PIPELINE \
+        | FEATURE_REFEREE)
+
+/**
+ * Represents the information for a server
+ *
+ * port: the port of the server
+ * to: file descriptor, the server is listening to this
+ * from: buffers what the server writes to us
+ * address: the resolved address of the server, so reconnecting does not
+ * need another lookup
+ * addressLength: the length of address, 0 if it has not been resolved
+ *
+ */
+typedef struct Server {
+    char* port;
+    FILE* to;
+    Scanner from;
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+} Server;
+
+/**
+ * Represents the information for a match from the perspective of an agent.
+ *
+ * id: the id of this match
+ * opponentName: the name of the opponent in the match
+ * port: the port to connect to, to play
+ * opponentScore: the score of the opponent
+ * playerScore: the score of the agent
+ * result: the result of the match
+ * server: the server information for the opponent
+ * ready: both players confirm their connections with READY before moves
+ * binary: the opponent reads frames rather than lines
+ * pipeline: both players send their moves PIPELINE_WINDOW rounds at a time
+ * refereed: the match is played through the rpsserver rather than with the
+ * opponent directly
+ * round: the rounds scored so far, when played by advance_agent
+ * sent: the rounds whose moves have been sent, when played by advance_agent
+ * opponentBinary: the opponent switched to frames
+ * magicChecked: whether the opponent switched to frames is known yet
+ *
+ */
+typedef struct Match {
+    int id;
+    char* opponentName;
+    char* port;
+    int opponentScore;
+    int playerScore;
+    GameResult result;
+    Server server;
+    bool ready;
+    bool binary;
+    bool pipeline;
+    bool refereed;
+    int round;
+    int sent;
+    bool opponentBinary;
+    bool magicChecked;
+} Match;
+
+/**
+ * How far an agent driven by advance_agent has got. Every stage but the idle
+ * and failed ones waits on input from the rpsserver or the opponent.
+ */
+typedef enum AgentStage {
+    STAGE_GREETING, // sent a HELLO in frames
+    STAGE_GREETING_TEXT, // sent a HELLO in text, as frames were refused
+    STAGE_IDLE, // between matches, nothing is expected
+    STAGE_MATCHING, // sent an MR
+    STAGE_REFEREED, // sent a move to the rpsserver refereeing the match
+    STAGE_ACCEPTING, // connected to the opponent, who has to connect to us
+    STAGE_READYING, // waiting for the opponent's READY
+    STAGE_PLAYING, // waiting for the opponent's moves
+    STAGE_FAILED // gave up, with every connection but socketFd closed
+} AgentStage;
+
+/**
+ * Represents an agent/client that can play a match.
+ *
+ * name: the name of this agent
+ * numMatches: the number of matches this agent will play
+ * matchesRemaining: the number of matches this agent has left to play
+ * port: the port this agent is listening on
+ * socketFd: the fd agent is listening to 
+ * server: the rpsserver info
+ * matches: the matches that this agent will play
+ * features: the protocol features agreed with the rpsserver
+ * names: the names the rpsserver sent us in NAME frames
+ * sentNames: the names we sent the rpsserver in NAME frames
+ * opponent: buffers what the opponent in the current match sends us
+ * moves: moves drawn but not played yet, a match may look ahead at moves
+ * it then does not get to play
+ * numMoves: the number of moves drawn but not played yet
+ * ownSeed: moves are drawn with rand_r from seed rather than with rand, for
+ * agents sharing a process
+ * seed: the state of the agent's moves, if ownSeed is set
+ * stage: how far the agent has got, when driven by advance_agent
+ *
+ */
+typedef struct AgentInfo {
+    char* name;
+    int numMatches;
+    int matchesRemaining;
+    int port;
+    int socketFd;
+    Server server;
+    Match* matches;
+    int features;
+    NameTable names;
+    NameTable sentNames;
+    Scanner opponent;
+    MoveType moves[MAX_ROUNDS];
+    int numMoves;
+    bool ownSeed;
+    unsigned int seed;
+    AgentStage stage;
+} AgentInfo;
+
+/** 
+ * The possible errors, as per the specification, includes an UNSPECIFIED
+ * type for situations not being tested.
+ */
+typedef enum ClientError {
+    SUCCESS,
+    INCORRECT_ARG_COUNT,
+    INVALID_NAME,
+    INVALID_MATCH_COUNT,
+    INVALID_PORT,
+    UNSPECIFIED
+} ClientError;
+
+// Returns a server that is not connected yet.
+Server init_server();
+
+// Returns an agent with no name, no matches and no connections yet.
+AgentInfo init_agent();
+
+// Closes the connection to a server, if it is open.
+void close_server(Server* server);
+
+// Closes the connection to a server and frees its buffers.
+void free_server(Server* server);
+
+// Frees everything a match holds, but not the match itself.
+void free_match(Match* match);
+
+// Frees everything an agent holds, including its matches.
+void free_agent(AgentInfo* info);
+
+// Connects to port on localhost, resolving it the first time only.
+ClientError connect_to_server(Server* info, char* port);
+
+// Connects to the rpsserver at info->server.port and agrees on the features
+// the connection will use, in info->features.
+ClientError open_session(AgentInfo* info);
+
+// Listens on an ephemeral port on localhost for opponents to connect to.
+ClientError listen_on_ephemeral(int* port, int* socketFd);
+
+// Sends a match request for the agent to the rpsserver.
+void send_match_request(AgentInfo* info);
+
+// Reports the result of a finished match to the rpsserver.
+void send_match_result(AgentInfo* info, Match* match);
+
+// Reads the MATCH the rpsserver sends in answer to a match request.
+ClientError read_match_message(AgentInfo* info, Match* match);
+
+// Plays a match that has been read with read_match_message, either with the
+// opponent directly or through the rpsserver, and reports its result if it
+// is not refereed.
+ClientError play_match(AgentInfo* info, Match* match);
+
+// Requests, waits for and plays the agent's next match, reconnecting first
+// if the agent has no session.
+ClientError play_next_match(AgentInfo* info, Match* match);
+
+// Connects to the rpsserver and sends it a HELLO in frames, without waiting
+// for the answer: advance_agent reads it once it arrives.
+ClientError start_session(AgentInfo* info);
+
+// Sends the agent's next match request without waiting for the MATCH,
+// reconnecting first if the agent has no session.
+ClientError request_match(AgentInfo* info);
+
+// Takes the agent as far through its session and match as what has arrived
+// from the rpsserver and its opponent allows, without waiting for more.
+// fromServer says the rpsserver sent something. Returns the stage the agent
+// is at now.
+AgentStage advance_agent(AgentInfo* info, Match* match, bool fromServer);
+
+#endif
@@ -0,0 +1,134 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Round a size up to a multiple of ARENA_ALIGNMENT
+ *
+ * size (size_t): the size
+ *
+ * Returns the rounded size
+ *
+ */
+static size_t align_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+}
+
+void init_arena(Arena* arena) {
+    arena->chunks = NULL;
+    arena->used = 0;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = align_size(size);
+    ArenaChunk* chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - arena->used < size) {
+        // each chunk doubles the last, so a long-lived arena needs few
+        size_t chunkSize = chunk == NULL ? ARENA_CHUNK_SIZE : chunk->size * 2;
+        while (chunkSize < size) {
+            chunkSize *= 2;
+        }
+        ArenaChunk* fresh = malloc(align_size(sizeof(ArenaChunk))
+                + chunkSize);
+        if (fresh == NULL) {
+            return NULL;
+        }
+        fresh->next = chunk;
+        fresh->size = chunkSize;
+        arena->chunks = chunk = fresh;
+        arena->used = 0;
+    }
+
+    // data follows the header, which is padded out to the alignment
+    char* memory = (char*) chunk + align_size(sizeof(ArenaChunk))
+            + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+char* arena_strndup(Arena* arena, const char* string, size_t length) {
+    length = strnlen(string, length);
+    char* copy = arena_alloc(arena, length + 1);
+    if (copy != NULL) {
+        memcpy(copy, string, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+void reset_arena(Arena* arena) {
+    ArenaChunk* chunk = arena->chunks;
+    if (chunk == NULL) {
+        return;
+    }
+    // keep the oldest, smallest chunk, which is all most arenas need
+    while (chunk->next != NULL) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = chunk;
+    arena->used = 0;
+}
+
+void free_arena(Arena* arena) {
+    reset_arena(arena);
+    free(arena->chunks);
+    init_arena(arena);
+}
+
+void init_slab_pool(SlabPool* pool, size_t recordSize) {
+    // records are linked through their first bytes while free
+    pool->recordSize = align_size(recordSize > sizeof(void*) ? recordSize
+            : sizeof(void*));
+    pool->freeRecords = NULL;
+    pool->slabs = 0;
+    pool->inUse = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+void* slab_record(SlabPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->freeRecords == NULL) {
+        char* slab = calloc(SLAB_RECORDS, pool->recordSize);
+        if (slab == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        for (int i = SLAB_RECORDS - 1; i >= 0; i--) {
+            void* record = slab + i * pool->recordSize;
+            *(void**) record = pool->freeRecords;
+            pool->freeRecords = record;
+        }
+        pool->slabs++;
+    }
+    void* record = pool->freeRecords;
+    pool->freeRecords = *(void**) record;
+    pool->inUse++;
+    pthread_mutex_unlock(&pool->lock);
+
+    // a record fresh from its slab was zeroed apart from the link
+    *(void**) record = NULL;
+    return record;
+}
+
+void release_slab_record(SlabPool* pool, void* record) {
+    pthread_mutex_lock(&pool->lock);
+    *(void**) record = pool->freeRecords;
+    pool->freeRecords = record;
+    pool->inUse--;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void print_slab_stats(SlabPool* pool, char* name, FILE* stream) {
+    pthread_mutex_lock(&pool->lock);
+    unsigned long slabs = pool->slabs;
+    unsigned long inUse = pool->inUse;
+    pthread_mutex_unlock(&pool->lock);
+
+    fprintf(stream, "slab %s_records %lu\n", name, slabs * SLAB_RECORDS);
+    fprintf(stream, "slab %s_in_use %lu\n", name, inUse);
+    fprintf(stream, "slab %s_bytes %zu\n", name,
+            slabs * SLAB_RECORDS * pool->recordSize);
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifndef ARENA_H
+#define ARENA_H
+
+// The size of the first chunk of an arena, later chunks are at least as big
+#define ARENA_CHUNK_SIZE 1024
+// Every allocation from an arena is aligned to this many bytes
+#define ARENA_ALIGNMENT 16
+// The number of records a slab pool carves out of each allocation
+#define SLAB_RECORDS 64
+
+/**
+ * A chunk of memory an arena hands out allocations from, which follows this
+ * header (padded out to ARENA_ALIGNMENT)
+ *
+ * next (struct ArenaChunk*): the chunk allocated before this one
+ * size (size_t): the bytes of memory after the header
+ *
+ */
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;
+} ArenaChunk;
+
+/**
+ * Memory handed out by bumping a pointer through a list of chunks, and given
+ * back all at once. Everything a connection allocates for its lifetime comes
+ * from its arena, so closing it frees nothing piece by piece. An arena that
+ * is all zeroes is empty. Not thread safe.
+ *
+ * chunks (ArenaChunk*): the chunks, the newest (being handed out) first
+ * used (size_t): the bytes of the newest chunk handed out
+ *
+ */
+typedef struct Arena {
+    ArenaChunk* chunks;
+    size_t used;
+} Arena;
+
+/**
+ * Records of a single fixed size, carved SLAB_RECORDS at a time out of one
+ * allocation and kept on a free list once released. Records are never given
+ * back to malloc, so a pool is as big as the most records ever in use at
+ * once. A record is zeroed the first time it is handed out, and keeps its
+ * contents when released other than its first pointer's worth of bytes,
+ * which link it into the free list. Thread safe.
+ *
+ * recordSize (size_t): the size of each record, rounded up to
+ * ARENA_ALIGNMENT
+ * freeRecords (void*): released records, linked through their first bytes
+ * slabs (unsigned long): the number of slabs allocated
+ * inUse (unsigned long): the number of records handed out
+ * lock (pthread_mutex_t): guards everything above
+ *
+ */
+typedef struct SlabPool {
+    size_t recordSize;
+    void* freeRecords;
+    unsigned long slabs;
+    unsigned long inUse;
+    pthread_mutex_t lock;
+} SlabPool;
+
+// Initialises an empty arena.
+void init_arena(Arena* arena);
+
+// Returns size bytes from the arena, aligned to ARENA_ALIGNMENT, or NULL if
+// they could not be allocated. They last until the arena is reset or freed.
+void* arena_alloc(Arena* arena, size_t size);
+
+// Returns a copy of the first length bytes of string, terminated, allocated
+// from the arena (or NULL).
+char* arena_strndup(Arena* arena, const char* string, size_t length);
+
+// Gives back everything allocated from the arena, keeping its first chunk
+// to hand out again.
+void reset_arena(Arena* arena);
+
+// Frees every chunk of the arena, leaving it empty.
+void free_arena(Arena* arena);
+
+// Initialises an empty pool of records of recordSize bytes.
+void init_slab_pool(SlabPool* pool, size_t recordSize);
+
+// Returns a record, reusing a released one if there is one, or NULL if a new
+// slab could not be allocated.
+void* slab_record(SlabPool* pool);
+
+// Gives a record from slab_record back to the pool.
+void release_slab_record(SlabPool* pool, void* record);
+
+// Prints the pool's counters, in the format "slab <name>_<key> <value>".
+void print_slab_stats(SlabPool* pool, char* name, FILE* stream);
+
+#endif
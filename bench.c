@@ -0,0 +1,575 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "shared.h"
+#include "frame.h"
+#include "server.h"
+
+// The most producer and consumer threads the channel benchmarks use
+// without -t
+#define DEFAULT_THREADS 4
+// The number of elements passed through a channel per benchmark
+#define CHANNEL_OPS (1 << 19)
+// The capacity of a lock-free channel, as the server sizes them
+#define CHANNEL_CAPACITY 1024
+// The number of messages parsed per benchmark
+#define PARSE_OPS 1000000
+// The number of short lines scanned per benchmark
+#define SHORT_LINES 1000000
+// The number and length of the long lines scanned per benchmark
+#define LONG_LINES 256
+#define LONG_LINE_LENGTH (64 * 1024)
+// The number of rounds compared per benchmark
+#define COMPARE_OPS 10000000
+// The number of results the standings reports are printed after
+#define NUM_RESULT_SIZES 3
+// Every player in the standings benchmarks has about this many results
+#define RESULTS_PER_PLAYER 10
+// The total number of players printed over the reports of one benchmark
+#define REPORT_PLAYERS 2000000
+
+// The glibc allocator, which the counting allocator below hands on to
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+
+// The number of allocations made so far, by any thread
+static unsigned long allocations;
+
+/**
+ * Replacements for the allocator which count every allocation, including
+ * those made within libc (strdup, asprintf and so on). Memory is still
+ * allocated and freed by glibc.
+ */
+void* malloc(size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(pointer, size);
+}
+
+/**
+ * A benchmark being timed
+ *
+ * start (struct timespec): when timing started
+ * allocations (unsigned long): the allocations made before timing started
+ *
+ */
+typedef struct Timer {
+    struct timespec start;
+    unsigned long allocations;
+} Timer;
+
+/**
+ * The settings of a run
+ *
+ * threads (int): the most producer and consumer threads to use
+ * filter (char*): only benchmarks with names containing this are run, NULL
+ * to run them all
+ *
+ */
+typedef struct Bench {
+    int threads;
+    char* filter;
+} Bench;
+
+/**
+ * One end of a channel benchmark, run on its own thread
+ *
+ * channel (struct Channel*): the channel being benchmarked
+ * count (unsigned long): the number of elements this thread writes or reads
+ *
+ */
+typedef struct ChannelWorker {
+    struct Channel* channel;
+    unsigned long count;
+} ChannelWorker;
+
+/**
+ * Check whether a benchmark should be run
+ *
+ * bench (Bench*): the run
+ * name (char*): the name of the benchmark
+ *
+ * Returns true if the benchmark was not filtered out
+ *
+ */
+static bool wanted(Bench* bench, char* name) {
+    return bench->filter == NULL || strstr(name, bench->filter) != NULL;
+}
+
+/**
+ * Start timing a benchmark
+ *
+ * timer (Timer*): the timer
+ *
+ */
+static void start_timer(Timer* timer) {
+    timer->allocations = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &timer->start);
+}
+
+/**
+ * Stop timing a benchmark and print the time and allocations per operation
+ *
+ * timer (Timer*): the timer, as started
+ * name (char*): the name of the benchmark
+ * ops (unsigned long): the number of operations timed
+ *
+ */
+static void stop_timer(Timer* timer, char* name, unsigned long ops) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long made = __atomic_load_n(&allocations, __ATOMIC_RELAXED)
+            - timer->allocations;
+    double nanos = (now.tv_sec - timer->start.tv_sec) * 1e9
+            + (now.tv_nsec - timer->start.tv_nsec);
+
+    printf("%-32s %10lu %12.1f ns/op %10.2f allocs/op\n", name, ops,
+            nanos / ops, (double) made / ops);
+    fflush(stdout);
+}
+
+/**
+ * Write elements to a channel, waiting whenever it is full
+ *
+ * workerArg (void*): the ChannelWorker
+ *
+ * Returns NULL
+ *
+ */
+static void* produce(void* workerArg) {
+    ChannelWorker* worker = (ChannelWorker*) workerArg;
+    Result result = {.player = 0, .opponent = NO_PLAYER, .result = WIN};
+    for (unsigned long i = 0; i < worker->count; i++) {
+        write_channel(worker->channel, (void*) &result);
+    }
+    return NULL;
+}
+
+/**
+ * Read elements from a channel, waiting whenever it is empty
+ *
+ * workerArg (void*): the ChannelWorker
+ *
+ * Returns NULL
+ *
+ */
+static void* consume(void* workerArg) {
+    ChannelWorker* worker = (ChannelWorker*) workerArg;
+    Result result;
+    unsigned long taken = 0;
+    while (taken < worker->count) {
+        if (read_channel(worker->channel, (void**) &result)) {
+            taken++;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Split the elements of a channel benchmark between threads
+ *
+ * workers (ChannelWorker*): the threads' share of the work
+ * count (int): the number of threads
+ * channel (struct Channel*): the channel being benchmarked
+ *
+ */
+static void share_work(ChannelWorker* workers, int count,
+        struct Channel* channel) {
+    for (int i = 0; i < count; i++) {
+        workers[i].channel = channel;
+        workers[i].count = CHANNEL_OPS / count
+                + (i < CHANNEL_OPS % count ? 1 : 0);
+    }
+}
+
+/**
+ * Pass elements through a channel from producer threads to consumer threads
+ *
+ * bench (Bench*): the run
+ * lockFree (bool): whether the channel is backed by a lock-free ring
+ * producers (int): the number of threads writing
+ * consumers (int): the number of threads reading
+ *
+ */
+static void bench_channel(Bench* bench, bool lockFree, int producers,
+        int consumers) {
+    char name[64];
+    snprintf(name, sizeof(name), "channel/%s/%dx%d",
+            lockFree ? "ring" : "queue", producers, consumers);
+    if (!wanted(bench, name)) {
+        return;
+    }
+
+    struct Channel channel = lockFree
+            ? new_ring_channel(sizeof(Result), CHANNEL_CAPACITY)
+            : new_channel(sizeof(Result));
+    // a full ring makes producers wait rather than drop elements
+    set_channel_limit(&channel, 0, WRITE_BLOCKING, 0);
+    ChannelWorker writers[producers], readers[consumers];
+    pthread_t ids[producers + consumers];
+    share_work(writers, producers, &channel);
+    share_work(readers, consumers, &channel);
+
+    Timer timer;
+    start_timer(&timer);
+    for (int i = 0; i < consumers; i++) {
+        pthread_create(&ids[i], NULL, consume, (void*) &readers[i]);
+    }
+    for (int i = 0; i < producers; i++) {
+        pthread_create(&ids[consumers + i], NULL, produce,
+                (void*) &writers[i]);
+    }
+    for (int i = 0; i < producers + consumers; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    stop_timer(&timer, name, CHANNEL_OPS);
+    destroy_channel(&channel, NULL);
+}
+
+/**
+ * Set up a scanner as if input had just been read into it, without a
+ * connection behind it
+ *
+ * scanner (Scanner*): the scanner
+ * input (char*): the input, which the scanner copies
+ * length (size_t): the length of the input
+ *
+ */
+static void fill_with(Scanner* scanner, char* input, size_t length) {
+    init_scanner(scanner, -1);
+    scanner->buffer = malloc(length);
+    memcpy(scanner->buffer, input, length);
+    scanner->size = scanner->end = length;
+}
+
+/**
+ * Scan lines out of a buffer of input, as the server does for every message
+ *
+ * bench (Bench*): the run
+ * name (char*): the name of the benchmark
+ * lines (size_t): the number of lines in the input
+ * lineLength (size_t): the length of each line, including its newline
+ *
+ */
+static void bench_scan_line(Bench* bench, char* name, size_t lines,
+        size_t lineLength) {
+    if (!wanted(bench, name)) {
+        return;
+    }
+    char* input = malloc(lines * lineLength);
+    for (size_t i = 0; i < lines; i++) {
+        char* line = input + i * lineLength;
+        memset(line, 'x', lineLength - 1);
+        memcpy(line, "MR:", 3);
+        line[lineLength - 1] = '\n';
+    }
+    Scanner scanner;
+    fill_with(&scanner, input, lines * lineLength);
+    free(input);
+
+    Slice line;
+    Timer timer;
+    start_timer(&timer);
+    for (size_t i = 0; i < lines; i++) {
+        scan_line(&scanner, &line);
+    }
+    stop_timer(&timer, name, lines);
+    destroy_scanner(&scanner);
+}
+
+/**
+ * Parse MR lines into a request, as read_match_message does once the line
+ * has been scanned
+ *
+ * bench (Bench*): the run
+ *
+ */
+static void bench_parse_match_request(Bench* bench) {
+    char* name = "parse/match_request/text";
+    if (!wanted(bench, name)) {
+        return;
+    }
+    char* message = "MR:player1234:45678";
+    size_t length = strlen(message);
+    char line[MAX_HELLO_LENGTH];
+    Fields fields;
+    Slice player, port;
+
+    Timer timer;
+    start_timer(&timer);
+    for (int i = 0; i < PARSE_OPS; i++) {
+        // split_line terminates the fields in place
+        memcpy(line, message, length + 1);
+        split_line(line, length, &fields);
+        if (parse_hello(&fields) != -1
+                || !parse_match_request(&fields, &player, &port)) {
+            break;
+        }
+        Request request = {.player = intern_player(player.start)};
+        memcpy(request.port, port.start, port.length);
+        request.port[port.length] = '\0';
+    }
+    stop_timer(&timer, name, PARSE_OPS);
+}
+
+/**
+ * Decode MR frames into a request, as read_match_frame does once the frame
+ * has been scanned
+ *
+ * bench (Bench*): the run
+ *
+ */
+static void bench_parse_match_frame(Bench* bench) {
+    char* name = "parse/match_request/frame";
+    if (!wanted(bench, name)) {
+        return;
+    }
+    NameTable names;
+    init_names(&names);
+    Message message = {.type = MESSAGE_MR,
+            .id = add_name(&names, "player1234"), .port = 45678};
+    unsigned char frame[MAX_FRAME_LENGTH];
+    int length = encode_message(&message, frame);
+    Request request;
+
+    Timer timer;
+    start_timer(&timer);
+    for (int i = 0; i < PARSE_OPS; i++) {
+        if (decode_message(frame, length, &message) != length
+                || !parse_match_frame(&message, &names, &request.player,
+                request.port)) {
+            break;
+        }
+    }
+    stop_timer(&timer, name, PARSE_OPS);
+    free_names(&names);
+}
+
+/**
+ * Parse RESULT lines, as read_result_message does once the line has been
+ * scanned
+ *
+ * bench (Bench*): the run
+ *
+ */
+static void bench_parse_result_message(Bench* bench) {
+    char* name = "parse/result/text";
+    if (!wanted(bench, name)) {
+        return;
+    }
+    char* message = "RESULT:123456:player1234";
+    size_t length = strlen(message);
+    char line[MAX_HELLO_LENGTH];
+    Fields fields;
+    int wins = 0;
+
+    Timer timer;
+    start_timer(&timer);
+    for (int i = 0; i < PARSE_OPS; i++) {
+        memcpy(line, message, length + 1);
+        split_line(line, length, &fields);
+        wins += parse_result_message(&fields, "player1234") == WIN;
+    }
+    stop_timer(&timer, name, PARSE_OPS);
+    if (wins != PARSE_OPS) {
+        fprintf(stderr, "%s: parsed the wrong result\n", name);
+    }
+}
+
+/**
+ * Decode RESULT frames, as read_result_message does once the frame has been
+ * scanned
+ *
+ * bench (Bench*): the run
+ *
+ */
+static void bench_parse_result_frame(Bench* bench) {
+    char* name = "parse/result/frame";
+    if (!wanted(bench, name)) {
+        return;
+    }
+    Message message = {.type = MESSAGE_RESULT, .id = 123456, .value = WIN};
+    unsigned char frame[MAX_FRAME_LENGTH];
+    int length = encode_message(&message, frame);
+    int wins = 0;
+
+    Timer timer;
+    start_timer(&timer);
+    for (int i = 0; i < PARSE_OPS; i++) {
+        decode_message(frame, length, &message);
+        wins += parse_result_frame(&message) == WIN;
+    }
+    stop_timer(&timer, name, PARSE_OPS);
+    if (wins != PARSE_OPS) {
+        fprintf(stderr, "%s: decoded the wrong result\n", name);
+    }
+}
+
+/**
+ * Score rounds of every combination of moves
+ *
+ * bench (Bench*): the run
+ *
+ */
+static void bench_compare_moves(Bench* bench) {
+    char* name = "compare_moves";
+    if (!wanted(bench, name)) {
+        return;
+    }
+    int scores[3] = {0, 0, 0};
+
+    Timer timer;
+    start_timer(&timer);
+    for (int i = 0; i < COMPARE_OPS; i++) {
+        scores[compare_moves(i % 3, (i / 3) % 3)]++;
+    }
+    stop_timer(&timer, name, COMPARE_OPS);
+    if (scores[WIN] != scores[LOSE]) {
+        fprintf(stderr, "%s: wins and losses do not match\n", name);
+    }
+}
+
+/**
+ * Record results into the standings, then print reports of them the way
+ * print_results does (to /dev/null rather than stdout)
+ *
+ * bench (Bench*): the run
+ * numResults (int): the number of results to record
+ *
+ */
+static void bench_results(Bench* bench, int numResults) {
+    char recordName[64], reportName[64];
+    snprintf(recordName, sizeof(recordName), "record_result/%d", numResults);
+    snprintf(reportName, sizeof(reportName), "print_results/%d", numResults);
+    bool record = wanted(bench, recordName);
+    bool report = wanted(bench, reportName);
+    if (!record && !report) {
+        return;
+    }
+
+    int numPlayers = numResults / RESULTS_PER_PLAYER;
+    PlayerId* players = malloc(sizeof(PlayerId) * numPlayers);
+    for (int i = 0; i < numPlayers; i++) {
+        char* playerName;
+        asprintf(&playerName, "player%d", i);
+        players[i] = intern_player(playerName);
+        free(playerName);
+    }
+    Standings standings;
+    init_standings(&standings);
+
+    Timer timer;
+    start_timer(&timer);
+    for (int i = 0; i < numResults; i++) {
+        // every player meets a different opponent each time
+        int player = i % numPlayers;
+        int opponent = (player + 1 + i / numPlayers) % numPlayers;
+        record_player_result(&standings, players[player], players[opponent],
+                (GameResult) (i % 3));
+    }
+    if (record) {
+        stop_timer(&timer, recordName, numResults);
+    }
+
+    if (report) {
+        FILE* devNull = fopen("/dev/null", "w");
+        int reports = REPORT_PLAYERS / numPlayers;
+        start_timer(&timer);
+        for (int i = 0; i < reports; i++) {
+            Snapshot snapshot = {.players = NULL, .numPlayers = 0,
+                    .capacity = 0};
+            take_snapshot(&standings, &snapshot);
+            print_snapshot(&snapshot, devNull);
+            free(snapshot.players);
+        }
+        stop_timer(&timer, reportName, reports);
+        fclose(devNull);
+    }
+
+    // the names stay interned, as they would in the server
+    free(players);
+}
+
+/**
+ * Parse the command line arguments of a run
+ *
+ * argc (int): the number of arguments
+ * argv (char**): the arguments
+ * bench (Bench*): the run to configure
+ *
+ * Returns true if the arguments were valid
+ *
+ */
+static bool parse_args(int argc, char** argv, Bench* bench) {
+    bench->threads = DEFAULT_THREADS;
+    bench->filter = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        char* end;
+        switch (opt) {
+            case 't':
+                bench->threads = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || bench->threads < 1) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    if (optind < argc - 1) {
+        return false;
+    }
+    if (optind == argc - 1) {
+        bench->filter = argv[optind];
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Bench bench;
+    if (!parse_args(argc, argv, &bench)) {
+        fprintf(stderr, "Usage: rpsbench [-t threads] [filter]\n");
+        return 1;
+    }
+
+    for (int lockFree = 0; lockFree < 2; lockFree++) {
+        for (int producers = 1; producers <= bench.threads; producers *= 2) {
+            for (int consumers = 1; consumers <= bench.threads;
+                    consumers *= 2) {
+                bench_channel(&bench, lockFree, producers, consumers);
+            }
+        }
+    }
+
+    bench_scan_line(&bench, "scan_line/short", SHORT_LINES, 20);
+    bench_scan_line(&bench, "scan_line/long", LONG_LINES, LONG_LINE_LENGTH);
+    bench_parse_match_request(&bench);
+    bench_parse_match_frame(&bench);
+    bench_parse_result_message(&bench);
+    bench_parse_result_frame(&bench);
+    bench_compare_moves(&bench);
+
+    int sizes[NUM_RESULT_SIZES] = {1000, 100000, 1000000};
+    for (int i = 0; i < NUM_RESULT_SIZES; i++) {
+        bench_results(&bench, sizes[i]);
+    }
+    return 0;
+}
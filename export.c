@@ -0,0 +1,270 @@
+#define _GNU_SOURCE
+
+#include "export.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+bool init_export(ExportLog* log, char* path) {
+    memset(log, 0, sizeof(ExportLog));
+    log->path = path;
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->wake, NULL);
+    log->block = malloc(sizeof(ExportBlock));
+    char* spillPath;
+    if (log->block == NULL
+            || asprintf(&spillPath, "%s.rows", path) == -1) {
+        return false;
+    }
+    // unlinked straight away, so it is gone once the server is
+    log->spillFd = open(spillPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+            0600);
+    if (log->spillFd != -1) {
+        unlink(spillPath);
+    }
+    free(spillPath);
+    return log->spillFd != -1;
+}
+
+/**
+ * Write a block to the end of the scratch file
+ *
+ * fd (int): the scratch file
+ * block (ExportBlock*): the block
+ * index (size_t): the number of blocks before it
+ *
+ * Returns false (with errno set) if it could not be written
+ *
+ */
+static bool spill_block(int fd, ExportBlock* block, size_t index) {
+    char* data = (char*) block;
+    size_t length = sizeof(ExportBlock);
+    off_t offset = index * sizeof(ExportBlock);
+    while (length > 0) {
+        ssize_t count = pwrite(fd, data, length, offset);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        data += count;
+        length -= count;
+        offset += count;
+    }
+    return true;
+}
+
+void export_result(ExportLog* log, int match, PlayerId player,
+        PlayerId opponent, GameResult result) {
+    pthread_mutex_lock(&log->lock);
+    if (log->spillError != 0) {
+        pthread_mutex_unlock(&log->lock);
+        return;
+    }
+    size_t row = log->numRows % EXPORT_BLOCK_ROWS;
+    ExportBlock* block = log->block;
+    block->players[row] = player;
+    block->opponents[row] = opponent == NO_PLAYER ? EXPORT_NO_OPPONENT
+            : opponent;
+    block->matches[row] = match;
+    block->outcomes[row] = result;
+    log->numRows++;
+    if (row == EXPORT_BLOCK_ROWS - 1) {
+        // the block is full, so it goes to scratch and is reused
+        if (spill_block(log->spillFd, block, log->numSpilled)) {
+            log->numSpilled++;
+        } else {
+            log->spillError = errno;
+            log->numRows -= EXPORT_BLOCK_ROWS;
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+}
+
+/**
+ * Round an offset in the file up to the alignment of its sections
+ *
+ * offset (uint64_t): the offset
+ *
+ * Returns the aligned offset
+ *
+ */
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+/**
+ * Write one column of the rows, a block at a time, padded to the alignment
+ * of the next section. Spilled blocks are read back from the scratch file a
+ * column at a time.
+ *
+ * file (FILE*): the export file
+ * log (ExportLog*): the export, for its scratch file
+ * numSpilled (size_t): the number of blocks spilled
+ * tail (ExportBlock*): the rows after the spilled blocks
+ * numRows (size_t): the number of rows to write
+ * column (size_t): the offset of the column in an ExportBlock
+ * width (size_t): the size of each value in the column
+ * buffer (char*): room for a block's worth of the widest column
+ *
+ * Returns false if the write failed
+ *
+ */
+static bool write_column(FILE* file, ExportLog* log, size_t numSpilled,
+        ExportBlock* tail, size_t numRows, size_t column, size_t width,
+        char* buffer) {
+    size_t length = EXPORT_BLOCK_ROWS * width;
+    for (size_t i = 0; i < numSpilled; i++) {
+        if (pread(log->spillFd, buffer, length,
+                i * sizeof(ExportBlock) + column) != length
+                || fwrite(buffer, 1, length, file) != length) {
+            return false;
+        }
+    }
+    size_t count = numRows - numSpilled * EXPORT_BLOCK_ROWS;
+    if (fwrite((char*) tail + column, width, count, file) != count) {
+        return false;
+    }
+    static const char padding[8];
+    length = numRows * width;
+    return fwrite(padding, 1, align_offset(length) - length, file)
+            == align_offset(length) - length;
+}
+
+/**
+ * Write every row so far to the export file, replacing it only once the new
+ * file is complete
+ *
+ * log (ExportLog*): the export
+ * tail (ExportBlock*): where to copy the open block
+ * buffer (char*): room for a block's worth of the widest column
+ *
+ * Returns false (with errno set) if it could not be written
+ *
+ */
+static bool write_export(ExportLog* log, ExportBlock* tail, char* buffer) {
+    // spilled blocks never change, so only the open block needs copying to
+    // write them without the lock
+    pthread_mutex_lock(&log->lock);
+    size_t numRows = log->numRows;
+    size_t numSpilled = log->numSpilled;
+    int spillError = log->spillError;
+    memcpy(tail, log->block, sizeof(ExportBlock));
+    pthread_mutex_unlock(&log->lock);
+    if (spillError != 0) {
+        errno = spillError;
+        return false;
+    }
+    // every id in the rows was given out before its row was added
+    size_t numNames = count_players();
+    size_t nameBytes = 0;
+    for (PlayerId id = 0; id < numNames; id++) {
+        nameBytes += strlen(player_name(id)) + 1;
+    }
+
+    ExportHeader header;
+    memset(&header, 0, sizeof(ExportHeader));
+    memcpy(header.magic, EXPORT_MAGIC, sizeof(header.magic));
+    header.numRows = numRows;
+    header.numNames = numNames;
+    header.playerOffset = align_offset(sizeof(ExportHeader));
+    header.opponentOffset = header.playerOffset
+            + align_offset(numRows * sizeof(uint32_t));
+    header.matchOffset = header.opponentOffset
+            + align_offset(numRows * sizeof(uint32_t));
+    header.outcomeOffset = header.matchOffset
+            + align_offset(numRows * sizeof(uint32_t));
+    header.nameIndexOffset = header.outcomeOffset
+            + align_offset(numRows * sizeof(uint8_t));
+    header.nameDataOffset = header.nameIndexOffset
+            + numNames * sizeof(uint64_t);
+    header.size = header.nameDataOffset + nameBytes;
+
+    char* tempPath;
+    if (asprintf(&tempPath, "%s.tmp", log->path) == -1) {
+        return false;
+    }
+    FILE* file = fopen(tempPath, "w");
+    bool written = file != NULL
+            && fwrite(&header, sizeof(ExportHeader), 1, file) == 1
+            && write_column(file, log, numSpilled, tail, numRows,
+            offsetof(ExportBlock, players), sizeof(uint32_t), buffer)
+            && write_column(file, log, numSpilled, tail, numRows,
+            offsetof(ExportBlock, opponents), sizeof(uint32_t), buffer)
+            && write_column(file, log, numSpilled, tail, numRows,
+            offsetof(ExportBlock, matches), sizeof(uint32_t), buffer)
+            && write_column(file, log, numSpilled, tail, numRows,
+            offsetof(ExportBlock, outcomes), sizeof(uint8_t), buffer);
+
+    uint64_t nameStart = 0;
+    for (PlayerId id = 0; written && id < numNames; id++) {
+        written = fwrite(&nameStart, sizeof(uint64_t), 1, file) == 1;
+        nameStart += strlen(player_name(id)) + 1;
+    }
+    for (PlayerId id = 0; written && id < numNames; id++) {
+        char* name = player_name(id);
+        written = fwrite(name, 1, strlen(name) + 1, file)
+                == strlen(name) + 1;
+    }
+    if (file != NULL) {
+        written = fclose(file) == 0 && written;
+    }
+    written = written && rename(tempPath, log->path) == 0;
+    if (!written) {
+        int error = errno;
+        unlink(tempPath);
+        errno = error;
+    }
+    free(tempPath);
+    return written;
+}
+
+/**
+ * Write the export file whenever one is requested, until the server exits
+ *
+ * logArg (void*): the ExportLog
+ *
+ * Returns NULL
+ *
+ */
+static void* run_exporter(void* logArg) {
+    ExportLog* log = (ExportLog*) logArg;
+    ExportBlock* tail = malloc(sizeof(ExportBlock));
+    char* buffer = malloc(EXPORT_BLOCK_ROWS * sizeof(uint32_t));
+    while (1) {
+        pthread_mutex_lock(&log->lock);
+        while (!log->exportRequested) {
+            pthread_cond_wait(&log->wake, &log->lock);
+        }
+        log->exportRequested = false;
+        pthread_mutex_unlock(&log->lock);
+
+        if (tail == NULL || buffer == NULL) {
+            errno = ENOMEM;
+            perror("Export");
+        } else if (!write_export(log, tail, buffer)) {
+            perror("Export");
+        }
+    }
+    return NULL;
+}
+
+bool start_exporter(ExportLog* log) {
+    if (pthread_create(&log->exporter, NULL, run_exporter, (void*) log)) {
+        return false;
+    }
+    pthread_detach(log->exporter);
+    return true;
+}
+
+void request_export(ExportLog* log) {
+    pthread_mutex_lock(&log->lock);
+    log->exportRequested = true;
+    pthread_cond_signal(&log->wake);
+    pthread_mutex_unlock(&log->lock);
+}
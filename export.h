@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "shared.h"
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+// The first bytes of a results export file
+#define EXPORT_MAGIC "RPSCOL1"
+// The opponent id of a result whose opponent is unknown
+#define EXPORT_NO_OPPONENT UINT32_MAX
+// Rows are kept in memory, and spilled to scratch, in blocks of this many
+#define EXPORT_BLOCK_ROWS 65536
+
+// The header at the start of a results export file. The file holds one row
+// per result, stored a column at a time so a scan only reads the columns it
+// needs, then a string table of every player name. Each section starts at
+// the offset the header gives, aligned to 8 bytes, and every integer is in
+// the byte order of the server that wrote it, so the file can be mapped and
+// read in place.
+typedef struct ExportHeader {
+    char magic[8];
+    uint64_t numRows;
+    uint64_t numNames;
+    // uint32_t[numRows], the id of the player each result is for
+    uint64_t playerOffset;
+    // uint32_t[numRows], the id of the opponent, or EXPORT_NO_OPPONENT
+    uint64_t opponentOffset;
+    // uint32_t[numRows], the id of the match
+    uint64_t matchOffset;
+    // uint8_t[numRows], the GameResult for the player
+    uint64_t outcomeOffset;
+    // uint64_t[numNames], where each name starts in the name data
+    uint64_t nameIndexOffset;
+    // the names, each terminated by a NUL byte
+    uint64_t nameDataOffset;
+    // the size of the whole file
+    uint64_t size;
+} ExportHeader;
+
+/**
+ * A block of rows of the export, a column at a time
+ *
+ * players (uint32_t[]): the id of the player of each row
+ * opponents (uint32_t[]): the id of the opponent of each row
+ * matches (uint32_t[]): the id of the match of each row
+ * outcomes (uint8_t[]): the GameResult of each row
+ *
+ */
+typedef struct ExportBlock {
+    uint32_t players[EXPORT_BLOCK_ROWS];
+    uint32_t opponents[EXPORT_BLOCK_ROWS];
+    uint32_t matches[EXPORT_BLOCK_ROWS];
+    uint8_t outcomes[EXPORT_BLOCK_ROWS];
+} ExportBlock;
+
+/**
+ * Every result since the server started, kept in columns to be written as a
+ * results export file. Players are stored by PlayerId, and the string table
+ * written is that of every id. Rows are added to an open block, which is
+ * spilled to an unlinked scratch file once full, so only one block is ever
+ * held in memory however long the server runs. The export file is written on
+ * its own thread, from the scratch file and a copy of the open block. Thread
+ * safe.
+ *
+ * path (char*): the file the export is written to
+ * spillFd (int): the scratch file full blocks are spilled to, in order
+ * numSpilled (size_t): the number of blocks spilled
+ * block (ExportBlock*): the open block
+ * numRows (size_t): the number of rows, spilled or not
+ * spillError (int): the errno of a failed spill, 0 for none. No more rows
+ * are added once a spill fails, so the export stays consistent.
+ * exportRequested (bool): whether the exporter has an export to write
+ * lock (pthread_mutex_t): guards everything above
+ * wake (pthread_cond_t): signalled when an export is requested
+ * exporter (pthread_t): the thread writing the export file
+ *
+ */
+typedef struct ExportLog {
+    char* path;
+    int spillFd;
+    size_t numSpilled;
+    ExportBlock* block;
+    size_t numRows;
+    int spillError;
+    bool exportRequested;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t exporter;
+} ExportLog;
+
+// Initialises an empty export, to be written to path, with its scratch file
+// beside it. Returns false (with errno set) if the scratch file could not be
+// made.
+bool init_export(ExportLog* log, char* path);
+
+// Appends a row for one player's result of a match. The opponent may be
+// NO_PLAYER if unknown.
+void export_result(ExportLog* log, int match, PlayerId player,
+        PlayerId opponent, GameResult result);
+
+// Starts the thread writing the export file. Must be called after the report
+// signals are blocked. Returns false if the thread could not be started.
+bool start_exporter(ExportLog* log);
+
+// Asks the exporter to write every row so far to the export file, replacing
+// it only once the new file is complete. Does not wait for the write, and
+// requests made while one is in progress are folded into one more. Failures
+// are reported on stderr.
+void request_export(ExportLog* log);
+
+#endif
@@ -0,0 +1,864 @@
+#define _GNU_SOURCE
+
+#include "federation.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <netinet/in.h>
+
+#define FEDERATION_BACKLOG 16
+
+/**
+ * A peer to dial, again whenever the link to it is lost
+ *
+ * federation (Federation*): the federation
+ * host (char*): the host of the peer
+ * port (char*): the port the peer listens for other nodes on
+ *
+ */
+typedef struct Dialler {
+    Federation* federation;
+    char* host;
+    char* port;
+} Dialler;
+
+/**
+ * Sleep for a number of milliseconds
+ *
+ * millis (int): how long to sleep
+ *
+ */
+static void sleep_millis(int millis) {
+    struct timespec interval = {.tv_sec = millis / 1000,
+            .tv_nsec = (millis % 1000) * 1000000L};
+    nanosleep(&interval, NULL);
+}
+
+/**
+ * Write text to a peer. A link that cannot be written to is shut down, so
+ * its reader sees it is lost.
+ *
+ * peer (Peer*): the link
+ * text (char*): the text
+ * length (size_t): the length of the text
+ *
+ * Returns false if the link is lost
+ *
+ */
+static bool send_text(Peer* peer, char* text, size_t length) {
+    pthread_mutex_lock(&peer->lock);
+    bool sent = peer->up;
+    while (sent && length > 0) {
+        ssize_t count = send(peer->fd, text, length, MSG_NOSIGNAL);
+        if (count <= 0) {
+            peer->up = sent = false;
+            shutdown(peer->fd, SHUT_RDWR);
+            break;
+        }
+        text += count;
+        length -= count;
+    }
+    pthread_mutex_unlock(&peer->lock);
+    return sent;
+}
+
+/**
+ * Write a line to a peer, formatted like printf
+ *
+ * peer (Peer*): the link
+ * format (const char*): the format of the line, with its newline
+ *
+ * Returns false if the link is lost
+ *
+ */
+static bool send_line(Peer* peer, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    char* line;
+    int length = vasprintf(&line, format, args);
+    va_end(args);
+    if (length == -1) {
+        return false;
+    }
+    bool sent = send_text(peer, line, length);
+    free(line);
+    return sent;
+}
+
+/**
+ * Take a request back from the offered requests
+ *
+ * federation (Federation*): the federation
+ * peer (Peer*): the link it was offered over
+ * token (unsigned long): its token, or 0 for any request offered over peer
+ * request (Request*): set to the request
+ *
+ * Returns false if there was no such request
+ *
+ */
+static bool take_offered(Federation* federation, Peer* peer,
+        unsigned long token, Request* request) {
+    bool found = false;
+    pthread_mutex_lock(&federation->lock);
+    for (size_t i = 0; i < federation->numOffered; i++) {
+        OfferedRequest* offered = &federation->offered[i];
+        if (offered->peer == peer && (token == 0 || offered->token == token)) {
+            *request = offered->request;
+            *offered = federation->offered[--federation->numOffered];
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&federation->lock);
+    return found;
+}
+
+/**
+ * Put an offered request that came back unmatched back in our own queue
+ *
+ * federation (Federation*): the federation
+ * request (Request*): the request
+ *
+ */
+static void requeue_request(Federation* federation, Request* request) {
+    __atomic_add_fetch(&federation->stats.returned, 1, __ATOMIC_RELAXED);
+    write_channel(&federation->info->requests, request);
+}
+
+bool offer_request(Federation* federation, Request* request) {
+    if (federation == NULL || request->peer != NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&federation->lock);
+    Peer* best = NULL;
+    for (Peer* peer = federation->peers; peer != NULL; peer = peer->next) {
+        if (__atomic_load_n(&peer->up, __ATOMIC_RELAXED)
+                && peer->local && peer->node > federation->node
+                && (best == NULL || peer->node > best->node)) {
+            best = peer;
+        }
+    }
+    if (best == NULL) {
+        pthread_mutex_unlock(&federation->lock);
+        return false;
+    }
+    if (federation->numOffered == federation->offeredCapacity) {
+        size_t capacity = federation->offeredCapacity * 2 + 16;
+        OfferedRequest* offered = realloc(federation->offered,
+                sizeof(OfferedRequest) * capacity);
+        if (offered == NULL) {
+            pthread_mutex_unlock(&federation->lock);
+            return false;
+        }
+        federation->offered = offered;
+        federation->offeredCapacity = capacity;
+    }
+    unsigned long token = federation->nextToken++;
+    federation->offered[federation->numOffered++] = (OfferedRequest) {
+            .token = token, .peer = best, .request = *request};
+    pthread_mutex_unlock(&federation->lock);
+
+    if (!send_line(best, "OFFER:%lu:%s:%s:%d\n", token,
+            player_name(request->player), request->port,
+            request->features & FEDERATION_FEATURES)) {
+        // unless the link's reader has already put it back in the queue
+        Request unsent;
+        return !take_offered(federation, best, token, &unsent);
+    }
+    __atomic_add_fetch(&federation->stats.offered, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * Tell the node a request came from about its match
+ *
+ * federation (Federation*): the federation
+ * request (Request*): the request
+ * match (Match*): the match, from the perspective of its player
+ *
+ * Returns false if the link to that node is lost, in which case the player
+ * never hears of the match
+ *
+ */
+static bool send_paired(Federation* federation, Request* request,
+        Match* match) {
+    if (!send_line(request->peer, "PAIRED:%lu:%d:%s:%s:%d\n", request->token,
+            match->id, player_name(match->opponent), match->opponentPort,
+            match->opponentFeatures & FEDERATION_FEATURES)) {
+        return false;
+    }
+    __atomic_add_fetch(&federation->stats.pairedHere, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void start_remote_match(Federation* federation, Request* requests[2],
+        Match* matches[2]) {
+    ServerInfo* info = federation->info;
+    // a lost link is only seen by a write to it, so check both before
+    // telling either, leaving only a link lost between the writes
+    bool up[2];
+    for (int i = 0; i < 2; i++) {
+        up[i] = requests[i]->peer == NULL
+                || __atomic_load_n(&requests[i]->peer->up, __ATOMIC_RELAXED);
+    }
+
+    bool told[2];
+    for (int i = 0; i < 2; i++) {
+        if (requests[i]->peer == NULL) {
+            told[i] = true;
+        } else if (!up[1 - i] || (i == 1 && !told[0])) {
+            // the opponent's node is gone, so back to its own node to wait
+            told[i] = false;
+            send_line(requests[i]->peer, "RETURN:%lu\n", requests[i]->token);
+        } else {
+            told[i] = up[i] && send_paired(federation, requests[i],
+                    matches[i]);
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (requests[i]->peer != NULL) {
+            continue;
+        }
+        if (!told[1 - i]) {
+            // the opponent's node is gone, so wait for another
+            write_channel(&info->requests, requests[i]);
+            continue;
+        }
+        record_stage(&info->latencies, STAGE_PAIR,
+                matches[i]->timeline.enqueued, matches[i]->timeline.paired);
+        start_player(info, requests[i], matches[i]);
+    }
+}
+
+/**
+ * Queue a request another node offered us, as if its player were our own.
+ * One we cannot take, or that came from another host, whose player could not
+ * reach ours, is sent straight back.
+ *
+ * peer (Peer*): the link it came over
+ * fields (Fields*): the token, name, port and features of the OFFER
+ *
+ */
+static void receive_offer(Peer* peer, Fields* fields) {
+    Federation* federation = peer->federation;
+    ServerInfo* info = federation->info;
+    unsigned long token = strtoul(fields->field[0].start, NULL, 10);
+    Request request;
+    memset(&request, 0, sizeof(Request));
+    request.player = intern_player(fields->field[1].start);
+    request.features = atoi(fields->field[3].start) & FEDERATION_FEATURES;
+    request.latencies = &info->latencies;
+    request.peer = peer;
+    request.token = token;
+    request.timeline.enqueued = monotonic_nanos();
+
+    if (!peer->local || request.player == NO_PLAYER || token == 0
+            || fields->field[2].length >= MAX_PORT_LENGTH
+            || fields->field[2].length == 0) {
+        send_line(peer, "RETURN:%lu\n", token);
+        return;
+    }
+    memcpy(request.port, fields->field[2].start, fields->field[2].length + 1);
+    if (!write_channel(&info->requests, &request)) {
+        send_line(peer, "RETURN:%lu\n", token);
+        return;
+    }
+    __atomic_add_fetch(&federation->stats.received, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Start our side of a match another node paired one of our requests in
+ *
+ * peer (Peer*): the link it came over
+ * fields (Fields*): the token, match id, opponent name, opponent port and
+ * opponent features of the PAIRED
+ *
+ */
+static void receive_paired(Peer* peer, Fields* fields) {
+    Federation* federation = peer->federation;
+    ServerInfo* info = federation->info;
+    Request request;
+    if (!take_offered(federation, peer,
+            strtoul(fields->field[0].start, NULL, 10), &request)) {
+        return;
+    }
+    PlayerId opponent = intern_player(fields->field[2].start);
+    if (opponent == NO_PLAYER || fields->field[3].length >= MAX_PORT_LENGTH) {
+        // the opponent is never told otherwise, so this one waits on
+        requeue_request(federation, &request);
+        return;
+    }
+
+    Match match = {.player = request.player, .opponent = opponent,
+            .id = atoi(fields->field[1].start), .stream = request.stream,
+            .client = request.client, .results = request.results,
+            .features = request.features,
+            .opponentFeatures = atoi(fields->field[4].start)
+            & FEDERATION_FEATURES,
+            .latencies = &info->latencies, .timeline = request.timeline};
+    memcpy(match.playerPort, request.port, MAX_PORT_LENGTH);
+    memcpy(match.opponentPort, fields->field[3].start,
+            fields->field[3].length + 1);
+    match.timeline.paired = monotonic_nanos();
+    record_stage(&info->latencies, STAGE_PAIR, match.timeline.enqueued,
+            match.timeline.paired);
+    __atomic_add_fetch(&federation->stats.pairedAway, 1, __ATOMIC_RELAXED);
+    start_player(info, &request, &match);
+}
+
+/**
+ * Add a player to standings being received from another node
+ *
+ * incoming (NodeStandings*): the standings so far
+ * fields (Fields*): the name, wins, losses, ties and rating of the PLAYER
+ *
+ */
+static void receive_player(NodeStandings* incoming, Fields* fields) {
+    Snapshot* snapshot = &incoming->snapshot;
+    if (snapshot->numPlayers == snapshot->capacity) {
+        size_t capacity = snapshot->capacity * 2 + 64;
+        Player* players = realloc(snapshot->players,
+                sizeof(Player) * capacity);
+        if (players == NULL) {
+            return;
+        }
+        snapshot->players = players;
+        snapshot->capacity = capacity;
+    }
+    char* name = arena_strndup(&incoming->names, fields->field[0].start,
+            fields->field[0].length);
+    if (name == NULL) {
+        return;
+    }
+    snapshot->players[snapshot->numPlayers++] = (Player) {.name = name,
+            .wins = atoi(fields->field[1].start),
+            .losses = atoi(fields->field[2].start),
+            .ties = atoi(fields->field[3].start),
+            .rating = strtod(fields->field[4].start, NULL)};
+}
+
+/**
+ * Keep standings received in full from another node in place of its last,
+ * leaving incoming empty to receive the next
+ *
+ * federation (Federation*): the federation
+ * node (uint32_t): the node they came from
+ * incoming (NodeStandings*): the standings
+ *
+ */
+static void store_standings(Federation* federation, uint32_t node,
+        NodeStandings* incoming) {
+    pthread_mutex_lock(&federation->lock);
+    NodeStandings* stored = NULL;
+    for (int i = 0; i < federation->numNodes; i++) {
+        if (federation->nodes[i].node == node) {
+            stored = &federation->nodes[i];
+        }
+    }
+    if (stored == NULL && federation->numNodes < FEDERATION_MAX_NODES) {
+        stored = &federation->nodes[federation->numNodes++];
+        memset(stored, 0, sizeof(NodeStandings));
+        stored->node = node;
+    }
+    if (stored != NULL) {
+        // swap, so the last standings' memory receives the next
+        NodeStandings last = *stored;
+        stored->snapshot = incoming->snapshot;
+        stored->names = incoming->names;
+        incoming->snapshot = last.snapshot;
+        incoming->names = last.names;
+        __atomic_add_fetch(&federation->stats.shares, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&federation->lock);
+
+    incoming->snapshot.numPlayers = 0;
+    reset_arena(&incoming->names);
+}
+
+/**
+ * Handle a line from another node
+ *
+ * peer (Peer*): the link it came over
+ * line (Slice*): the line
+ * incoming (NodeStandings*): the standings being received over the link
+ *
+ * Returns false if the link should be hung up on
+ *
+ */
+static bool handle_line(Peer* peer, Slice* line, NodeStandings* incoming) {
+    Federation* federation = peer->federation;
+    Fields fields;
+    split_line(line->start, line->length, &fields);
+    // the tag is terminated in place at its colon
+    char* tag = line->start;
+
+    if (!strcmp(tag, "PEER") && fields.count == 1) {
+        uint32_t node = strtoul(fields.field[0].start, NULL, 10);
+        pthread_mutex_lock(&federation->lock);
+        peer->node = node;
+        pthread_mutex_unlock(&federation->lock);
+        // a node linked to itself would offer requests to itself
+        return node != 0 && node != federation->node;
+    }
+    if (peer->node == 0) {
+        return false;
+    }
+    if (!strcmp(tag, "OFFER") && fields.count == 4) {
+        receive_offer(peer, &fields);
+    } else if (!strcmp(tag, "PAIRED") && fields.count == 5) {
+        receive_paired(peer, &fields);
+    } else if (!strcmp(tag, "RETURN") && fields.count == 1) {
+        Request request;
+        if (take_offered(federation, peer,
+                strtoul(fields.field[0].start, NULL, 10), &request)) {
+            requeue_request(federation, &request);
+        }
+    } else if (!strcmp(tag, "STANDINGS") && fields.count == 0) {
+        incoming->snapshot.numPlayers = 0;
+        reset_arena(&incoming->names);
+    } else if (!strcmp(tag, "PLAYER") && fields.count == 5) {
+        receive_player(incoming, &fields);
+    } else if (!strcmp(tag, "END") && fields.count == 0) {
+        store_standings(federation, peer->node, incoming);
+    }
+    return true;
+}
+
+/**
+ * Exchange lines with another node until the link is lost, then put every
+ * request offered over it back in our queue. The peer's requests we have
+ * queued stay queued, but are never matched: pairing one fails to send, so
+ * its opponent is queued again.
+ *
+ * peer (Peer*): the link
+ *
+ */
+static void run_link(Peer* peer) {
+    Federation* federation = peer->federation;
+    Scanner scanner;
+    init_scanner(&scanner, peer->fd);
+    NodeStandings incoming;
+    memset(&incoming, 0, sizeof(NodeStandings));
+
+    Slice line;
+    if (send_line(peer, "PEER:%u\n", federation->node)) {
+        while (scan_line(&scanner, &line)
+                && handle_line(peer, &line, &incoming)) {
+        }
+    }
+
+    pthread_mutex_lock(&peer->lock);
+    peer->up = false;
+    close(peer->fd);
+    pthread_mutex_unlock(&peer->lock);
+    destroy_scanner(&scanner);
+    free(incoming.snapshot.players);
+    free_arena(&incoming.names);
+
+    Request request;
+    while (take_offered(federation, peer, 0, &request)) {
+        requeue_request(federation, &request);
+    }
+}
+
+/**
+ * Check whether the other end of a socket is on this host: at a loopback
+ * address, or at the same address as our end
+ *
+ * fd (int): the connected socket
+ *
+ * Returns true if the other end is on this host
+ *
+ */
+static bool is_local(int fd) {
+    struct sockaddr_storage ours, theirs;
+    socklen_t ourLength = sizeof(ours), theirLength = sizeof(theirs);
+    if (getsockname(fd, (struct sockaddr*) &ours, &ourLength)
+            || getpeername(fd, (struct sockaddr*) &theirs, &theirLength)
+            || ours.ss_family != theirs.ss_family) {
+        return false;
+    }
+    if (theirs.ss_family == AF_INET) {
+        struct in_addr* our = &((struct sockaddr_in*) &ours)->sin_addr;
+        struct in_addr* their = &((struct sockaddr_in*) &theirs)->sin_addr;
+        return (ntohl(their->s_addr) >> 24) == IN_LOOPBACKNET
+                || our->s_addr == their->s_addr;
+    }
+    if (theirs.ss_family == AF_INET6) {
+        struct in6_addr* our = &((struct sockaddr_in6*) &ours)->sin6_addr;
+        struct in6_addr* their = &((struct sockaddr_in6*) &theirs)->sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(their)
+                || !memcmp(our, their, sizeof(struct in6_addr));
+    }
+    return false;
+}
+
+/**
+ * Make a new link to another node
+ *
+ * federation (Federation*): the federation
+ * fd (int): the connected socket
+ *
+ * Returns the link
+ *
+ */
+static Peer* new_peer(Federation* federation, int fd) {
+    Peer* peer = calloc(1, sizeof(Peer));
+    peer->fd = fd;
+    peer->local = is_local(fd);
+    peer->up = true;
+    peer->federation = federation;
+    pthread_mutex_init(&peer->lock, NULL);
+
+    pthread_mutex_lock(&federation->lock);
+    peer->next = federation->peers;
+    federation->peers = peer;
+    pthread_mutex_unlock(&federation->lock);
+    return peer;
+}
+
+/**
+ * Run a link another node dialled
+ *
+ * peerArg (void*): the Peer
+ *
+ * Returns NULL
+ *
+ */
+static void* link_thread(void* peerArg) {
+    run_link((Peer*) peerArg);
+    return NULL;
+}
+
+/**
+ * Take links from other nodes until the server exits
+ *
+ * federationArg (void*): the Federation
+ *
+ * Returns NULL
+ *
+ */
+static void* accept_peers(void* federationArg) {
+    Federation* federation = (Federation*) federationArg;
+    while (1) {
+        int fd = accept(federation->listenFd, NULL, NULL);
+        if (fd == -1) {
+            continue;
+        }
+        pthread_t id;
+        if (pthread_create(&id, NULL, link_thread,
+                (void*) new_peer(federation, fd))) {
+            continue;
+        }
+        pthread_detach(id);
+    }
+    return NULL;
+}
+
+/**
+ * Connect to another node
+ *
+ * host (char*): the host of the node
+ * port (char*): the port it listens for other nodes on
+ *
+ * Returns the connected socket, or -1 if it could not be reached
+ *
+ */
+static int connect_peer(char* host, char* port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* ai = NULL;
+    if (getaddrinfo(host, port, &hints, &ai)) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* next = ai; next != NULL && fd == -1;
+            next = next->ai_next) {
+        fd = socket(next->ai_family, next->ai_socktype, next->ai_protocol);
+        if (fd != -1 && connect(fd, next->ai_addr, next->ai_addrlen)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+/**
+ * Keep a link to a peer until the server exits, dialling it again every
+ * FEDERATION_RETRY_INTERVAL while it cannot be reached
+ *
+ * diallerArg (void*): the Dialler
+ *
+ * Returns NULL
+ *
+ */
+static void* dial_peer(void* diallerArg) {
+    Dialler* dialler = (Dialler*) diallerArg;
+    while (1) {
+        int fd = connect_peer(dialler->host, dialler->port);
+        if (fd != -1) {
+            run_link(new_peer(dialler->federation, fd));
+        }
+        sleep_millis(FEDERATION_RETRY_INTERVAL);
+    }
+    return NULL;
+}
+
+/**
+ * Send our standings to every peer every FEDERATION_SHARE_INTERVAL, as a
+ * STANDINGS line, a PLAYER line per player and an END line
+ *
+ * federationArg (void*): the Federation
+ *
+ * Returns NULL
+ *
+ */
+static void* share_standings(void* federationArg) {
+    Federation* federation = (Federation*) federationArg;
+    Snapshot snapshot = {.players = NULL, .numPlayers = 0, .capacity = 0};
+    while (1) {
+        sleep_millis(FEDERATION_SHARE_INTERVAL);
+        take_snapshot(&federation->info->results.standings, &snapshot);
+
+        char* text;
+        size_t length;
+        FILE* stream = open_memstream(&text, &length);
+        if (stream == NULL) {
+            continue;
+        }
+        fprintf(stream, "STANDINGS\n");
+        for (size_t i = 0; i < snapshot.numPlayers; i++) {
+            Player* player = &snapshot.players[i];
+            fprintf(stream, "PLAYER:%s:%d:%d:%d:%.3f\n", player->name,
+                    player->wins, player->losses, player->ties,
+                    player->rating);
+        }
+        fprintf(stream, "END\n");
+        fclose(stream);
+
+        // links are only ever pushed onto the list, so it can be walked
+        // once its head is read
+        pthread_mutex_lock(&federation->lock);
+        Peer* peers = federation->peers;
+        pthread_mutex_unlock(&federation->lock);
+        for (Peer* peer = peers; peer != NULL; peer = peer->next) {
+            if (__atomic_load_n(&peer->up, __ATOMIC_RELAXED)) {
+                send_text(peer, text, length);
+            }
+        }
+        free(text);
+    }
+    return NULL;
+}
+
+/**
+ * Start a detached thread
+ *
+ * run (void* (*)(void*)): what the thread runs
+ * arg (void*): passed to run
+ *
+ * Returns true on success
+ *
+ */
+static bool start_thread(void* (*run)(void*), void* arg) {
+    pthread_t id;
+    if (pthread_create(&id, NULL, run, arg)) {
+        return false;
+    }
+    pthread_detach(id);
+    return true;
+}
+
+/**
+ * Listen for other nodes on a port
+ *
+ * port (int): the port
+ *
+ * Returns the listening socket, or -1 if it could not be listened on
+ *
+ */
+static int listen_peers(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(struct sockaddr_in));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*) &address, sizeof(address))
+            || listen(fd, FEDERATION_BACKLOG)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+Federation* start_federation(ServerInfo* info, int port, char** peers,
+        int numPeers) {
+    Federation* federation = calloc(1, sizeof(Federation));
+    federation->info = info;
+    federation->listenFd = -1;
+    federation->nextToken = 1;
+    pthread_mutex_init(&federation->lock, NULL);
+    // random, so that which node collects the odd requests out is arbitrary
+    while (federation->node == 0) {
+        if (getrandom(&federation->node, sizeof(uint32_t), 0)
+                != sizeof(uint32_t)) {
+            federation->node = (uint32_t) time(NULL) ^ (uint32_t) getpid();
+        }
+    }
+
+    if (port > 0) {
+        federation->listenFd = listen_peers(port);
+        if (federation->listenFd == -1
+                || !start_thread(accept_peers, (void*) federation)) {
+            return NULL;
+        }
+    }
+    for (int i = 0; i < numPeers; i++) {
+        // host:port, split at the last colon
+        char* separator = strrchr(peers[i], ':');
+        Dialler* dialler = malloc(sizeof(Dialler));
+        dialler->federation = federation;
+        dialler->host = strndup(peers[i], separator - peers[i]);
+        dialler->port = separator + 1;
+        if (!start_thread(dial_peer, (void*) dialler)) {
+            return NULL;
+        }
+    }
+    if (!start_thread(share_standings, (void*) federation)) {
+        return NULL;
+    }
+    return federation;
+}
+
+/**
+ * Add the players of a snapshot to merged standings
+ *
+ * global (Snapshot*): the merged standings
+ * from (Snapshot*): the snapshot
+ * names (Arena*): where to copy the names of the players, NULL to keep them
+ *
+ */
+static void append_players(Snapshot* global, Snapshot* from, Arena* names) {
+    if (global->capacity < global->numPlayers + from->numPlayers) {
+        size_t capacity = (global->numPlayers + from->numPlayers) * 2;
+        Player* players = realloc(global->players, sizeof(Player) * capacity);
+        if (players == NULL) {
+            return;
+        }
+        global->players = players;
+        global->capacity = capacity;
+    }
+    for (size_t i = 0; i < from->numPlayers; i++) {
+        Player player = from->players[i];
+        if (names != NULL && (player.name = arena_strndup(names, player.name,
+                strlen(player.name))) == NULL) {
+            continue;
+        }
+        global->players[global->numPlayers++] = player;
+    }
+}
+
+/**
+ * Order players by name, then by the most games played
+ *
+ * first (const void*): the first Player
+ * second (const void*): the second Player
+ *
+ * Returns less than, equal to or greater than 0 as first comes before, with
+ * or after second
+ *
+ */
+static int compare_players(const void* first, const void* second) {
+    const Player* one = (const Player*) first;
+    const Player* two = (const Player*) second;
+    int order = strcmp(one->name, two->name);
+    if (order != 0) {
+        return order;
+    }
+    return (two->wins + two->losses + two->ties)
+            - (one->wins + one->losses + one->ties);
+}
+
+void merge_standings(Federation* federation, Snapshot* local,
+        Snapshot* global) {
+    reset_arena(&federation->global);
+    global->numPlayers = 0;
+    // our own names are never freed, so need no copy
+    append_players(global, local, NULL);
+    pthread_mutex_lock(&federation->lock);
+    for (int i = 0; i < federation->numNodes; i++) {
+        append_players(global, &federation->nodes[i].snapshot,
+                &federation->global);
+    }
+    pthread_mutex_unlock(&federation->lock);
+
+    qsort(global->players, global->numPlayers, sizeof(Player),
+            compare_players);
+    // each player's first entry has the rating of their busiest node
+    size_t merged = 0;
+    for (size_t i = 0; i < global->numPlayers; i++) {
+        Player* player = &global->players[i];
+        if (merged > 0 && !strcmp(global->players[merged - 1].name,
+                player->name)) {
+            Player* total = &global->players[merged - 1];
+            total->wins += player->wins;
+            total->losses += player->losses;
+            total->ties += player->ties;
+        } else {
+            global->players[merged++] = *player;
+        }
+    }
+    global->numPlayers = merged;
+}
+
+void print_federation_stats(Federation* federation, FILE* stream) {
+    FederationStats* stats = &federation->stats;
+    int links = 0;
+    int localLinks = 0;
+    pthread_mutex_lock(&federation->lock);
+    for (Peer* peer = federation->peers; peer != NULL; peer = peer->next) {
+        bool up = __atomic_load_n(&peer->up, __ATOMIC_RELAXED);
+        links += up;
+        localLinks += up && peer->local;
+    }
+    size_t waiting = federation->numOffered;
+    int nodes = federation->numNodes;
+    pthread_mutex_unlock(&federation->lock);
+
+    fprintf(stream, "federation node %u\n", federation->node);
+    fprintf(stream, "federation links %d\n", links);
+    fprintf(stream, "federation local_links %d\n", localLinks);
+    fprintf(stream, "federation nodes %d\n", nodes);
+    fprintf(stream, "federation offered %lu\n",
+            __atomic_load_n(&stats->offered, __ATOMIC_RELAXED));
+    fprintf(stream, "federation offered_waiting %zu\n", waiting);
+    fprintf(stream, "federation received %lu\n",
+            __atomic_load_n(&stats->received, __ATOMIC_RELAXED));
+    fprintf(stream, "federation returned %lu\n",
+            __atomic_load_n(&stats->returned, __ATOMIC_RELAXED));
+    fprintf(stream, "federation paired_here %lu\n",
+            __atomic_load_n(&stats->pairedHere, __ATOMIC_RELAXED));
+    fprintf(stream, "federation paired_away %lu\n",
+            __atomic_load_n(&stats->pairedAway, __ATOMIC_RELAXED));
+    fprintf(stream, "federation shares %lu\n",
+            __atomic_load_n(&stats->shares, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "server.h"
+#include "arena.h"
+
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+// How long (ms) an odd request out waits for an opponent on its own node
+// before it is offered to a peer
+#define FEDERATION_OFFER_WAIT 500
+// How often (ms) each node sends its standings to its peers
+#define FEDERATION_SHARE_INTERVAL 1000
+// How long (ms) to wait before dialling a peer again once a link is lost
+#define FEDERATION_RETRY_INTERVAL 1000
+// The most nodes whose standings are kept, other than this one
+#define FEDERATION_MAX_NODES 64
+// The Features a request keeps when it is played against a player on another
+// node. Refereeing needs both players on one server, and binary frames and
+// sessions are only between a player and their own server.
+#define FEDERATION_FEATURES (FEATURE_READY | FEATURE_PIPELINE)
+
+struct Federation;
+
+/**
+ * A link to another node, over which requests and standings are exchanged in
+ * text lines. Peers are never freed, as requests offered over a link may
+ * still point at it long after it is lost, and a lost link is never used
+ * again: dialling a peer again makes a new one.
+ *
+ * fd (int): the socket
+ * node (uint32_t): the id of the node at the other end, 0 until it says
+ * local (bool): whether the node at the other end is on this host, as
+ * players only ever reach each other by port on localhost
+ * up (bool): whether the link can still be written to
+ * lock (pthread_mutex_t): guards writes to fd, and up
+ * federation (struct Federation*): the federation the link belongs to
+ * next (struct Peer*): the link made before this one
+ *
+ */
+typedef struct Peer {
+    int fd;
+    uint32_t node;
+    bool local;
+    bool up;
+    pthread_mutex_t lock;
+    struct Federation* federation;
+    struct Peer* next;
+} Peer;
+
+/**
+ * A request of one of our players, offered to another node
+ *
+ * token (unsigned long): identifies the request to the node it went to
+ * peer (Peer*): the link it went over
+ * request (Request): the request
+ *
+ */
+typedef struct OfferedRequest {
+    unsigned long token;
+    Peer* peer;
+    Request request;
+} OfferedRequest;
+
+/**
+ * The last standings another node sent
+ *
+ * node (uint32_t): the id of the node
+ * snapshot (Snapshot): its standings
+ * names (Arena): where the names of the snapshot are kept
+ *
+ */
+typedef struct NodeStandings {
+    uint32_t node;
+    Snapshot snapshot;
+    Arena names;
+} NodeStandings;
+
+/**
+ * Counters kept by the federation
+ *
+ * offered (unsigned long): our requests offered to another node
+ * received (unsigned long): requests other nodes offered to us
+ * returned (unsigned long): offered requests that came back unmatched
+ * pairedHere (unsigned long): requests of other nodes we paired
+ * pairedAway (unsigned long): our requests another node paired
+ * shares (unsigned long): the standings received from other nodes
+ *
+ */
+typedef struct FederationStats {
+    unsigned long offered;
+    unsigned long received;
+    unsigned long returned;
+    unsigned long pairedHere;
+    unsigned long pairedAway;
+    unsigned long shares;
+} FederationStats;
+
+/**
+ * This node's part in a federation of servers, each with their own players,
+ * which pair their odd requests out with each other's and share their
+ * standings. An odd request is only ever offered to the linked node on this
+ * host with the highest id above our own, so where every node is linked to
+ * every other, the odd requests of every node on a host end up on the same
+ * one. Nodes on other hosts only share standings.
+ *
+ * info (ServerInfo*): the server
+ * node (uint32_t): the id of this node, chosen at random
+ * listenFd (int): where other nodes dial us, -1 for nowhere
+ * peers (Peer*): every link ever made, newest first
+ * offered (OfferedRequest*): our requests waiting on another node
+ * numOffered (size_t): the number of requests offered
+ * offeredCapacity (size_t): how many fit in offered before it must grow
+ * nextToken (unsigned long): the token given to the next request offered
+ * nodes (NodeStandings[]): the last standings of each other node
+ * numNodes (int): the number of nodes whose standings are kept
+ * global (Arena): the names of the last merged standings
+ * lock (pthread_mutex_t): guards everything above other than info and node
+ * stats (FederationStats): the counters
+ *
+ */
+typedef struct Federation {
+    ServerInfo* info;
+    uint32_t node;
+    int listenFd;
+    Peer* peers;
+    OfferedRequest* offered;
+    size_t numOffered;
+    size_t offeredCapacity;
+    unsigned long nextToken;
+    NodeStandings nodes[FEDERATION_MAX_NODES];
+    int numNodes;
+    Arena global;
+    pthread_mutex_t lock;
+    FederationStats stats;
+} Federation;
+
+// Starts this node's part in a federation: listening for other nodes on port
+// (unless it is 0), dialling each of the numPeers "host:port" addresses
+// (again whenever a link is lost), and sending our standings to every peer
+// every FEDERATION_SHARE_INTERVAL. Returns NULL if the port could not be
+// listened on or a thread could not be started.
+Federation* start_federation(ServerInfo* info, int port, char** peers,
+        int numPeers);
+
+// Offers a request to the linked node on this host with the highest id above
+// ours, which pairs it with one of its own or sends it back. Requests from
+// other nodes are never offered on. Returns false if there was nowhere to offer it, in
+// which case it is still the caller's.
+bool offer_request(Federation* federation, Request* request);
+
+// Starts a match either side of which came from another node, given from the
+// perspective of each side. The node of each remote side is told about its
+// match, and each local side is started. A side whose opponent's node cannot
+// be told is queued again, or sent back to its own node, so its player never
+// hears of a match their opponent does not.
+void start_remote_match(Federation* federation, Request* requests[2],
+        Match* matches[2]);
+
+// Merges our own standings with the last standings of every other node into
+// global, reusing its memory. A player's totals are summed over every node,
+// and their rating taken from the node they have played the most on. The
+// names of global last until the next call, so only the reporter may call it.
+void merge_standings(Federation* federation, Snapshot* local,
+        Snapshot* global);
+
+// Prints the federation's counters, in the format "federation <key> <value>".
+void print_federation_stats(Federation* federation, FILE* stream);
+
+#endif
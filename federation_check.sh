@@ -0,0 +1,56 @@
+#!/bin/sh
+# Runs a federation of two servers on localhost, plays a client against
+# each, and checks the match was paired across the servers and that both
+# report the same standings. Exits non-zero on failure.
+#
+# ./federation_check.sh [firstport] [secondport]
+
+FIRST=${1:-4001}
+SECOND=${2:-4002}
+DIR=$(mktemp -d)
+
+cleanup() {
+    kill $FIRST_PID $SECOND_PID 2>/dev/null
+    wait $FIRST_PID $SECOND_PID 2>/dev/null
+    rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "federation check failed: $1" >&2
+    exit 1
+}
+
+./rpsserver -f "$FIRST" > "$DIR/first" &
+FIRST_PID=$!
+./rpsserver -f "$SECOND" -n "localhost:$FIRST" > "$DIR/second" &
+SECOND_PID=$!
+# give the second server time to dial the first
+sleep 1
+FIRST_PORT=$(head -1 "$DIR/first")
+SECOND_PORT=$(head -1 "$DIR/second")
+[ -n "$FIRST_PORT" ] && [ -n "$SECOND_PORT" ] \
+        || fail "a server did not start"
+
+# one player on each server, so they can only be paired with each other
+timeout 20 ./rpsclient alpha 1 "$FIRST_PORT" > "$DIR/alpha" &
+ALPHA_PID=$!
+timeout 20 ./rpsclient beta 1 "$SECOND_PORT" > "$DIR/beta" \
+        || fail "beta did not finish its match"
+wait $ALPHA_PID || fail "alpha did not finish its match"
+grep -q beta "$DIR/alpha" || fail "alpha was not paired with beta"
+grep -q alpha "$DIR/beta" || fail "beta was not paired with alpha"
+
+# wait for each server to share its standings with the other
+sleep 2
+kill -HUP $FIRST_PID $SECOND_PID
+sleep 0.5
+sed -n '2,/^---$/p' "$DIR/first" > "$DIR/first.standings"
+sed -n '2,/^---$/p' "$DIR/second" > "$DIR/second.standings"
+[ "$(grep -c '^\(alpha\|beta\) ' "$DIR/first.standings")" -eq 2 ] \
+        || fail "the standings do not hold both players"
+cmp -s "$DIR/first.standings" "$DIR/second.standings" \
+        || fail "the servers report different standings"
+
+cat "$DIR/first.standings"
+echo "federation check passed"
@@ -0,0 +1,343 @@
+#include "frame.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Write a 32 bit integer in network order
+ *
+ * buffer (unsigned char*): where to write it
+ * value (uint32_t): the value
+ *
+ */
+static void put_u32(unsigned char* buffer, uint32_t value) {
+    buffer[0] = value >> 24;
+    buffer[1] = value >> 16;
+    buffer[2] = value >> 8;
+    buffer[3] = value;
+}
+
+/**
+ * Read a 32 bit integer in network order
+ *
+ * buffer (unsigned char*): where to read it from
+ *
+ * Returns the value
+ *
+ */
+static uint32_t get_u32(unsigned char* buffer) {
+    return (uint32_t) buffer[0] << 24 | (uint32_t) buffer[1] << 16
+            | (uint32_t) buffer[2] << 8 | buffer[3];
+}
+
+/**
+ * Write a 16 bit integer in network order
+ *
+ * buffer (unsigned char*): where to write it
+ * value (uint16_t): the value
+ *
+ */
+static void put_u16(unsigned char* buffer, uint16_t value) {
+    buffer[0] = value >> 8;
+    buffer[1] = value;
+}
+
+/**
+ * Read a 16 bit integer in network order
+ *
+ * buffer (unsigned char*): where to read it from
+ *
+ * Returns the value
+ *
+ */
+static uint16_t get_u16(unsigned char* buffer) {
+    return buffer[0] << 8 | buffer[1];
+}
+
+int encode_message(Message* message, unsigned char* buffer) {
+    unsigned char* payload = buffer + FRAME_HEADER_SIZE;
+    size_t length = 0;
+
+    switch (message->type) {
+        case MESSAGE_HELLO:
+            put_u32(payload, message->value);
+            length = 4;
+            break;
+        case MESSAGE_NAME:
+            put_u32(payload, message->id);
+            length = strnlen(message->name, MAX_FRAME_NAME);
+            memcpy(payload + 4, message->name, length);
+            length += 4;
+            break;
+        case MESSAGE_MR:
+            put_u32(payload, message->id);
+            put_u16(payload + 4, message->port);
+            length = 6;
+            break;
+        case MESSAGE_MATCH:
+            put_u32(payload, message->id);
+            put_u32(payload + 4, message->nameId);
+            put_u16(payload + 8, message->port);
+            payload[10] = message->value;
+            length = 11;
+            break;
+        case MESSAGE_RESULT:
+            put_u32(payload, message->id);
+            payload[4] = message->value;
+            length = 5;
+            break;
+        case MESSAGE_MOVE:
+            payload[0] = message->value;
+            length = 1;
+            break;
+        case MESSAGE_READY:
+            break;
+    }
+
+    buffer[0] = message->type;
+    put_u16(buffer + 1, length);
+    return FRAME_HEADER_SIZE + length;
+}
+
+/**
+ * Decode the payload of a frame
+ *
+ * type (MessageType): the type from the frame header
+ * payload (unsigned char*): the payload
+ * length (size_t): the length of the payload
+ * message (Message*): where to decode it to
+ *
+ * Returns false if the payload does not fit the layout of its type
+ *
+ */
+static bool decode_payload(MessageType type, unsigned char* payload,
+        size_t length, Message* message) {
+    message->type = type;
+    switch (type) {
+        case MESSAGE_HELLO:
+            if (length != 4) {
+                return false;
+            }
+            message->value = get_u32(payload);
+            return true;
+        case MESSAGE_NAME:
+            if (length <= 4 || length > 4 + MAX_FRAME_NAME) {
+                return false;
+            }
+            message->id = get_u32(payload);
+            memcpy(message->name, payload + 4, length - 4);
+            message->name[length - 4] = '\0';
+            // names end up in text reports, so keep them to what MR allows
+            return strlen(message->name) == length - 4
+                    && strchr(message->name, ':') == NULL
+                    && strchr(message->name, '\n') == NULL;
+        case MESSAGE_MR:
+            if (length != 6) {
+                return false;
+            }
+            message->id = get_u32(payload);
+            message->port = get_u16(payload + 4);
+            return true;
+        case MESSAGE_MATCH:
+            if (length != 11) {
+                return false;
+            }
+            message->id = get_u32(payload);
+            message->nameId = get_u32(payload + 4);
+            message->port = get_u16(payload + 8);
+            message->value = payload[10];
+            return true;
+        case MESSAGE_RESULT:
+            if (length != 5) {
+                return false;
+            }
+            message->id = get_u32(payload);
+            message->value = payload[4];
+            return true;
+        case MESSAGE_MOVE:
+            if (length != 1) {
+                return false;
+            }
+            message->value = payload[0];
+            return true;
+        case MESSAGE_READY:
+            return length == 0;
+    }
+    return false;
+}
+
+int decode_message(unsigned char* buffer, size_t length, Message* message) {
+    if (length < FRAME_HEADER_SIZE) {
+        return 0;
+    }
+    size_t payloadLength = get_u16(buffer + 1);
+    if (payloadLength > MAX_FRAME_LENGTH - FRAME_HEADER_SIZE) {
+        return -1;
+    }
+    if (length < FRAME_HEADER_SIZE + payloadLength) {
+        return 0;
+    }
+    if (!decode_payload(buffer[0], buffer + FRAME_HEADER_SIZE, payloadLength,
+            message)) {
+        return -1;
+    }
+    return FRAME_HEADER_SIZE + payloadLength;
+}
+
+bool scan_message(Scanner* scanner, Message* message) {
+    char* header;
+    if (!scan_bytes(scanner, FRAME_HEADER_SIZE, &header)) {
+        return false;
+    }
+    // the header may move once the payload is read in
+    MessageType type = (unsigned char) header[0];
+    size_t payloadLength = get_u16((unsigned char*) header + 1);
+
+    char* payload;
+    if (payloadLength > MAX_FRAME_LENGTH - FRAME_HEADER_SIZE
+            || !scan_bytes(scanner, payloadLength, &payload)) {
+        return false;
+    }
+    return decode_payload(type, (unsigned char*) payload, payloadLength,
+            message);
+}
+
+int take_message(Scanner* scanner, Message* message) {
+    int length = decode_message((unsigned char*) scanner->buffer
+            + scanner->start, scanner->end - scanner->start, message);
+    if (length <= 0) {
+        return length;
+    }
+    scanner->start += length;
+    return 1;
+}
+
+bool write_message(FILE* stream, Message* message) {
+    unsigned char buffer[MAX_FRAME_LENGTH];
+    int length = encode_message(message, buffer);
+    return fwrite(buffer, 1, length, stream) == length;
+}
+
+bool scan_magic(Scanner* scanner) {
+    char* magic;
+    return peek_byte(scanner) == FRAME_MAGIC
+            && scan_bytes(scanner, 2, &magic) && magic[1] == '\n';
+}
+
+int take_magic(Scanner* scanner) {
+    size_t buffered = scanner->end - scanner->start;
+    char* magic = scanner->buffer + scanner->start;
+    if (buffered == 0
+            || ((unsigned char) magic[0] == FRAME_MAGIC && buffered < 2)) {
+        return 0;
+    }
+    if ((unsigned char) magic[0] != FRAME_MAGIC) {
+        return -1;
+    }
+    // as with scan_magic, a magic byte without its newline is still taken
+    scanner->start += 2;
+    return magic[1] == '\n' ? 1 : -1;
+}
+
+void write_magic(FILE* stream) {
+    fputc(FRAME_MAGIC, stream);
+    fputc('\n', stream);
+}
+
+void init_names(NameTable* table) {
+    table->names = NULL;
+    table->numNames = 0;
+    table->capacity = 0;
+    table->ids = NULL;
+    table->idCapacity = 0;
+    init_arena(&table->arena);
+}
+
+void free_names(NameTable* table) {
+    free_arena(&table->arena);
+    init_names(table);
+}
+
+void reset_names(NameTable* table) {
+    reset_arena(&table->arena);
+    table->names = NULL;
+    table->numNames = 0;
+    table->capacity = 0;
+    table->ids = NULL;
+    table->idCapacity = 0;
+}
+
+uint32_t add_name(NameTable* table, char* name) {
+    if (table->numNames == table->capacity) {
+        // the old array stays in the arena, but doubling bounds the waste
+        uint32_t capacity = table->capacity == 0 ? 8 : table->capacity * 2;
+        char** names = arena_alloc(&table->arena, sizeof(char*) * capacity);
+        if (names == NULL) {
+            return 0;
+        }
+        if (table->numNames > 0) {
+            memcpy(names, table->names, sizeof(char*) * table->numNames);
+        }
+        table->names = names;
+        table->capacity = capacity;
+    }
+    char* copy = arena_strndup(&table->arena, name, strlen(name));
+    if (copy == NULL) {
+        return 0;
+    }
+    table->names[table->numNames++] = copy;
+    return table->numNames;
+}
+
+bool learn_name(NameTable* table, uint32_t id, char* name) {
+    if (id != table->numNames + 1) {
+        return false;
+    }
+    return add_name(table, name) != 0;
+}
+
+uint32_t find_name(NameTable* table, char* name) {
+    // the most recent opponents are the most likely to come up again
+    for (uint32_t i = table->numNames; i > 0; i--) {
+        if (!strcmp(table->names[i - 1], name)) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+uint32_t add_player_name(NameTable* table, PlayerId player) {
+    if (player >= table->idCapacity) {
+        // ids are handed out densely, so this is bounded by the players seen
+        uint32_t capacity = table->idCapacity == 0 ? 64
+                : table->idCapacity * 2;
+        while (capacity <= player) {
+            capacity *= 2;
+        }
+        uint32_t* ids = arena_alloc(&table->arena,
+                sizeof(uint32_t) * capacity);
+        if (ids == NULL) {
+            return 0;
+        }
+        memset(ids, 0, sizeof(uint32_t) * capacity);
+        if (table->idCapacity > 0) {
+            memcpy(ids, table->ids, sizeof(uint32_t) * table->idCapacity);
+        }
+        table->ids = ids;
+        table->idCapacity = capacity;
+    }
+    uint32_t id = add_name(table, player_name(player));
+    table->ids[player] = id;
+    return id;
+}
+
+uint32_t find_player_name(NameTable* table, PlayerId player) {
+    return player < table->idCapacity ? table->ids[player] : 0;
+}
+
+char* lookup_name(NameTable* table, uint32_t id) {
+    if (id == 0 || id > table->numNames) {
+        return NULL;
+    }
+    return table->names[id - 1];
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "shared.h"
+#include "arena.h"
+
+#ifndef FRAME_H
+#define FRAME_H
+
+// The byte a peer sends first, followed by a newline, to switch a connection
+// to frames. The newline means a text-only peer sees a complete (bad) line and
+// hangs up rather than waiting for the rest of it.
+#define FRAME_MAGIC 0xB5
+// Every frame starts with its type (1 byte) and payload length (2 bytes)
+#define FRAME_HEADER_SIZE 3
+// The longest player name a NAME frame can carry
+#define MAX_FRAME_NAME 255
+// The longest frame encode_message can produce
+#define MAX_FRAME_LENGTH (FRAME_HEADER_SIZE + 4 + MAX_FRAME_NAME)
+
+// Bits of the flags in a MATCH frame
+#define MATCH_FLAG_READY 0x01 // both players exchange READY before moving
+#define MATCH_FLAG_BINARY 0x02 // the opponent reads frames from its peers
+#define MATCH_FLAG_PIPELINE 0x04 // both players send windows of moves
+#define MATCH_FLAG_REFEREE 0x08 // both players send their moves to the server
+
+/**
+ * The kinds of frame, and the fixed layout of each payload. Integers are big
+ * endian.
+ */
+typedef enum MessageType {
+    MESSAGE_HELLO = 1, // features (4)
+    MESSAGE_NAME = 2, // id (4), name (the rest of the payload)
+    MESSAGE_MR = 3, // name id (4), port (2)
+    MESSAGE_MATCH = 4, // match id (4), opponent name id (4), port (2),
+                       // flags (1)
+    MESSAGE_RESULT = 5, // match id (4), result for the sender (1), or for
+                        // the receiver when sent by the server
+    MESSAGE_MOVE = 6, // move (1)
+    MESSAGE_READY = 7 // nothing
+} MessageType;
+
+/**
+ * A decoded frame. Only the fields used by its type are meaningful.
+ *
+ * type (MessageType): the kind of frame
+ * id (uint32_t): the match id (MATCH, RESULT) or name id (NAME, MR)
+ * nameId (uint32_t): the opponent's name id (MATCH)
+ * value (uint32_t): the features (HELLO), flags (MATCH), result (RESULT) or
+ * move (MOVE)
+ * port (uint16_t): the port to play on (MR, MATCH)
+ * name (char[]): the player name (NAME)
+ *
+ */
+typedef struct Message {
+    MessageType type;
+    uint32_t id;
+    uint32_t nameId;
+    uint32_t value;
+    uint16_t port;
+    char name[MAX_FRAME_NAME + 1];
+} Message;
+
+/**
+ * The names one side of a connection has told the other about. Ids are
+ * handed out in order from 1, so a name's id is its index plus one. The
+ * names and the array of them come from the table's own arena, so the table
+ * lives and dies with its connection. A table that is all zeroes is empty.
+ * Names added for a player are also kept by PlayerId, so the server finds
+ * the id of an opponent's name without comparing it to every name sent.
+ *
+ * names (char**): the names, owned by the table
+ * numNames (uint32_t): the number of names
+ * capacity (uint32_t): how many names fit in names before it must grow
+ * ids (uint32_t*): the id of each player's name, indexed by PlayerId, 0 for
+ * players whose names have not been added
+ * idCapacity (uint32_t): the number of players ids has room for
+ * arena (Arena): where the names and both arrays are allocated
+ *
+ */
+typedef struct NameTable {
+    char** names;
+    uint32_t numNames;
+    uint32_t capacity;
+    uint32_t* ids;
+    uint32_t idCapacity;
+    Arena arena;
+} NameTable;
+
+// Encodes message as a frame into buffer, which should hold MAX_FRAME_LENGTH
+// bytes. Returns the length of the frame.
+int encode_message(Message* message, unsigned char* buffer);
+
+// Decodes the frame at the start of buffer. Returns the length of the frame,
+// 0 if it has not all arrived yet, or -1 if it is not a valid frame.
+int decode_message(unsigned char* buffer, size_t length, Message* message);
+
+// Reads a frame from scanner. Returns false on EOF or a bad frame.
+bool scan_message(Scanner* scanner, Message* message);
+
+// Takes the next frame from scanner if all of it has been read in, without
+// reading more. Returns 1 if a frame was taken, 0 if it has not all arrived
+// yet, or -1 if it is not a valid frame.
+int take_message(Scanner* scanner, Message* message);
+
+// Writes message as a frame to stream, without flushing. Returns false if it
+// could not be written.
+bool write_message(FILE* stream, Message* message);
+
+// Checks whether the next byte from scanner is FRAME_MAGIC and if so takes it
+// and the newline after it. Returns true if the peer switched to frames.
+bool scan_magic(Scanner* scanner);
+
+// Like scan_magic, but only looks at what has been read in already. Returns
+// 1 if the peer switched to frames, 0 if not enough has arrived to tell, or
+// -1 if it did not.
+int take_magic(Scanner* scanner);
+
+// Writes FRAME_MAGIC and its newline to stream, without flushing.
+void write_magic(FILE* stream);
+
+void init_names(NameTable* table);
+void free_names(NameTable* table);
+
+// Empties the table for another connection, keeping some of its memory.
+void reset_names(NameTable* table);
+
+// Adds a copy of name to the table. Returns its id, or 0 if it could not be
+// allocated.
+uint32_t add_name(NameTable* table, char* name);
+
+// Stores a name the peer told us about with a NAME frame. Returns false if the
+// id is not the next one in order, or the name could not be allocated.
+bool learn_name(NameTable* table, uint32_t id, char* name);
+
+// Returns the id of name in the table, or 0 if it is not there. Takes time
+// in the number of names, so only for tables of a few.
+uint32_t find_name(NameTable* table, char* name);
+
+// Adds a copy of the player's name to the table. Returns its id, or 0 if it
+// could not be allocated.
+uint32_t add_player_name(NameTable* table, PlayerId player);
+
+// Returns the id of the player's name in the table, or 0 if it has not been
+// added with add_player_name.
+uint32_t find_player_name(NameTable* table, PlayerId player);
+
+// Returns the name with the given id, or NULL if there is none.
+char* lookup_name(NameTable* table, uint32_t id);
+
+#endif
@@ -0,0 +1,755 @@
+#define _GNU_SOURCE
+
+#include "journal.h"
+#include "latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// Every record starts with its checksum (4 bytes), the lengths of the player
+// and opponent names (2 each) and the result (1), followed by both names
+#define RECORD_HEADER_SIZE 9
+// The opponent length of a record without an opponent
+#define NO_OPPONENT 0xFFFF
+// The first bytes of a snapshot file
+#define SNAPSHOT_MAGIC "RPSSNAP1"
+#define SNAPSHOT_MAGIC_SIZE 8
+// The names of the files in a journal directory
+#define SNAPSHOT_NAME "snapshot"
+#define SEGMENT_PREFIX "journal."
+
+/**
+ * Store an integer in a buffer, least significant byte first
+ *
+ * buffer (unsigned char*): where to store it
+ * value (uint64_t): the integer
+ * size (int): how many bytes to store it in
+ *
+ */
+static void put_bytes(unsigned char* buffer, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        buffer[i] = value >> (8 * i);
+    }
+}
+
+/**
+ * Load an integer stored by put_bytes
+ *
+ * buffer (unsigned char*): where it is stored
+ * size (int): how many bytes it is stored in
+ *
+ * Returns the integer
+ *
+ */
+static uint64_t get_bytes(unsigned char* buffer, int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) {
+        value |= (uint64_t) buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * Add bytes to a running CRC-32 checksum
+ *
+ * checksum (uint32_t): the checksum so far, 0 to start
+ * data (unsigned char*): the bytes to add
+ * length (size_t): the number of bytes
+ *
+ * Returns the new checksum
+ *
+ */
+static uint32_t update_checksum(uint32_t checksum, unsigned char* data,
+        size_t length) {
+    checksum = ~checksum;
+    for (size_t i = 0; i < length; i++) {
+        checksum ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            checksum = (checksum >> 1) ^ (0xEDB88320 & -(checksum & 1));
+        }
+    }
+    return ~checksum;
+}
+
+/**
+ * Make a directory entry durable by syncing the directory
+ *
+ * dir (char*): the directory
+ *
+ * Returns false if the directory could not be synced
+ *
+ */
+static bool sync_dir(char* dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+/**
+ * Write all of a buffer to a file
+ *
+ * fd (int): the file
+ * data (char*): the buffer
+ * length (size_t): the bytes to write
+ *
+ * Returns false if the write failed
+ *
+ */
+static bool write_all(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t count = write(fd, data, length);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += count;
+        length -= count;
+    }
+    return true;
+}
+
+/**
+ * Open the segment that starts at a sequence number for appending, creating
+ * it if needed
+ *
+ * journal (Journal*): the journal
+ * start (unsigned long): the sequence number of the segment's first result
+ *
+ * Returns the fd of the segment, or -1 if it could not be opened
+ *
+ */
+static int open_segment(Journal* journal, unsigned long start) {
+    char* path;
+    if (asprintf(&path, "%s/" SEGMENT_PREFIX "%020lu", journal->dir,
+            start) == -1) {
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    free(path);
+    return fd;
+}
+
+/**
+ * Delete the segment that starts at a sequence number
+ *
+ * journal (Journal*): the journal
+ * start (unsigned long): the sequence number of the segment's first result
+ *
+ */
+static void remove_segment(Journal* journal, unsigned long start) {
+    char* path;
+    if (asprintf(&path, "%s/" SEGMENT_PREFIX "%020lu", journal->dir,
+            start) == -1) {
+        return;
+    }
+    unlink(path);
+    free(path);
+}
+
+/**
+ * Write bytes to a snapshot file, adding them to its checksum
+ *
+ * file (FILE*): the snapshot file
+ * checksum (uint32_t*): the checksum of the file so far
+ * data (void*): the bytes to write
+ * length (size_t): the number of bytes
+ *
+ * Returns false if the write failed
+ *
+ */
+static bool write_field(FILE* file, uint32_t* checksum, void* data,
+        size_t length) {
+    *checksum = update_checksum(*checksum, (unsigned char*) data, length);
+    return fwrite(data, 1, length, file) == length;
+}
+
+/**
+ * Write the copy of the standings in journal->snapshot to the snapshot file,
+ * replacing the last one only once the new one is safely on disk
+ *
+ * journal (Journal*): the journal
+ * sequence (unsigned long): the number of results the copy includes
+ *
+ * Returns false if the snapshot could not be written
+ *
+ */
+static bool write_snapshot(Journal* journal, unsigned long sequence) {
+    char* path;
+    char* tempPath;
+    if (asprintf(&path, "%s/" SNAPSHOT_NAME, journal->dir) == -1) {
+        return false;
+    }
+    if (asprintf(&tempPath, "%s.tmp", path) == -1) {
+        free(path);
+        return false;
+    }
+
+    FILE* file = fopen(tempPath, "w");
+    bool written = file != NULL;
+    uint32_t checksum = 0;
+    unsigned char field[8];
+    Snapshot* snapshot = &journal->snapshot;
+    if (written) {
+        written = write_field(file, &checksum, SNAPSHOT_MAGIC,
+                SNAPSHOT_MAGIC_SIZE);
+        put_bytes(field, sequence, 8);
+        written = written && write_field(file, &checksum, field, 8);
+        put_bytes(field, snapshot->numPlayers, 8);
+        written = written && write_field(file, &checksum, field, 8);
+    }
+    for (size_t i = 0; written && i < snapshot->numPlayers; i++) {
+        Player* player = &snapshot->players[i];
+        size_t nameLength = strlen(player->name);
+        uint64_t rating;
+        memcpy(&rating, &player->rating, sizeof(rating));
+
+        put_bytes(field, nameLength, 2);
+        written = write_field(file, &checksum, field, 2)
+                && write_field(file, &checksum, player->name, nameLength);
+        int totals[3] = {player->wins, player->losses, player->ties};
+        for (int j = 0; j < 3; j++) {
+            put_bytes(field, totals[j], 4);
+            written = written && write_field(file, &checksum, field, 4);
+        }
+        put_bytes(field, rating, 8);
+        written = written && write_field(file, &checksum, field, 8);
+    }
+    if (written) {
+        put_bytes(field, checksum, 4);
+        written = fwrite(field, 1, 4, file) == 4 && fflush(file) == 0
+                && fsync(fileno(file)) == 0;
+    }
+    if (file != NULL) {
+        written = fclose(file) == 0 && written;
+    }
+
+    written = written && rename(tempPath, path) == 0
+            && sync_dir(journal->dir);
+    if (!written) {
+        unlink(tempPath);
+    }
+    free(path);
+    free(tempPath);
+    return written;
+}
+
+/**
+ * Read bytes from a snapshot file, adding them to its checksum
+ *
+ * file (FILE*): the snapshot file
+ * checksum (uint32_t*): the checksum of the file so far
+ * data (void*): where to read the bytes to
+ * length (size_t): the number of bytes
+ *
+ * Returns false if the file ended early
+ *
+ */
+static bool read_field(FILE* file, uint32_t* checksum, void* data,
+        size_t length) {
+    if (fread(data, 1, length, file) != length) {
+        return false;
+    }
+    *checksum = update_checksum(*checksum, (unsigned char*) data, length);
+    return true;
+}
+
+/**
+ * Restore the standings from the snapshot file, if there is one
+ *
+ * journal (Journal*): the journal
+ * sequence (unsigned long*): set to the number of results the snapshot
+ * includes, 0 if there is no snapshot
+ *
+ * Returns false (with errno set) if the snapshot could not be read or is
+ * corrupt
+ *
+ */
+static bool read_snapshot(Journal* journal, unsigned long* sequence) {
+    *sequence = 0;
+    char* path;
+    if (asprintf(&path, "%s/" SNAPSHOT_NAME, journal->dir) == -1) {
+        return false;
+    }
+    FILE* file = fopen(path, "r");
+    free(path);
+    if (file == NULL) {
+        return errno == ENOENT;
+    }
+
+    uint32_t checksum = 0;
+    unsigned char field[8];
+    char magic[SNAPSHOT_MAGIC_SIZE];
+    bool valid = read_field(file, &checksum, magic, SNAPSHOT_MAGIC_SIZE)
+            && !memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE)
+            && read_field(file, &checksum, field, 8);
+    *sequence = get_bytes(field, 8);
+    valid = valid && read_field(file, &checksum, field, 8);
+    uint64_t numPlayers = get_bytes(field, 8);
+
+    char name[JOURNAL_MAX_NAME + 1];
+    for (uint64_t i = 0; valid && i < numPlayers; i++) {
+        valid = read_field(file, &checksum, field, 2);
+        size_t nameLength = get_bytes(field, 2);
+        // checked before the checksum, so a corrupt length must not overflow
+        valid = valid && nameLength <= JOURNAL_MAX_NAME
+                && read_field(file, &checksum, name, nameLength);
+        name[nameLength] = '\0';
+
+        int totals[3];
+        for (int j = 0; j < 3; j++) {
+            valid = valid && read_field(file, &checksum, field, 4);
+            totals[j] = get_bytes(field, 4);
+        }
+        valid = valid && read_field(file, &checksum, field, 8);
+        uint64_t rating = get_bytes(field, 8);
+
+        Player player = {.name = name, .wins = totals[0],
+                .losses = totals[1], .ties = totals[2]};
+        memcpy(&player.rating, &rating, sizeof(rating));
+        if (valid) {
+            restore_player(journal->standings, &player);
+        }
+    }
+    valid = valid && fread(field, 1, 4, file) == 4
+            && get_bytes(field, 4) == checksum;
+    fclose(file);
+    if (!valid) {
+        errno = EILSEQ;
+    }
+    return valid;
+}
+
+/**
+ * Record every result in a segment in the standings. A torn or corrupt
+ * record, left by a crash in the middle of a commit, is cut off along with
+ * everything after it.
+ *
+ * journal (Journal*): the journal
+ * start (unsigned long): the sequence number of the segment's first result
+ *
+ * Returns false (with errno set) if the segment could not be read
+ *
+ */
+static bool replay_segment(Journal* journal, unsigned long start) {
+    char* path;
+    if (asprintf(&path, "%s/" SEGMENT_PREFIX "%020lu", journal->dir,
+            start) == -1) {
+        return false;
+    }
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    free(path);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info)) {
+        return false;
+    }
+    unsigned char* data = malloc(info.st_size + 1);
+    size_t size = 0;
+    while (size < (size_t) info.st_size) {
+        ssize_t count = read(fd, data + size, info.st_size - size);
+        if (count <= 0) {
+            break;
+        }
+        size += count;
+    }
+
+    if (journal->sequence < start) {
+        journal->sequence = start;
+    }
+    char player[JOURNAL_MAX_NAME + 1];
+    char opponent[JOURNAL_MAX_NAME + 1];
+    size_t offset = 0;
+    while (offset + RECORD_HEADER_SIZE <= size) {
+        unsigned char* record = data + offset;
+        size_t playerLength = get_bytes(record + 4, 2);
+        size_t opponentLength = get_bytes(record + 6, 2);
+        size_t length = RECORD_HEADER_SIZE + playerLength
+                + (opponentLength == NO_OPPONENT ? 0 : opponentLength);
+        if (offset + length > size || get_bytes(record, 4)
+                != update_checksum(0, record + 4, length - 4)) {
+            break;
+        }
+
+        memcpy(player, record + RECORD_HEADER_SIZE, playerLength);
+        player[playerLength] = '\0';
+        if (opponentLength != NO_OPPONENT) {
+            memcpy(opponent, record + RECORD_HEADER_SIZE + playerLength,
+                    opponentLength);
+            opponent[opponentLength] = '\0';
+        }
+        record_result(journal->standings, player,
+                opponentLength == NO_OPPONENT ? NULL : opponent,
+                (GameResult) record[8]);
+        journal->sequence++;
+        journal->stats.recovered++;
+        offset += length;
+    }
+    if (offset < size && ftruncate(fd, offset)) {
+        free(data);
+        close(fd);
+        return false;
+    }
+    free(data);
+    close(fd);
+    return true;
+}
+
+/**
+ * Compare two segment start numbers, for qsort
+ *
+ * a (const void*): the first start number
+ * b (const void*): the second start number
+ *
+ * Returns less than, equal to or greater than 0 as a is less than, equal to
+ * or greater than b
+ *
+ */
+static int compare_starts(const void* a, const void* b) {
+    unsigned long first = *(const unsigned long*) a;
+    unsigned long second = *(const unsigned long*) b;
+    return (first > second) - (first < second);
+}
+
+/**
+ * Find every segment in the journal directory
+ *
+ * journal (Journal*): the journal
+ * numStarts (size_t*): set to the number of segments
+ *
+ * Returns the sequence numbers the segments start at, in order, which must
+ * be freed, or NULL if the directory could not be read
+ *
+ */
+static unsigned long* find_segments(Journal* journal, size_t* numStarts) {
+    DIR* dir = opendir(journal->dir);
+    if (dir == NULL) {
+        return NULL;
+    }
+    unsigned long* starts = malloc(sizeof(unsigned long));
+    *numStarts = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char* end;
+        if (strncmp(entry->d_name, SEGMENT_PREFIX, strlen(SEGMENT_PREFIX))) {
+            continue;
+        }
+        char* number = entry->d_name + strlen(SEGMENT_PREFIX);
+        unsigned long start = strtoul(number, &end, 10);
+        if (*number == '\0' || *end != '\0') {
+            continue;
+        }
+        starts = realloc(starts, sizeof(unsigned long) * (*numStarts + 1));
+        starts[(*numStarts)++] = start;
+    }
+    closedir(dir);
+    qsort(starts, *numStarts, sizeof(unsigned long), compare_starts);
+    return starts;
+}
+
+/**
+ * Rebuild the standings from the snapshot and the segments written since,
+ * removing segments the snapshot has made redundant, and open the last
+ * segment for appending
+ *
+ * journal (Journal*): the journal
+ *
+ * Returns false (with errno set) on failure
+ *
+ */
+static bool recover_journal(Journal* journal) {
+    unsigned long snapshotSequence;
+    if (!read_snapshot(journal, &snapshotSequence)) {
+        return false;
+    }
+    journal->sequence = snapshotSequence;
+
+    size_t numStarts;
+    unsigned long* starts = find_segments(journal, &numStarts);
+    if (starts == NULL) {
+        return false;
+    }
+    journal->segment = snapshotSequence;
+    for (size_t i = 0; i < numStarts; i++) {
+        if (starts[i] < snapshotSequence) {
+            // a crash between writing a snapshot and removing the segment
+            // before it, whose results the snapshot already has
+            remove_segment(journal, starts[i]);
+            continue;
+        }
+        if (!replay_segment(journal, starts[i])) {
+            free(starts);
+            return false;
+        }
+        journal->segment = starts[i];
+    }
+    free(starts);
+
+    journal->sinceSnapshot = journal->sequence - snapshotSequence;
+    journal->fd = open_segment(journal, journal->segment);
+    return journal->fd != -1 && sync_dir(journal->dir);
+}
+
+Journal* open_journal(char* dir, Standings* standings) {
+    unsigned long start = monotonic_nanos();
+    if (mkdir(dir, 0755) && errno != EEXIST) {
+        return NULL;
+    }
+
+    Journal* journal = calloc(1, sizeof(Journal));
+    journal->dir = strdup(dir);
+    journal->standings = standings;
+    journal->pendingSize = journal->writingSize = JOURNAL_COMMIT_BYTES;
+    journal->pending = malloc(journal->pendingSize);
+    journal->writing = malloc(journal->writingSize);
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->wake, NULL);
+
+    if (!recover_journal(journal)) {
+        int error = errno;
+        free(journal->pending);
+        free(journal->writing);
+        free(journal->dir);
+        free(journal);
+        errno = error;
+        return NULL;
+    }
+    journal->stats.recoveryNanos = monotonic_nanos() - start;
+    return journal;
+}
+
+void journal_result(Journal* journal, PlayerId playerId, PlayerId opponentId,
+        GameResult result) {
+    // the journal outlives the ids, so it holds the names
+    char* player = player_name(playerId);
+    char* opponent = opponentId == NO_PLAYER ? NULL : player_name(opponentId);
+    size_t playerLength = strlen(player);
+    size_t opponentLength = opponent == NULL ? 0 : strlen(opponent);
+    if (playerLength > JOURNAL_MAX_NAME || opponentLength > JOURNAL_MAX_NAME) {
+        fprintf(stderr, "Not journalling result for %.40s...\n", player);
+        record_player_result(journal->standings, playerId, opponentId,
+                result);
+        return;
+    }
+    size_t length = RECORD_HEADER_SIZE + playerLength + opponentLength;
+
+    pthread_mutex_lock(&journal->lock);
+    if (journal->pendingLength + length > journal->pendingSize) {
+        // the committer is behind, hold on to everything until it catches up
+        while (journal->pendingLength + length > journal->pendingSize) {
+            journal->pendingSize *= 2;
+        }
+        journal->pending = realloc(journal->pending, journal->pendingSize);
+    }
+    unsigned char* record = (unsigned char*) journal->pending
+            + journal->pendingLength;
+    put_bytes(record + 4, playerLength, 2);
+    put_bytes(record + 6, opponent == NULL ? NO_OPPONENT : opponentLength, 2);
+    record[8] = result;
+    memcpy(record + RECORD_HEADER_SIZE, player, playerLength);
+    if (opponent != NULL) {
+        memcpy(record + RECORD_HEADER_SIZE + playerLength, opponent,
+                opponentLength);
+    }
+    put_bytes(record, update_checksum(0, record + 4, length - 4), 4);
+    journal->pendingLength += length;
+    journal->pendingRecords++;
+    journal->sequence++;
+    journal->sinceSnapshot++;
+
+    // recorded under our lock, so a snapshot never includes a result the
+    // journal is missing or misses one it has
+    record_player_result(journal->standings, playerId, opponentId,
+            result);
+    if (journal->pendingLength >= JOURNAL_COMMIT_BYTES) {
+        pthread_cond_signal(&journal->wake);
+    }
+    pthread_mutex_unlock(&journal->lock);
+}
+
+/**
+ * Snapshot the standings and start a new segment, removing the old segment
+ * once the snapshot is safely on disk. Only called by the committer.
+ *
+ * journal (Journal*): the journal, whose snapshot holds the standings
+ * sequence (unsigned long): the number of results the snapshot includes
+ *
+ * Returns false if the snapshot or the new segment could not be written, in
+ * which case the old segment is kept
+ *
+ */
+static bool rotate_journal(Journal* journal, unsigned long sequence) {
+    int fd = open_segment(journal, sequence);
+    if (fd == -1) {
+        perror("Journal segment");
+        return false;
+    }
+    if (!write_snapshot(journal, sequence)) {
+        perror("Journal snapshot");
+        close(fd);
+        remove_segment(journal, sequence);
+        return false;
+    }
+    close(journal->fd);
+    remove_segment(journal, journal->segment);
+    journal->fd = fd;
+    journal->segment = sequence;
+    __atomic_add_fetch(&journal->stats.snapshots, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * Write a batch to the end of the segment and sync it, trying again up to
+ * JOURNAL_COMMIT_ATTEMPTS times. Whatever a failed attempt wrote is cut off
+ * before the next, so a torn record is never left in the middle of the
+ * segment for recovery to stop at.
+ *
+ * journal (Journal*): the journal
+ * batch (char*): the records
+ * length (size_t): the bytes of records
+ *
+ * Returns false if every attempt failed
+ *
+ */
+static bool commit_batch(Journal* journal, char* batch, size_t length) {
+    off_t start = lseek(journal->fd, 0, SEEK_END);
+    if (start == -1) {
+        return false;
+    }
+    struct timespec pause = {.tv_sec = JOURNAL_RETRY_INTERVAL / 1000,
+            .tv_nsec = (JOURNAL_RETRY_INTERVAL % 1000) * 1000000L};
+    for (int attempt = 0; attempt < JOURNAL_COMMIT_ATTEMPTS; attempt++) {
+        if (attempt > 0) {
+            perror("Journal commit");
+            nanosleep(&pause, NULL);
+            if (ftruncate(journal->fd, start)) {
+                continue;
+            }
+        }
+        // a failed sync may have dropped the pages, so rewrite them all
+        if (write_all(journal->fd, batch, length)
+                && !fdatasync(journal->fd)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Commit batches of results until the server exits. Each batch is whatever
+ * was appended since the last, written and synced at once.
+ *
+ * journalArg (void*): the Journal
+ *
+ * Returns NULL
+ *
+ */
+static void* commit_journal(void* journalArg) {
+    Journal* journal = (Journal*) journalArg;
+    JournalStats* stats = &journal->stats;
+    while (1) {
+        pthread_mutex_lock(&journal->lock);
+        if (journal->pendingLength < JOURNAL_COMMIT_BYTES) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += JOURNAL_COMMIT_INTERVAL * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&journal->wake, &journal->lock, &deadline);
+        }
+        // take the batch, leaving our last buffer for the next one
+        char* batch = journal->pending;
+        size_t batchSize = journal->pendingSize;
+        size_t length = journal->pendingLength;
+        unsigned long records = journal->pendingRecords;
+        journal->pending = journal->writing;
+        journal->pendingSize = journal->writingSize;
+        journal->pendingLength = 0;
+        journal->pendingRecords = 0;
+        journal->writing = batch;
+        journal->writingSize = batchSize;
+
+        unsigned long sequence = journal->sequence;
+        bool snapshot = journal->sinceSnapshot >= JOURNAL_SNAPSHOT_RESULTS;
+        if (snapshot) {
+            take_snapshot(journal->standings, &journal->snapshot);
+        }
+        pthread_mutex_unlock(&journal->lock);
+
+        if (length > 0) {
+            unsigned long start = monotonic_nanos();
+            if (!commit_batch(journal, batch, length)) {
+                // the standings already hold results the journal cannot, so
+                // carrying on would leave them to be lost by the next crash
+                perror("Journal commit");
+                exit(8);
+            }
+            __atomic_add_fetch(&stats->syncNanos, monotonic_nanos() - start,
+                    __ATOMIC_RELAXED);
+            __atomic_add_fetch(&stats->commits, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&stats->records, records, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&stats->bytes, length, __ATOMIC_RELAXED);
+            if (records > stats->largestCommit) {
+                __atomic_store_n(&stats->largestCommit, records,
+                        __ATOMIC_RELAXED);
+            }
+        }
+        // a failed rotation is tried again at the next commit, so the
+        // segment recovery replays never grows far past a snapshot's worth
+        if (snapshot && rotate_journal(journal, sequence)) {
+            pthread_mutex_lock(&journal->lock);
+            journal->sinceSnapshot = journal->sequence - sequence;
+            pthread_mutex_unlock(&journal->lock);
+        }
+    }
+    return NULL;
+}
+
+bool start_journal(Journal* journal) {
+    if (pthread_create(&journal->committer, NULL, commit_journal,
+            (void*) journal)) {
+        return false;
+    }
+    pthread_detach(journal->committer);
+    return true;
+}
+
+void print_journal_stats(Journal* journal, FILE* stream) {
+    JournalStats* stats = &journal->stats;
+    unsigned long commits = __atomic_load_n(&stats->commits,
+            __ATOMIC_RELAXED);
+    unsigned long records = __atomic_load_n(&stats->records,
+            __ATOMIC_RELAXED);
+    unsigned long syncNanos = __atomic_load_n(&stats->syncNanos,
+            __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&journal->lock);
+    unsigned long sequence = journal->sequence;
+    pthread_mutex_unlock(&journal->lock);
+
+    fprintf(stream, "journal sequence %lu\n", sequence);
+    fprintf(stream, "journal commits %lu\n", commits);
+    fprintf(stream, "journal records %lu\n", records);
+    fprintf(stream, "journal bytes %lu\n",
+            __atomic_load_n(&stats->bytes, __ATOMIC_RELAXED));
+    fprintf(stream, "journal mean_commit %.2f\n",
+            commits == 0 ? 0.0 : (double) records / commits);
+    fprintf(stream, "journal largest_commit %lu\n",
+            __atomic_load_n(&stats->largestCommit, __ATOMIC_RELAXED));
+    fprintf(stream, "journal mean_sync_ns %lu\n",
+            commits == 0 ? 0 : syncNanos / commits);
+    fprintf(stream, "journal snapshots %lu\n",
+            __atomic_load_n(&stats->snapshots, __ATOMIC_RELAXED));
+    fprintf(stream, "journal recovered %lu\n", stats->recovered);
+    fprintf(stream, "journal recovery_ns %lu\n", stats->recoveryNanos);
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "shared.h"
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+// How long (ms) results wait to be committed, at most, so a crash loses no
+// more than this much
+#define JOURNAL_COMMIT_INTERVAL 10
+// Results past this many bytes are committed without waiting out the interval
+#define JOURNAL_COMMIT_BYTES (64 * 1024)
+// A snapshot of the standings is written after this many results, which
+// bounds how much of the journal is replayed on startup
+#define JOURNAL_SNAPSHOT_RESULTS 100000
+// How many times a batch is written before the journal gives up on the disk
+#define JOURNAL_COMMIT_ATTEMPTS 10
+// How long (ms) to wait before writing a failed batch again
+#define JOURNAL_RETRY_INTERVAL 100
+// The longest name a journal record can hold
+#define JOURNAL_MAX_NAME 0xFFFE
+
+/**
+ * Counters kept by the committer thread
+ *
+ * commits (unsigned long): the number of batches written and synced
+ * records (unsigned long): the number of results committed
+ * bytes (unsigned long): the number of bytes committed
+ * largestCommit (unsigned long): the most results committed at once
+ * syncNanos (unsigned long): the total time spent in fdatasync
+ * snapshots (unsigned long): the number of snapshots written
+ * recovered (unsigned long): the results replayed from the journal on
+ * startup
+ * recoveryNanos (unsigned long): how long startup recovery took
+ *
+ */
+typedef struct JournalStats {
+    unsigned long commits;
+    unsigned long records;
+    unsigned long bytes;
+    unsigned long largestCommit;
+    unsigned long syncNanos;
+    unsigned long snapshots;
+    unsigned long recovered;
+    unsigned long recoveryNanos;
+} JournalStats;
+
+/**
+ * An append-only log of every result, kept in a directory as a snapshot of
+ * the standings and the journal segments written since. Results are appended
+ * to a buffer and committed in batches by their own thread, with one
+ * fdatasync per batch. Thread safe.
+ *
+ * dir (char*): the directory holding the journal
+ * standings (Standings*): the standings the journal is a record of
+ * fd (int): the segment being appended to
+ * segment (unsigned long): the sequence number the segment starts at
+ * sequence (unsigned long): the number of results logged, ever
+ * sinceSnapshot (unsigned long): the results logged since the last snapshot
+ * pending (char*): results appended but not yet handed to the committer
+ * pendingLength (size_t): the bytes in pending
+ * pendingSize (size_t): the capacity of pending
+ * pendingRecords (unsigned long): the results in pending
+ * writing (char*): the batch being committed, swapped with pending
+ * writingSize (size_t): the capacity of writing
+ * snapshot (Snapshot): the standings copied for the next snapshot file
+ * lock (pthread_mutex_t): guards pending and the sequence, and is held
+ * around recording each result so snapshots line up with the journal
+ * wake (pthread_cond_t): signalled when pending is full
+ * committer (pthread_t): the thread committing batches
+ * stats (JournalStats): the committer's counters
+ *
+ */
+typedef struct Journal {
+    char* dir;
+    Standings* standings;
+    int fd;
+    unsigned long segment;
+    unsigned long sequence;
+    unsigned long sinceSnapshot;
+    char* pending;
+    size_t pendingLength;
+    size_t pendingSize;
+    unsigned long pendingRecords;
+    char* writing;
+    size_t writingSize;
+    Snapshot snapshot;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t committer;
+    JournalStats stats;
+} Journal;
+
+// Opens the journal in dir (creating the directory if needed) and rebuilds
+// the standings from its last snapshot and the segments written since. A
+// torn record at the end of the journal is cut off. Returns NULL (with errno
+// set) if the journal could not be opened or is corrupt.
+Journal* open_journal(char* dir, Standings* standings);
+
+// Starts the thread committing results. Must be called after the report
+// signals are blocked. Returns false if the thread could not be started.
+bool start_journal(Journal* journal);
+
+// Records a result in the standings and appends it to the journal, to be
+// committed within JOURNAL_COMMIT_INTERVAL. Does not wait for the commit.
+void journal_result(Journal* journal, PlayerId player, PlayerId opponent,
+        GameResult result);
+
+// Prints the committer's counters, in the format "journal <key> <value>".
+void print_journal_stats(Journal* journal, FILE* stream);
+
+#endif
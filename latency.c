@@ -0,0 +1,136 @@
+#include "latency.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+/** The names of the stages, as printed */
+static const char* stageNames[NUM_STAGES] = {"request", "enqueue", "pair",
+        "match", "play", "total"};
+
+/**
+ * Find the bucket a latency is counted in. Latencies below
+ * LATENCY_SUB_BUCKETS get a bucket each, above that every power of two is
+ * split into LATENCY_SUB_BUCKETS equal buckets.
+ *
+ * nanos (unsigned long): the latency
+ *
+ * Returns the index of the bucket
+ *
+ */
+static int bucket_index(unsigned long nanos) {
+    if (nanos < LATENCY_SUB_BUCKETS) {
+        return nanos;
+    }
+    int shift = 63 - __builtin_clzl(nanos) - LATENCY_SUB_BITS;
+    return (shift + 1) * LATENCY_SUB_BUCKETS
+            + (nanos >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+/**
+ * Find the largest latency counted in a bucket
+ *
+ * index (int): the index of the bucket
+ *
+ * Returns the top of the bucket, in nanoseconds
+ *
+ */
+static unsigned long bucket_top(int index) {
+    if (index < LATENCY_SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / LATENCY_SUB_BUCKETS - 1;
+    unsigned long bottom = (unsigned long) (LATENCY_SUB_BUCKETS
+            + index % LATENCY_SUB_BUCKETS) << shift;
+    return bottom + (1UL << shift) - 1;
+}
+
+unsigned long monotonic_nanos(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+void init_latencies(Latencies* latencies) {
+    memset(latencies, 0, sizeof(Latencies));
+}
+
+void record_stage(Latencies* latencies, Stage stage, unsigned long from,
+        unsigned long to) {
+    if (from == 0 || to < from) {
+        return;
+    }
+    Histogram* histogram = &latencies->stages[stage];
+    unsigned long nanos = to - from;
+    __atomic_add_fetch(&histogram->buckets[bucket_index(nanos)], 1,
+            __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->total, nanos, __ATOMIC_RELAXED);
+
+    unsigned long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while (nanos > max && !__atomic_compare_exchange_n(&histogram->max, &max,
+            nanos, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        continue; // max was reloaded, try again if we are still above it
+    }
+}
+
+void record_result_latency(Latencies* latencies, Timeline* timeline,
+        unsigned long now) {
+    record_stage(latencies, STAGE_PLAY, timeline->matched, now);
+    record_stage(latencies, STAGE_TOTAL, timeline->parsed, now);
+}
+
+unsigned long histogram_percentile(Histogram* histogram, double percentile) {
+    // other threads may still be recording, so work from one copy of the
+    // counts rather than the histogram's own total
+    unsigned long counts[LATENCY_BUCKETS];
+    unsigned long count = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        counts[i] = __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        count += counts[i];
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    // the rank of the latency wanted, counting from 1 and rounding up
+    double exact = percentile / 100 * count;
+    unsigned long rank = (unsigned long) exact;
+    if (rank < exact || rank == 0) {
+        rank++;
+    }
+    unsigned long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucket_top(i);
+        }
+    }
+    return bucket_top(LATENCY_BUCKETS - 1);
+}
+
+void print_latencies(Latencies* latencies, FILE* stream) {
+    double percentiles[] = {50, 99, 99.9};
+    char* names[] = {"p50", "p99", "p999"};
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+        Histogram* histogram = &latencies->stages[stage];
+        unsigned long count = __atomic_load_n(&histogram->count,
+                __ATOMIC_RELAXED);
+        unsigned long total = __atomic_load_n(&histogram->total,
+                __ATOMIC_RELAXED);
+        unsigned long max = __atomic_load_n(&histogram->max,
+                __ATOMIC_RELAXED);
+
+        fprintf(stream, "latency %s_count %lu\n", stageNames[stage], count);
+        fprintf(stream, "latency %s_mean_ns %lu\n", stageNames[stage],
+                count == 0 ? 0 : total / count);
+        for (int i = 0; i < 3; i++) {
+            // the top bucket is rounded up past the largest latency in it
+            unsigned long value = histogram_percentile(histogram,
+                    percentiles[i]);
+            fprintf(stream, "latency %s_%s_ns %lu\n", stageNames[stage],
+                    names[i], value < max ? value : max);
+        }
+        fprintf(stream, "latency %s_max_ns %lu\n", stageNames[stage], max);
+    }
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+// Each power of two of nanoseconds is split into 2^LATENCY_SUB_BITS buckets,
+// so a percentile is never more than 1/8 above the latency it stands for
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+// Enough buckets for any latency that fits in an unsigned long
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+/** The stages of a match request, each timed from the end of the last */
+typedef enum Stage {
+    // from the accept, or the end of the client's last match, to its MR
+    // being parsed
+    STAGE_REQUEST,
+    // from the MR being parsed to the request channel taking the request
+    STAGE_ENQUEUE,
+    // from the request being handed to the channel to the matchmaker
+    // pairing it with an opponent
+    STAGE_PAIR,
+    // from being paired to the MATCH being written
+    STAGE_MATCH,
+    // from the MATCH being written to the RESULT being received (or sent,
+    // for a refereed match)
+    STAGE_PLAY,
+    // from the MR being parsed to the RESULT, the whole of a match as the
+    // client sees it
+    STAGE_TOTAL,
+    NUM_STAGES
+} Stage;
+
+// The times (monotonic nanoseconds) a match request reached each point of
+// its life, 0 for points it has not reached.
+typedef struct Timeline {
+    unsigned long accepted;
+    unsigned long parsed;
+    unsigned long enqueued;
+    unsigned long paired;
+    unsigned long matched;
+} Timeline;
+
+// The latencies of one stage, counted into log-linear buckets. Recorded
+// without locks, from any thread.
+typedef struct Histogram {
+    unsigned long buckets[LATENCY_BUCKETS];
+    unsigned long count;
+    // The sum of every latency, for the mean.
+    unsigned long total;
+    unsigned long max;
+} Histogram;
+
+// A histogram for every stage of a match request.
+typedef struct Latencies {
+    Histogram stages[NUM_STAGES];
+} Latencies;
+
+// Returns the time on the monotonic clock, in nanoseconds.
+unsigned long monotonic_nanos(void);
+
+void init_latencies(Latencies* latencies);
+
+// Records the time between two points of a timeline against a stage. Does
+// nothing if the earlier point was never reached.
+void record_stage(Latencies* latencies, Stage stage, unsigned long from,
+        unsigned long to);
+
+// Records the end of a match at now, for the RESULT of a match whose
+// timeline has reached the MATCH.
+void record_result_latency(Latencies* latencies, Timeline* timeline,
+        unsigned long now);
+
+// Returns the latency (ns) below which percentile percent of those recorded
+// fall, rounded up to the top of its bucket, or 0 if none were recorded.
+unsigned long histogram_percentile(Histogram* histogram, double percentile);
+
+// Prints the count, mean, p50, p99, p999 and max of every stage, in the
+// format "latency <stage>_<stat> <value>".
+void print_latencies(Latencies* latencies, FILE* stream);
+
+#endif
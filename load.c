@@ -0,0 +1,512 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+
+#include "shared.h"
+#include "agent.h"
+
+// The number of agents simulated without -a
+#define DEFAULT_AGENTS 64
+// How long (seconds) a run lasts without -d
+#define DEFAULT_DURATION 10
+// The latencies an agent has room for before it first grows
+#define INITIAL_LATENCIES 1024
+// The most descriptors an agent holds at once: its listening socket, its
+// connection to the rpsserver and its connection to its opponent
+#define AGENT_DESCRIPTORS 3
+// The descriptors kept for everything other than the agents
+#define SPARE_DESCRIPTORS 8
+// The events taken from epoll at a time
+#define MAX_EVENTS 256
+// The bit of an event's data set if it is from the rpsserver, the rest of it
+// is the number of the agent
+#define FROM_SERVER 1
+
+/** Exit codes */
+typedef enum LoadError {
+    LOAD_USAGE = 1,
+    LOAD_NO_AGENTS = 2
+} LoadError;
+
+/**
+ * A simulated agent, speaking the same protocol as rpsclient without blocking
+ * on any of it: the agents share one epoll loop, which moves each along as
+ * its input arrives.
+ *
+ * info (AgentInfo): the agent, as rpsclient would run it
+ * match (Match): the match the agent is waiting for or playing
+ * started (unsigned long): when (ns into the run) the current match was due
+ * latencies (unsigned long*): how long (ns) each match took
+ * numLatencies (size_t): the number of latencies recorded
+ * capacity (size_t): the number of latencies there is room for
+ *
+ */
+typedef struct Agent {
+    AgentInfo info;
+    Match match;
+    unsigned long started;
+    unsigned long* latencies;
+    size_t numLatencies;
+    size_t capacity;
+} Agent;
+
+/**
+ * A load test run
+ *
+ * port (char*): the port of the rpsserver
+ * numAgents (int): the number of agents
+ * duration (int): how long the run lasts, in seconds
+ * rate (int): match requests per second for an open loop, 0 for a closed
+ * loop where every agent requests its next match as soon as it can
+ * agents (Agent*): the agents
+ * epollFd (int): the epoll instance watching every agent's connections
+ * start (struct timespec): when the run started
+ * idle (int*): the numbers of the agents waiting to request a match
+ * numIdle (int): the number of agents waiting to request a match
+ * released (unsigned long): the open loop requests handed to agents so far
+ * failed (int): the number of agents that gave up early
+ *
+ */
+typedef struct Load {
+    char* port;
+    int numAgents;
+    int duration;
+    int rate;
+    Agent* agents;
+    int epollFd;
+    struct timespec start;
+    int* idle;
+    int numIdle;
+    unsigned long released;
+    int failed;
+} Load;
+
+/**
+ * Get the time elapsed since an earlier point on the monotonic clock
+ *
+ * since (struct timespec*): the earlier point
+ *
+ * Returns the elapsed time in nanoseconds
+ *
+ */
+static unsigned long nanos_since(struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000000UL
+            + now.tv_nsec - since->tv_nsec;
+}
+
+/**
+ * Record how long a match took
+ *
+ * agent (Agent*): the agent that played the match
+ * nanos (unsigned long): how long it took
+ *
+ */
+static void record_latency(Agent* agent, unsigned long nanos) {
+    if (agent->numLatencies == agent->capacity) {
+        agent->capacity *= 2;
+        agent->latencies = realloc(agent->latencies,
+                sizeof(unsigned long) * agent->capacity);
+    }
+    agent->latencies[agent->numLatencies++] = nanos;
+}
+
+/**
+ * Watch a descriptor of an agent with epoll, if it is not watched already
+ *
+ * load (Load*): the run
+ * fd (int): the descriptor
+ * data (uint64_t): the number of the agent, with FROM_SERVER if fd is its
+ * connection to the rpsserver
+ *
+ */
+static void watch(Load* load, int fd, uint64_t data) {
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = data};
+    // a descriptor is dropped from epoll once it is closed, so one with the
+    // same number as before may well be a new connection
+    epoll_ctl(load->epollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/**
+ * Catch up with an agent that has moved on to another stage: watch the
+ * connections it has opened, and once it is done with a match record how
+ * long it took and queue the agent for its next one.
+ *
+ * load (Load*): the run
+ * number (int): the number of the agent
+ * before (AgentStage): the stage the agent was at before
+ *
+ */
+static void settle_agent(Load* load, int number, AgentStage before) {
+    Agent* agent = &load->agents[number];
+    AgentInfo* info = &agent->info;
+    if (info->stage == before) {
+        return;
+    }
+
+    switch (info->stage) {
+        case STAGE_FAILED:
+            load->failed++;
+            close(info->socketFd);
+            return;
+        case STAGE_IDLE:
+            if (before != STAGE_GREETING && before != STAGE_GREETING_TEXT) {
+                record_latency(agent, nanos_since(&load->start)
+                        - agent->started);
+                free_match(&agent->match);
+                memset(&agent->match, 0, sizeof(Match));
+            }
+            load->idle[load->numIdle++] = number;
+            return;
+        case STAGE_ACCEPTING: {
+            // the opponent may have connected before we were told about
+            // them, so the listening socket is only watched from now on
+            struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT,
+                    .data.u64 = (uint64_t) number << 1};
+            epoll_ctl(load->epollFd, EPOLL_CTL_MOD, info->socketFd, &event);
+            break;
+        }
+        default:
+            break;
+    }
+    if (info->server.to != NULL) {
+        watch(load, info->server.from.fd,
+                (uint64_t) number << 1 | FROM_SERVER);
+    }
+    if (info->opponent.fd != -1) {
+        watch(load, info->opponent.fd, (uint64_t) number << 1);
+    }
+}
+
+/**
+ * Hand match requests to idle agents. In a closed loop every idle agent
+ * requests its next match straight away. In an open loop requests are due
+ * at a fixed rate, and each is timed from when it was due, so time spent
+ * queued behind busy agents counts against the server.
+ *
+ * load (Load*): the run
+ * now (unsigned long): how long (ns) the run has lasted
+ *
+ */
+static void release_requests(Load* load, unsigned long now) {
+    unsigned long interval = load->rate > 0 ? 1000000000UL / load->rate : 0;
+    while (load->numIdle > 0) {
+        unsigned long due = now;
+        if (load->rate > 0) {
+            due = load->released * interval;
+            if (due > now) {
+                return;
+            }
+            load->released++;
+        }
+
+        int number = load->idle[--load->numIdle];
+        Agent* agent = &load->agents[number];
+        agent->started = due;
+        if (request_match(&agent->info) != SUCCESS) {
+            agent->info.stage = STAGE_FAILED;
+        }
+        settle_agent(load, number, STAGE_IDLE);
+    }
+}
+
+/**
+ * Work out how long the event loop may wait before it has something to do
+ * other than handle input
+ *
+ * load (Load*): the run
+ * now (unsigned long): how long (ns) the run has lasted
+ *
+ * Returns the timeout for epoll_wait, in milliseconds
+ *
+ */
+static int next_timeout(Load* load, unsigned long now) {
+    unsigned long wake = load->duration * 1000000000UL;
+    if (load->rate > 0 && load->numIdle > 0) {
+        unsigned long due = load->released * (1000000000UL / load->rate);
+        wake = due < wake ? due : wake;
+    }
+    return wake <= now ? 0 : (wake - now + 999999) / 1000000;
+}
+
+/**
+ * Move every agent along as its input arrives until the run is over
+ *
+ * load (Load*): the run
+ *
+ */
+static void run_agents(Load* load) {
+    struct epoll_event events[MAX_EVENTS];
+    unsigned long end = load->duration * 1000000000UL;
+    unsigned long now;
+    while ((now = nanos_since(&load->start)) < end) {
+        release_requests(load, now);
+        int count = epoll_wait(load->epollFd, events, MAX_EVENTS,
+                next_timeout(load, now));
+        for (int i = 0; i < count; i++) {
+            int number = events[i].data.u64 >> 1;
+            Agent* agent = &load->agents[number];
+            AgentStage before = agent->info.stage;
+            advance_agent(&agent->info, &agent->match,
+                    events[i].data.u64 & FROM_SERVER);
+            settle_agent(load, number, before);
+        }
+    }
+}
+
+/**
+ * Set up an agent and send its HELLO. An agent whose HELLO cannot be sent
+ * fails, but still counts towards the run.
+ *
+ * agent (Agent*): the agent
+ * load (Load*): the run the agent is part of
+ * number (int): the number of the agent, which its name is made from
+ *
+ * Returns false if the agent could not be set up, with errno set
+ *
+ */
+static bool start_agent(Agent* agent, Load* load, int number) {
+    agent->info = init_agent();
+    agent->info.server.port = load->port;
+    // the agents draw their moves from the same process
+    agent->info.ownSeed = true;
+    agent->info.seed = rand();
+    agent->capacity = INITIAL_LATENCIES;
+    agent->latencies = malloc(sizeof(unsigned long) * agent->capacity);
+    agent->numLatencies = 0;
+    if (asprintf(&agent->info.name, "load%d", number) == -1) {
+        return false;
+    }
+
+    // opponents that do not agree to a referee still connect to us
+    if (listen_on_ephemeral(&agent->info.port, &agent->info.socketFd)
+            != SUCCESS
+            || fcntl(agent->info.socketFd, F_SETFL, O_NONBLOCK) == -1) {
+        return false;
+    }
+    // watched once there is an opponent to accept
+    struct epoll_event event = {.events = 0,
+            .data.u64 = (uint64_t) number << 1};
+    if (epoll_ctl(load->epollFd, EPOLL_CTL_ADD, agent->info.socketFd, &event)
+            == -1) {
+        return false;
+    }
+
+    if (start_session(&agent->info) != SUCCESS) {
+        agent->info.stage = STAGE_FAILED;
+    }
+    settle_agent(load, number, STAGE_IDLE);
+    return true;
+}
+
+/**
+ * Check that every agent of a run can hold its descriptors at once, as an
+ * agent that runs out fails mid-match and takes its opponent with it
+ *
+ * load (Load*): the run
+ *
+ * Returns false if the agents need more descriptors than may be open
+ *
+ */
+static bool check_descriptors(Load* load) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1
+            || limit.rlim_cur == RLIM_INFINITY) {
+        return true;
+    }
+    rlim_t needed = (rlim_t) load->numAgents * AGENT_DESCRIPTORS
+            + SPARE_DESCRIPTORS;
+    if (needed <= limit.rlim_cur) {
+        return true;
+    }
+    fprintf(stderr, "Agents: %d agents need %lu descriptors, but only %lu "
+            "may be open\n", load->numAgents, (unsigned long) needed,
+            (unsigned long) limit.rlim_cur);
+    return false;
+}
+
+/**
+ * Free everything a run holds, once it is over
+ *
+ * load (Load*): the run
+ *
+ */
+static void free_load(Load* load) {
+    for (int i = 0; i < load->numAgents; i++) {
+        Agent* agent = &load->agents[i];
+        free_match(&agent->match);
+        free_agent(&agent->info);
+        free(agent->latencies);
+    }
+    free(load->agents);
+    free(load->idle);
+    close(load->epollFd);
+}
+
+/**
+ * Compare two latencies, for qsort
+ *
+ * a (const void*): the first latency
+ * b (const void*): the second latency
+ *
+ * Returns less than, equal to or greater than 0 as a is less than, equal to
+ * or greater than b
+ *
+ */
+static int compare_latencies(const void* a, const void* b) {
+    unsigned long first = *(const unsigned long*) a;
+    unsigned long second = *(const unsigned long*) b;
+    return (first > second) - (first < second);
+}
+
+/**
+ * Print the throughput and latency percentiles of a finished run
+ *
+ * load (Load*): the run
+ * elapsed (unsigned long): how long the run lasted, in nanoseconds
+ * stream (FILE*): where to print the report
+ *
+ */
+static void print_report(Load* load, unsigned long elapsed, FILE* stream) {
+    size_t total = 0;
+    unsigned long* latencies = NULL;
+    for (int i = 0; i < load->numAgents; i++) {
+        Agent* agent = &load->agents[i];
+        if (agent->numLatencies == 0) {
+            continue;
+        }
+        latencies = realloc(latencies,
+                sizeof(unsigned long) * (total + agent->numLatencies));
+        memcpy(latencies + total, agent->latencies,
+                sizeof(unsigned long) * agent->numLatencies);
+        total += agent->numLatencies;
+    }
+    qsort(latencies, total, sizeof(unsigned long), compare_latencies);
+
+    double seconds = elapsed / 1e9;
+    fprintf(stream, "load agents %d\n", load->numAgents);
+    fprintf(stream, "load failed_agents %d\n", load->failed);
+    fprintf(stream, "load mode %s\n", load->rate > 0 ? "open" : "closed");
+    fprintf(stream, "load seconds %.2f\n", seconds);
+    // every match is played by two agents, and each records it
+    fprintf(stream, "load requests %zu\n", total);
+    fprintf(stream, "load requests_per_sec %.1f\n", total / seconds);
+    fprintf(stream, "load matches_per_sec %.1f\n", total / 2 / seconds);
+
+    double percentiles[] = {50, 90, 99, 99.9};
+    char* names[] = {"p50", "p90", "p99", "p999"};
+    for (int i = 0; i < 4; i++) {
+        fprintf(stream, "load latency_%s_ns %lu\n", names[i], total == 0 ? 0
+                : latencies[(size_t) (percentiles[i] / 100 * (total - 1))]);
+    }
+    fprintf(stream, "load latency_max_ns %lu\n",
+            total == 0 ? 0 : latencies[total - 1]);
+    fflush(stream);
+    free(latencies);
+}
+
+/**
+ * Parse a strictly positive integer argument
+ *
+ * arg (char*): the argument
+ * value (int*): set to the value of the argument
+ *
+ * Returns true if the argument was a positive integer
+ *
+ */
+static bool parse_positive(char* arg, int* value) {
+    char* end;
+    long parsed = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || parsed <= 0 || (int) parsed != parsed) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+/**
+ * Parse the command line arguments of a run
+ *
+ * argc (int): the number of arguments
+ * argv (char**): the arguments
+ * load (Load*): the run to configure
+ *
+ * Returns true if the arguments were valid
+ *
+ */
+static bool parse_args(int argc, char** argv, Load* load) {
+    memset(load, 0, sizeof(Load));
+    load->numAgents = DEFAULT_AGENTS;
+    load->duration = DEFAULT_DURATION;
+
+    int opt;
+    bool valid = true;
+    while (valid && (opt = getopt(argc, argv, "a:d:r:")) != -1) {
+        switch (opt) {
+            case 'a':
+                valid = parse_positive(optarg, &load->numAgents)
+                        && load->numAgents >= 2;
+                break;
+            case 'd':
+                valid = parse_positive(optarg, &load->duration);
+                break;
+            case 'r':
+                valid = parse_positive(optarg, &load->rate);
+                break;
+            default:
+                return false;
+        }
+    }
+    if (!valid || optind != argc - 1) {
+        return false;
+    }
+    load->port = argv[optind];
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Load load;
+    if (!parse_args(argc, argv, &load)) {
+        fprintf(stderr, "Usage: rpsload [-a agents] [-d seconds] "
+                "[-r requestspersec] port\n");
+        return LOAD_USAGE;
+    }
+    // opponents that have gone away should fail a match, not kill us
+    signal(SIGPIPE, SIG_IGN);
+    srand(time(NULL));
+
+    if (!check_descriptors(&load)) {
+        return LOAD_NO_AGENTS;
+    }
+    if ((load.epollFd = epoll_create1(0)) == -1) {
+        perror("epoll_create1");
+        return LOAD_NO_AGENTS;
+    }
+    load.agents = calloc(load.numAgents, sizeof(Agent));
+    load.idle = malloc(sizeof(int) * load.numAgents);
+    clock_gettime(CLOCK_MONOTONIC, &load.start);
+
+    for (int i = 0; i < load.numAgents; i++) {
+        if (!start_agent(&load.agents[i], &load, i)) {
+            fprintf(stderr, "Agent %d: %s\n", i, strerror(errno));
+            return LOAD_NO_AGENTS;
+        }
+    }
+    run_agents(&load);
+
+    // agents still waiting on an opponent or an arrival are not waited for
+    print_report(&load, nanos_since(&load.start), stdout);
+    free_load(&load);
+    return 0;
+}
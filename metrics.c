@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+
+#include "metrics.h"
+#include "tally.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+// The most connections waiting for the metrics listener to accept them
+#define METRICS_BACKLOG 16
+// How long (seconds) the listener waits for a scraper to send its request
+#define METRICS_READ_TIMEOUT 1
+// The longest request from a scraper that is read before answering
+#define METRICS_REQUEST_SIZE 1024
+
+/**
+ * The counters of a single thread, which only that thread writes. Blocks are
+ * linked into a list of live blocks while their thread runs, and recycled
+ * once it exits.
+ *
+ * counts (unsigned long[]): the count of each Counter
+ * prev (struct CounterBlock*): the previous live block
+ * next (struct CounterBlock*): the next live (or spare) block
+ *
+ */
+typedef struct CounterBlock {
+    unsigned long counts[NUM_COUNTERS];
+    struct CounterBlock* prev;
+    struct CounterBlock* next;
+} CounterBlock;
+
+/**
+ * Every thread's counters
+ *
+ * lock (pthread_mutex_t): guards everything below, but never a live block's
+ * counts, which are written without it
+ * live (CounterBlock*): the blocks of threads that are still running
+ * spare (CounterBlock*): the blocks of threads that have exited
+ * retired (unsigned long[]): the counts of threads that have exited
+ * key (pthread_key_t): retires a thread's block when it exits
+ * once (pthread_once_t): creates the key
+ *
+ */
+static struct {
+    pthread_mutex_t lock;
+    CounterBlock* live;
+    CounterBlock* spare;
+    unsigned long retired[NUM_COUNTERS];
+    pthread_key_t key;
+    pthread_once_t once;
+} counters = {.lock = PTHREAD_MUTEX_INITIALIZER, .once = PTHREAD_ONCE_INIT};
+
+/** The calling thread's counters, NULL until it first counts something */
+static __thread CounterBlock* threadBlock;
+
+/**
+ * Fold the counts of a thread that has exited into the retired counts, and
+ * keep its block for the next thread
+ *
+ * blockArg (void*): the CounterBlock of the thread
+ *
+ */
+static void retire_block(void* blockArg) {
+    CounterBlock* block = (CounterBlock*) blockArg;
+    pthread_mutex_lock(&counters.lock);
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        counters.retired[i] += block->counts[i];
+        block->counts[i] = 0;
+    }
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        counters.live = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    block->prev = NULL;
+    block->next = counters.spare;
+    counters.spare = block;
+    pthread_mutex_unlock(&counters.lock);
+}
+
+/**
+ * Create the key which retires each thread's block when it exits
+ */
+static void create_key(void) {
+    pthread_key_create(&counters.key, retire_block);
+}
+
+/**
+ * Give the calling thread a block of counters
+ *
+ * Returns the block
+ *
+ */
+static CounterBlock* claim_block(void) {
+    pthread_once(&counters.once, create_key);
+    pthread_mutex_lock(&counters.lock);
+    CounterBlock* block = counters.spare;
+    if (block != NULL) {
+        counters.spare = block->next;
+    } else {
+        block = calloc(1, sizeof(CounterBlock));
+    }
+    block->prev = NULL;
+    block->next = counters.live;
+    if (counters.live != NULL) {
+        counters.live->prev = block;
+    }
+    counters.live = block;
+    pthread_mutex_unlock(&counters.lock);
+
+    pthread_setspecific(counters.key, block);
+    return block;
+}
+
+void count_event(Counter counter) {
+    CounterBlock* block = threadBlock;
+    if (block == NULL) {
+        block = threadBlock = claim_block();
+    }
+    // we are the only writer, so there is no need for an atomic increment,
+    // only for readers to never see a torn count
+    __atomic_store_n(&block->counts[counter], block->counts[counter] + 1,
+            __ATOMIC_RELAXED);
+}
+
+unsigned long counter_total(Counter counter) {
+    pthread_mutex_lock(&counters.lock);
+    unsigned long total = counters.retired[counter];
+    for (CounterBlock* block = counters.live; block != NULL;
+            block = block->next) {
+        total += __atomic_load_n(&block->counts[counter], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&counters.lock);
+    return total;
+}
+
+/**
+ * Count the threads of this process
+ *
+ * Returns the number of threads, or 0 if it could not be found
+ *
+ */
+static long count_threads(void) {
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status == NULL) {
+        return 0;
+    }
+    char line[256];
+    long threads = 0;
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (sscanf(line, "Threads: %ld", &threads) == 1) {
+            break;
+        }
+    }
+    fclose(status);
+    return threads;
+}
+
+/**
+ * Print a single metric with its help and type lines
+ *
+ * stream (FILE*): where to print it
+ * name (char*): the name of the metric
+ * type (char*): counter or gauge
+ * help (char*): what the metric measures
+ * value (unsigned long): the value of the metric
+ *
+ */
+static void print_metric(FILE* stream, char* name, char* type, char* help,
+        unsigned long value) {
+    fprintf(stream, "# HELP %s %s\n", name, help);
+    fprintf(stream, "# TYPE %s %s\n", name, type);
+    fprintf(stream, "%s %lu\n", name, value);
+}
+
+void print_metrics(ServerInfo* info, FILE* stream) {
+    unsigned long opened = counter_total(COUNTER_CONNECTIONS_OPENED);
+    unsigned long closed = counter_total(COUNTER_CONNECTIONS_CLOSED);
+    unsigned long results = counter_total(COUNTER_RESULTS);
+
+    print_metric(stream, "rps_connections_active", "gauge",
+            "Clients connected now.", opened - closed);
+    print_metric(stream, "rps_connections_total", "counter",
+            "Clients accepted.", opened);
+    print_metric(stream, "rps_threads", "gauge",
+            "Threads in the server process.", count_threads());
+    print_metric(stream, "rps_request_channel_depth", "gauge",
+            "Match requests waiting for the matchmaker.",
+            channel_depth(&info->requests));
+    print_metric(stream, "rps_results_pending", "gauge",
+            "Results tallied but not yet merged into the standings.",
+            pending_results());
+    print_metric(stream, "rps_matches_started_total", "counter",
+            "Matches the matchmaker has started.",
+            counter_total(COUNTER_MATCHES_STARTED));
+    print_metric(stream, "rps_results_total", "counter",
+            "Results recorded, one for each player of a match.", results);
+    print_metric(stream, "rps_matches_completed_total", "counter",
+            "Matches with both results recorded.", results / 2);
+    print_metric(stream, "rps_parse_errors_total", "counter",
+            "Lines and frames that broke the protocol.",
+            counter_total(COUNTER_PARSE_ERRORS));
+    print_metric(stream, "rps_dropped_writes_total", "counter",
+            "Requests the request channel would not take.",
+            counter_total(COUNTER_DROPPED_WRITES));
+}
+
+/**
+ * Answer every scraper that connects with the metrics, one at a time
+ *
+ * infoArg (void*): the ServerInfo, whose metricsFd is listening
+ *
+ * Returns NULL
+ *
+ */
+static void* serve_metrics(void* infoArg) {
+    ServerInfo* info = (ServerInfo*) infoArg;
+    struct timeval timeout = {.tv_sec = METRICS_READ_TIMEOUT};
+    char request[METRICS_REQUEST_SIZE];
+
+    while (1) {
+        int fd = accept(info->metricsFd, NULL, NULL);
+        if (fd == -1) {
+            continue;
+        }
+        // the request itself does not matter, but reading it means closing
+        // the socket will not reset the connection under the response
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (recv(fd, request, sizeof(request), 0) <= 0) {
+            close(fd);
+            continue;
+        }
+
+        FILE* stream = fdopen(fd, "w");
+        fprintf(stream, "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Connection: close\r\n\r\n");
+        print_metrics(info, stream);
+        fclose(stream);
+    }
+    return NULL;
+}
+
+bool start_metrics(ServerInfo* info, int port) {
+    info->metricsFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (info->metricsFd == -1) {
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(info->metricsFd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+            sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(struct sockaddr_in));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(info->metricsFd, (struct sockaddr*) &address, sizeof(address))
+            || listen(info->metricsFd, METRICS_BACKLOG)) {
+        close(info->metricsFd);
+        return false;
+    }
+
+    pthread_t id;
+    if (pthread_create(&id, NULL, serve_metrics, (void*) info)) {
+        close(info->metricsFd);
+        return false;
+    }
+    pthread_detach(id);
+    return true;
+}
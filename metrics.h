@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "server.h"
+
+#ifndef METRICS_H
+#define METRICS_H
+
+/** The events the server counts */
+typedef enum Counter {
+    COUNTER_CONNECTIONS_OPENED,
+    COUNTER_CONNECTIONS_CLOSED,
+    COUNTER_MATCHES_STARTED,
+    // each player's result of a match, so two to a match
+    COUNTER_RESULTS,
+    // lines and frames that were not what the protocol expected
+    COUNTER_PARSE_ERRORS,
+    // requests a full channel would not take
+    COUNTER_DROPPED_WRITES,
+    NUM_COUNTERS
+} Counter;
+
+// Adds one to a counter. Every thread counts into its own copy of the
+// counters, so this never waits on another thread.
+void count_event(Counter counter);
+
+// Returns a counter summed over every thread, including those that have
+// exited.
+unsigned long counter_total(Counter counter);
+
+// Prints the counters and gauges of the server in the Prometheus text format.
+// Never takes the results lock.
+void print_metrics(ServerInfo* info, FILE* stream);
+
+// Starts a thread serving print_metrics over HTTP to anything that connects
+// to port. Returns false if the port could not be listened on.
+bool start_metrics(ServerInfo* info, int port);
+
+#endif
@@ -0,0 +1,176 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Get the time elapsed since an earlier point on the monotonic clock
+ *
+ * since (struct timespec*): the earlier point
+ *
+ * Returns the elapsed time in nanoseconds
+ *
+ */
+static unsigned long nanos_since(struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000000UL
+            + now.tv_nsec - since->tv_nsec;
+}
+
+/**
+ * Raise a shared maximum to a new value if it is larger
+ *
+ * largest (unsigned long*): the maximum
+ * value (unsigned long): the new value
+ *
+ */
+static void store_largest(unsigned long* largest, unsigned long value) {
+    unsigned long current = __atomic_load_n(largest, __ATOMIC_RELAXED);
+    while (value > current) {
+        if (__atomic_compare_exchange_n(largest, &current, value, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+/**
+ * Run queued tasks until told to exit
+ *
+ * poolArg (void*): the WorkerPool this worker belongs to
+ *
+ * Returns NULL
+ *
+ */
+static void* run_worker(void* poolArg) {
+    WorkerPool* pool = (WorkerPool*) poolArg;
+    Task task;
+
+    while (1) {
+        if (!read_channel(&pool->tasks, (void**) &task)) {
+            continue;
+        }
+        if (task.run == NULL) {
+            break;
+        }
+
+        unsigned long wait = nanos_since(&task.queued);
+        __atomic_add_fetch(&pool->tasksRun, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pool->totalWaitNanos, wait, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pool->windowTasks, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pool->windowWaitNanos, wait, __ATOMIC_RELAXED);
+        store_largest(&pool->largestWaitNanos, wait);
+
+        __atomic_add_fetch(&pool->active, 1, __ATOMIC_RELAXED);
+        task.run(task.arg);
+        __atomic_sub_fetch(&pool->active, 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_sub_fetch(&pool->workers, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * Start more workers
+ *
+ * pool (WorkerPool*): the pool
+ * count (int): the number of workers to start
+ *
+ * Returns the number of workers started
+ *
+ */
+static int add_workers(WorkerPool* pool, int count) {
+    int started = 0;
+    for (; started < count; started++) {
+        pthread_t id;
+        if (pthread_create(&id, NULL, run_worker, (void*) pool)) {
+            break;
+        }
+        pthread_detach(id);
+        __atomic_add_fetch(&pool->workers, 1, __ATOMIC_RELAXED);
+    }
+    return started;
+}
+
+/**
+ * Periodically resize an adaptive pool. The pool grows by a quarter (at
+ * least one worker) whenever tasks have been waiting too long, and shrinks by
+ * one worker when tasks are started straight away and most workers are idle.
+ *
+ * poolArg (void*): the WorkerPool to resize
+ *
+ * Returns NULL
+ *
+ */
+static void* resize_pool(void* poolArg) {
+    WorkerPool* pool = (WorkerPool*) poolArg;
+
+    while (1) {
+        usleep(POOL_ADJUST_INTERVAL * 1000);
+
+        unsigned long tasks = __atomic_exchange_n(&pool->windowTasks, 0,
+                __ATOMIC_RELAXED);
+        unsigned long wait = __atomic_exchange_n(&pool->windowWaitNanos, 0,
+                __ATOMIC_RELAXED);
+        int workers = __atomic_load_n(&pool->workers, __ATOMIC_RELAXED);
+        int active = __atomic_load_n(&pool->active, __ATOMIC_RELAXED);
+        unsigned long meanWait = tasks == 0 ? 0 : wait / tasks;
+
+        // tasks still queued have been waiting at least one interval
+        if (channel_depth(&pool->tasks) > 0 && active == workers) {
+            meanWait = POOL_GROW_WAIT;
+        }
+
+        if (meanWait >= POOL_GROW_WAIT && workers < pool->maxWorkers) {
+            int extra = workers / 4 > 1 ? workers / 4 : 1;
+            if (workers + extra > pool->maxWorkers) {
+                extra = pool->maxWorkers - workers;
+            }
+            add_workers(pool, extra);
+        } else if (meanWait < POOL_SHRINK_WAIT && workers > pool->minWorkers
+                && active * 2 <= workers) {
+            submit_task(pool, NULL, NULL);
+        }
+    }
+    return NULL;
+}
+
+bool start_pool(WorkerPool* pool, int minWorkers, int maxWorkers) {
+    memset(pool, 0, sizeof(WorkerPool));
+    pool->tasks = new_channel(sizeof(Task));
+    pool->minWorkers = minWorkers;
+    pool->maxWorkers = maxWorkers;
+
+    if (add_workers(pool, minWorkers) != minWorkers) {
+        return false;
+    }
+    if (maxWorkers > minWorkers) {
+        return pthread_create(&pool->monitor, NULL, resize_pool,
+                (void*) pool) == 0;
+    }
+    return true;
+}
+
+bool submit_task(WorkerPool* pool, void (*run)(void*), void* arg) {
+    Task task = {.run = run, .arg = arg};
+    clock_gettime(CLOCK_MONOTONIC, &task.queued);
+    return write_channel(&pool->tasks, (void*) &task);
+}
+
+void print_pool_stats(WorkerPool* pool, FILE* stream) {
+    unsigned long tasks = __atomic_load_n(&pool->tasksRun, __ATOMIC_RELAXED);
+    unsigned long wait = __atomic_load_n(&pool->totalWaitNanos,
+            __ATOMIC_RELAXED);
+
+    fprintf(stream, "pool workers %d\n",
+            __atomic_load_n(&pool->workers, __ATOMIC_RELAXED));
+    fprintf(stream, "pool active %d\n",
+            __atomic_load_n(&pool->active, __ATOMIC_RELAXED));
+    fprintf(stream, "pool queued %zu\n", channel_depth(&pool->tasks));
+    fprintf(stream, "pool tasks %lu\n", tasks);
+    fprintf(stream, "pool mean_wait_ns %lu\n", tasks == 0 ? 0 : wait / tasks);
+    fprintf(stream, "pool largest_wait_ns %lu\n",
+            __atomic_load_n(&pool->largestWaitNanos, __ATOMIC_RELAXED));
+}
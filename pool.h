@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "shared.h"
+
+#ifndef POOL_H
+#define POOL_H
+
+// How often (ms) an adaptive pool decides whether to resize
+#define POOL_ADJUST_INTERVAL 100
+// An adaptive pool grows when tasks wait longer than this (ns) on average
+#define POOL_GROW_WAIT 1000000
+// An adaptive pool shrinks when tasks wait less than this (ns) on average and
+// at least half of its workers are idle
+#define POOL_SHRINK_WAIT 100000
+
+/**
+ * A unit of work queued on a worker pool
+ *
+ * run (void (*)(void*)): the function to run, NULL tells a worker to exit
+ * arg (void*): the argument to run
+ * queued (struct timespec): when the task was queued
+ *
+ */
+typedef struct Task {
+    void (*run)(void*);
+    void* arg;
+    struct timespec queued;
+} Task;
+
+/**
+ * A set of persistent worker threads which run queued tasks. An adaptive
+ * pool (maxWorkers > minWorkers) grows and shrinks between its bounds based
+ * on how long tasks wait to be run.
+ *
+ * tasks (struct Channel): the queued tasks
+ * minWorkers (int): the fewest workers the pool will run
+ * maxWorkers (int): the most workers the pool will run
+ * workers (int): the number of workers running
+ * active (int): the number of workers running a task
+ * tasksRun (unsigned long): the number of tasks started
+ * totalWaitNanos (unsigned long): the total time tasks spent queued
+ * largestWaitNanos (unsigned long): the longest time a task spent queued
+ * windowTasks (unsigned long): tasks started since the last resize check
+ * windowWaitNanos (unsigned long): time queued since the last resize check
+ * monitor (pthread_t): the thread resizing an adaptive pool
+ *
+ */
+typedef struct WorkerPool {
+    struct Channel tasks;
+    int minWorkers;
+    int maxWorkers;
+    int workers;
+    int active;
+    unsigned long tasksRun;
+    unsigned long totalWaitNanos;
+    unsigned long largestWaitNanos;
+    unsigned long windowTasks;
+    unsigned long windowWaitNanos;
+    pthread_t monitor;
+} WorkerPool;
+
+// Starts a pool of minWorkers workers, which may grow to maxWorkers. Returns
+// true on success.
+bool start_pool(WorkerPool* pool, int minWorkers, int maxWorkers);
+
+// Queues run(arg) to be run by the next free worker. Returns true if the task
+// was queued.
+bool submit_task(WorkerPool* pool, void (*run)(void*), void* arg);
+
+// Prints the pool's counters, one per line.
+void print_pool_stats(WorkerPool* pool, FILE* stream);
+
+#endif
@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+
+#include "server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Work out the features to agree to with a client
+ *
+ * offered (int): the Features the server will agree to
+ * asked (int): the Features the client asked for
+ *
+ * Returns the Features agreed
+ *
+ */
+int negotiate_features(int offered, int asked) {
+    int agreed = offered & asked;
+    if (!(agreed & FEATURE_SESSION)) {
+        // a refereed match ends with our RESULT rather than the client's,
+        // so the client has to stay connected for its next MR
+        agreed &= ~FEATURE_REFEREE;
+    }
+    return agreed;
+}
+
+/**
+ * Parse a MR line into the player name and port
+ *
+ * line (Fields*): the line to parse, split at its colons
+ * name (Slice*): set to the player name, within the line
+ * port (Slice*): set to the port, within the line, which is shorter than
+ * MAX_PORT_LENGTH
+ *
+ * Returns true if the message was valid
+ *
+ */
+bool parse_match_request(Fields* line, Slice* name, Slice* port) {
+    if (line->tag != TAG_MR || line->count != 2
+            || line->field[1].length >= MAX_PORT_LENGTH) {
+        return false;
+    }
+    *name = line->field[0];
+    *port = line->field[1];
+    return true;
+}
+
+/**
+ * Turn a MR frame into the player and port
+ *
+ * message (Message*): the MR frame
+ * names (NameTable*): the names the client has sent
+ * player (PlayerId*): set to the id of the player
+ * port (char*): set to the port, which holds MAX_PORT_LENGTH bytes
+ *
+ * Returns true if the frame named a known player
+ *
+ */
+bool parse_match_frame(Message* message, NameTable* names, PlayerId* player,
+        char* port) {
+    char* known = lookup_name(names, message->id);
+    if (known == NULL || (*player = intern_player(known)) == NO_PLAYER) {
+        return false;
+    }
+    snprintf(port, MAX_PORT_LENGTH, "%u", message->port);
+    return true;
+}
+
+/**
+ * Parse a RESULT line from the perspective of a player
+ *
+ * line (Fields*): the line to parse, of the form RESULT:id:winner
+ * player (char*): the player who sent the line
+ *
+ * Returns the result for the player
+ *
+ */
+GameResult parse_result_message(Fields* line, char* player) {
+    if (line->tag != TAG_RESULT || line->count == 0) {
+        return LOSE;
+    }
+    char* winner = line->field[line->count - 1].start;
+
+    if (!strcmp("TIE", winner)) {
+        return TIE;
+    } else if (!strcmp(player, winner)) {
+        return WIN;
+    }
+    return LOSE;
+}
+
+/**
+ * Get the result of a RESULT frame for the player who sent it
+ *
+ * message (Message*): the RESULT frame
+ *
+ * Returns the result for the player
+ *
+ */
+GameResult parse_result_frame(Message* message) {
+    if (message->type != MESSAGE_RESULT || message->value > TIE) {
+        return LOSE;
+    }
+    return (GameResult) message->value;
+}
+
+/**
+ * Format the MATCH line telling a player about their match. The line ends in
+ * :READY and :PIPELINE when both players agreed to those features, or in
+ * :REFEREE alone for a refereed match.
+ *
+ * message (char**): set to the allocated line, including its newline
+ * match (Match*): the match from the perspective of the player
+ *
+ * Returns the length of the line, or -1 if it could not be allocated
+ *
+ */
+int format_match(char** message, Match* match) {
+    char* opponent = player_name(match->opponent);
+    int agreed = match->features & match->opponentFeatures;
+    if (agreed & FEATURE_REFEREE) {
+        // the players never connect to each other, so nothing else applies
+        return asprintf(message, "MATCH:%d:%s:%s:REFEREE\n", match->id,
+                opponent, match->opponentPort);
+    }
+    return asprintf(message, "MATCH:%d:%s:%s%s%s\n", match->id,
+            opponent, match->opponentPort,
+            agreed & FEATURE_READY ? ":READY" : "",
+            agreed & FEATURE_PIPELINE ? ":PIPELINE" : "");
+}
+
+/**
+ * Encode the MATCH frame telling a player about their match, preceded by a
+ * NAME frame if the player has not been told the opponent's name before
+ *
+ * buffer (unsigned char*): where to encode the frames, which should hold
+ * 2 * MAX_FRAME_LENGTH bytes
+ * match (Match*): the match from the perspective of the player
+ * sentNames (NameTable*): the names already sent to the player
+ *
+ * Returns the length of the frames
+ *
+ */
+int encode_match(unsigned char* buffer, Match* match, NameTable* sentNames) {
+    int length = 0;
+    Message message = {.type = MESSAGE_MATCH, .id = match->id,
+            .port = atoi(match->opponentPort)};
+
+    message.nameId = find_player_name(sentNames, match->opponent);
+    if (message.nameId == 0) {
+        Message name = {.type = MESSAGE_NAME,
+                .id = add_player_name(sentNames, match->opponent)};
+        strncpy(name.name, player_name(match->opponent), MAX_FRAME_NAME);
+        length += encode_message(&name, buffer);
+        message.nameId = name.id;
+    }
+
+    if (match->features & match->opponentFeatures & FEATURE_REFEREE) {
+        message.value = MATCH_FLAG_REFEREE;
+        return length + encode_message(&message, buffer + length);
+    }
+    if (match->features & match->opponentFeatures & FEATURE_READY) {
+        message.value |= MATCH_FLAG_READY;
+    }
+    if (match->features & match->opponentFeatures & FEATURE_PIPELINE) {
+        message.value |= MATCH_FLAG_PIPELINE;
+    }
+    if (match->opponentFeatures & FEATURE_BINARY) {
+        message.value |= MATCH_FLAG_BINARY;
+    }
+    return length + encode_message(&message, buffer + length);
+}
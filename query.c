@@ -0,0 +1,502 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shared.h"
+#include "export.h"
+
+// The number of periods winrate splits the results into without -b
+#define DEFAULT_BUCKETS 10
+// The most threads a scan is split between
+#define MAX_THREADS 256
+
+/** Exit codes */
+typedef enum QueryError {
+    QUERY_USAGE = 1,
+    QUERY_BAD_FILE = 2,
+    QUERY_NO_PLAYER = 3
+} QueryError;
+
+/** The questions rpsquery can answer */
+typedef enum QueryKind {
+    // wins, losses and ties of every player
+    QUERY_STANDINGS,
+    // wins, losses and ties of one player against each opponent
+    QUERY_VERSUS,
+    // wins, losses and ties of one player in each period of the results
+    QUERY_WINRATE
+} QueryKind;
+
+/**
+ * A results export file, mapped into memory
+ *
+ * header (ExportHeader*): the header at the start of the file
+ * size (size_t): the size of the file
+ * players (uint32_t*): the player column
+ * opponents (uint32_t*): the opponent column
+ * matches (uint32_t*): the match column
+ * outcomes (uint8_t*): the outcome column
+ * nameIndex (uint64_t*): where each name starts in nameData
+ * nameData (char*): the names
+ *
+ */
+typedef struct Export {
+    ExportHeader* header;
+    size_t size;
+    uint32_t* players;
+    uint32_t* opponents;
+    uint32_t* matches;
+    uint8_t* outcomes;
+    uint64_t* nameIndex;
+    char* nameData;
+} Export;
+
+/**
+ * A query over an export
+ *
+ * kind (QueryKind): the question asked
+ * path (char*): the export file
+ * player (char*): the player asked about, for QUERY_VERSUS and QUERY_WINRATE
+ * playerId (uint32_t): the id of player
+ * numThreads (int): the number of threads the scan is split between
+ * numBuckets (int): the number of periods for QUERY_WINRATE
+ * export (Export): the mapped export
+ * numTallies (size_t): the number of tallies each scan keeps, one for each
+ * player or period
+ *
+ */
+typedef struct Query {
+    QueryKind kind;
+    char* path;
+    char* player;
+    uint32_t playerId;
+    int numThreads;
+    int numBuckets;
+    Export export;
+    size_t numTallies;
+} Query;
+
+/**
+ * One thread's share of a scan, a contiguous range of rows
+ *
+ * query (Query*): the query being answered
+ * from (size_t): the first row of the range
+ * to (size_t): one past the last row of the range
+ * tallies (uint64_t(*)[3]): the wins, losses and ties seen for each player
+ * or period, indexed by GameResult
+ * id (pthread_t): the thread scanning the range
+ *
+ */
+typedef struct Scan {
+    Query* query;
+    size_t from;
+    size_t to;
+    uint64_t (*tallies)[3];
+    pthread_t id;
+} Scan;
+
+/**
+ * Check that a section of an export file lies inside it
+ *
+ * export (Export*): the export
+ * offset (uint64_t): where the section starts
+ * length (uint64_t): the length of the section
+ *
+ * Returns true if the section is inside the file
+ *
+ */
+static bool in_file(Export* export, uint64_t offset, uint64_t length) {
+    return offset <= export->size && length <= export->size - offset;
+}
+
+/**
+ * Check that every name of an export starts inside its name data, and that
+ * the name data ends in a NUL, so no name runs past the end of the file
+ *
+ * export (Export*): the export, with its name sections set
+ *
+ * Returns true if every name can be read
+ *
+ */
+static bool names_in_file(Export* export) {
+    ExportHeader* header = export->header;
+    uint64_t length = export->size - header->nameDataOffset;
+    if (header->numNames > 0
+            && (length == 0 || export->nameData[length - 1] != '\0')) {
+        return false;
+    }
+    for (uint64_t i = 0; i < header->numNames; i++) {
+        if (export->nameIndex[i] >= length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Map an export file into memory and check its header and names
+ *
+ * export (Export*): set to the mapped export
+ * path (char*): the export file
+ *
+ * Returns false if the file could not be mapped or is not an export
+ *
+ */
+static bool map_export(Export* export, char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info)) {
+        return false;
+    }
+    export->size = info.st_size;
+    if (export->size < sizeof(ExportHeader)) {
+        close(fd);
+        return false;
+    }
+    char* base = mmap(NULL, export->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    // every scan reads its columns front to back
+    madvise(base, export->size, MADV_SEQUENTIAL);
+
+    ExportHeader* header = (ExportHeader*) base;
+    export->header = header;
+    uint64_t rows = header->numRows;
+    if (memcmp(header->magic, EXPORT_MAGIC, sizeof(header->magic))
+            || header->size != export->size
+            || rows > export->size || header->numNames > export->size
+            || !in_file(export, header->playerOffset, rows * 4)
+            || !in_file(export, header->opponentOffset, rows * 4)
+            || !in_file(export, header->matchOffset, rows * 4)
+            || !in_file(export, header->outcomeOffset, rows)
+            || !in_file(export, header->nameIndexOffset,
+            header->numNames * 8)
+            || !in_file(export, header->nameDataOffset, 0)) {
+        munmap(base, export->size);
+        return false;
+    }
+    export->players = (uint32_t*) (base + header->playerOffset);
+    export->opponents = (uint32_t*) (base + header->opponentOffset);
+    export->matches = (uint32_t*) (base + header->matchOffset);
+    export->outcomes = (uint8_t*) (base + header->outcomeOffset);
+    export->nameIndex = (uint64_t*) (base + header->nameIndexOffset);
+    export->nameData = base + header->nameDataOffset;
+    if (!names_in_file(export)) {
+        munmap(base, export->size);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Look up the name of a player in an export
+ *
+ * export (Export*): the export
+ * id (uint32_t): the id of the player
+ *
+ * Returns the name
+ *
+ */
+static char* export_name(Export* export, uint32_t id) {
+    return export->nameData + export->nameIndex[id];
+}
+
+/**
+ * Count the wins, losses and ties in a range of rows, into a tally for each
+ * player, opponent or period depending on the query
+ *
+ * scanArg (void*): the Scan
+ *
+ * Returns NULL
+ *
+ */
+static void* scan_rows(void* scanArg) {
+    Scan* scan = (Scan*) scanArg;
+    Query* query = scan->query;
+    Export* export = &query->export;
+    uint32_t* players = export->players;
+    uint8_t* outcomes = export->outcomes;
+    uint32_t target = query->playerId;
+    size_t numTallies = query->numTallies;
+
+    // a loop for each kind so the innermost loop never branches on it
+    switch (query->kind) {
+        case QUERY_STANDINGS:
+            for (size_t row = scan->from; row < scan->to; row++) {
+                if (players[row] < numTallies) {
+                    scan->tallies[players[row]][outcomes[row] % 3]++;
+                }
+            }
+            break;
+        case QUERY_VERSUS:
+            for (size_t row = scan->from; row < scan->to; row++) {
+                uint32_t opponent = export->opponents[row];
+                if (players[row] == target && opponent < numTallies) {
+                    scan->tallies[opponent][outcomes[row] % 3]++;
+                }
+            }
+            break;
+        case QUERY_WINRATE:
+            for (size_t row = scan->from; row < scan->to; row++) {
+                if (players[row] == target) {
+                    size_t bucket = row * numTallies
+                            / export->header->numRows;
+                    scan->tallies[bucket][outcomes[row] % 3]++;
+                }
+            }
+            break;
+    }
+    return NULL;
+}
+
+/**
+ * Scan every row of the export, split between the query's threads, and sum
+ * their tallies
+ *
+ * query (Query*): the query
+ *
+ * Returns the tallies, indexed by player or period then GameResult, which
+ * must be freed
+ *
+ */
+static uint64_t (*run_scan(Query* query))[3] {
+    size_t numRows = query->export.header->numRows;
+    int numThreads = query->numThreads;
+    Scan* scans = calloc(numThreads, sizeof(Scan));
+    for (int i = 0; i < numThreads; i++) {
+        scans[i].query = query;
+        scans[i].from = numRows * i / numThreads;
+        scans[i].to = numRows * (i + 1) / numThreads;
+        scans[i].tallies = calloc(query->numTallies + 1, sizeof(uint64_t[3]));
+        if (pthread_create(&scans[i].id, NULL, scan_rows, &scans[i])) {
+            // scan it on this thread instead
+            scan_rows(&scans[i]);
+            scans[i].id = pthread_self();
+        }
+    }
+
+    uint64_t (*totals)[3] = scans[0].tallies;
+    for (int i = 0; i < numThreads; i++) {
+        if (!pthread_equal(scans[i].id, pthread_self())) {
+            pthread_join(scans[i].id, NULL);
+        }
+        if (i == 0) {
+            continue;
+        }
+        for (size_t j = 0; j < query->numTallies; j++) {
+            for (int k = 0; k < 3; k++) {
+                totals[j][k] += scans[i].tallies[j][k];
+            }
+        }
+        free(scans[i].tallies);
+    }
+    free(scans);
+    return totals;
+}
+
+/**
+ * Compare two player ids by name, for qsort_r
+ *
+ * a (const void*): the first id
+ * b (const void*): the second id
+ * exportArg (void*): the Export the ids are from
+ *
+ * Returns the comparison of the names
+ *
+ */
+static int compare_names(const void* a, const void* b, void* exportArg) {
+    Export* export = (Export*) exportArg;
+    return strcmp(export_name(export, *(const uint32_t*) a),
+            export_name(export, *(const uint32_t*) b));
+}
+
+/**
+ * Print a tally for each player with any results, ordered by name, in the
+ * format "name wins losses ties" followed by a "---" line
+ *
+ * export (Export*): the export the players are from
+ * tallies (uint64_t(*)[3]): the tallies, indexed by player id
+ * stream (FILE*): where to print them
+ *
+ */
+static void print_tallies(Export* export, uint64_t (*tallies)[3],
+        FILE* stream) {
+    size_t numNames = export->header->numNames;
+    uint32_t* ids = malloc(sizeof(uint32_t) * (numNames + 1));
+    size_t count = 0;
+    for (uint32_t id = 0; id < numNames; id++) {
+        if (tallies[id][WIN] + tallies[id][LOSE] + tallies[id][TIE] > 0) {
+            ids[count++] = id;
+        }
+    }
+    qsort_r(ids, count, sizeof(uint32_t), compare_names, export);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t* tally = tallies[ids[i]];
+        fprintf(stream, "%s %lu %lu %lu\n", export_name(export, ids[i]),
+                tally[WIN], tally[LOSE], tally[TIE]);
+    }
+    fprintf(stream, "---\n");
+    free(ids);
+}
+
+/**
+ * Print the tally of each period, in the format
+ * "firstmatch lastmatch wins losses ties winrate" followed by a "---" line.
+ * A period's matches are those of its first and last row, whoever played them.
+ *
+ * query (Query*): the query
+ * tallies (uint64_t(*)[3]): the tallies, indexed by period
+ * stream (FILE*): where to print them
+ *
+ */
+static void print_periods(Query* query, uint64_t (*tallies)[3],
+        FILE* stream) {
+    Export* export = &query->export;
+    size_t numRows = export->header->numRows;
+    for (size_t bucket = 0; bucket < query->numTallies; bucket++) {
+        // the first row of each bucket, as scan_rows assigns them
+        size_t from = (bucket * numRows + query->numTallies - 1)
+                / query->numTallies;
+        size_t to = ((bucket + 1) * numRows + query->numTallies - 1)
+                / query->numTallies;
+        if (from >= to) {
+            continue;
+        }
+        uint64_t* tally = tallies[bucket];
+        uint64_t games = tally[WIN] + tally[LOSE] + tally[TIE];
+        fprintf(stream, "%u %u %lu %lu %lu %.3f\n", export->matches[from],
+                export->matches[to - 1], tally[WIN], tally[LOSE], tally[TIE],
+                games == 0 ? 0.0 : (double) tally[WIN] / games);
+    }
+    fprintf(stream, "---\n");
+}
+
+/**
+ * Find the id of a player in an export
+ *
+ * export (Export*): the export
+ * name (char*): the player
+ * id (uint32_t*): set to the id of the player
+ *
+ * Returns false if the player is not in the export
+ *
+ */
+static bool find_player_id(Export* export, char* name, uint32_t* id) {
+    for (uint32_t i = 0; i < export->header->numNames; i++) {
+        if (!strcmp(export_name(export, i), name)) {
+            *id = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Parse a strictly positive integer argument
+ *
+ * arg (char*): the argument
+ * value (int*): set to the value of the argument
+ *
+ * Returns true if the argument was a positive integer
+ *
+ */
+static bool parse_positive(char* arg, int* value) {
+    char* end;
+    long parsed = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || parsed <= 0 || (int) parsed != parsed) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+/**
+ * Parse the command line arguments of a query
+ *
+ * argc (int): the number of arguments
+ * argv (char**): the arguments
+ * query (Query*): the query to configure
+ *
+ * Returns true if the arguments were valid
+ *
+ */
+static bool parse_args(int argc, char** argv, Query* query) {
+    memset(query, 0, sizeof(Query));
+    query->numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    query->numBuckets = DEFAULT_BUCKETS;
+
+    int opt;
+    bool valid = true;
+    while (valid && (opt = getopt(argc, argv, "t:b:")) != -1) {
+        switch (opt) {
+            case 't':
+                valid = parse_positive(optarg, &query->numThreads);
+                break;
+            case 'b':
+                valid = parse_positive(optarg, &query->numBuckets);
+                break;
+            default:
+                return false;
+        }
+    }
+    if (query->numThreads < 1) {
+        query->numThreads = 1;
+    } else if (query->numThreads > MAX_THREADS) {
+        query->numThreads = MAX_THREADS;
+    }
+    if (!valid || argc - optind < 2) {
+        return false;
+    }
+    query->path = argv[optind];
+    char* command = argv[optind + 1];
+    int numArgs = argc - optind - 2;
+    if (!strcmp(command, "standings") && numArgs == 0) {
+        query->kind = QUERY_STANDINGS;
+    } else if (!strcmp(command, "versus") && numArgs == 1) {
+        query->kind = QUERY_VERSUS;
+    } else if (!strcmp(command, "winrate") && numArgs == 1) {
+        query->kind = QUERY_WINRATE;
+    } else {
+        return false;
+    }
+    query->player = numArgs == 1 ? argv[optind + 2] : NULL;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Query query;
+    if (!parse_args(argc, argv, &query)) {
+        fprintf(stderr, "Usage: rpsquery [-t threads] [-b periods] "
+                "exportfile standings|versus player|winrate player\n");
+        return QUERY_USAGE;
+    }
+    if (!map_export(&query.export, query.path)) {
+        fprintf(stderr, "Not a results export: %s\n", query.path);
+        return QUERY_BAD_FILE;
+    }
+    if (query.player != NULL && !find_player_id(&query.export, query.player,
+            &query.playerId)) {
+        fprintf(stderr, "No results for %s\n", query.player);
+        return QUERY_NO_PLAYER;
+    }
+
+    query.numTallies = query.kind == QUERY_WINRATE ? query.numBuckets
+            : query.export.header->numNames;
+    uint64_t (*tallies)[3] = run_scan(&query);
+    if (query.kind == QUERY_WINRATE) {
+        print_periods(&query, tallies, stdout);
+    } else {
+        print_tallies(&query.export, tallies, stdout);
+    }
+    free(tallies);
+    return 0;
+}
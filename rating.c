@@ -0,0 +1,293 @@
+#include "rating.h"
+#include "federation.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ * Get the number of milliseconds between two points on the monotonic clock
+ *
+ * from (struct timespec*): the earlier point
+ * to (struct timespec*): the later point
+ *
+ * Returns the milliseconds elapsed
+ *
+ */
+static long millis_between(struct timespec* from, struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) * 1000
+            + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+/**
+ * Work out the largest rating gap a waiting player will currently accept
+ *
+ * player (WaitingPlayer*): the waiting player
+ * now (struct timespec*): the current time
+ *
+ * Returns the accepted gap, which is infinite once they have waited long
+ * enough
+ *
+ */
+static double accepted_gap(WaitingPlayer* player, struct timespec* now) {
+    long waited = millis_between(&player->arrived, now);
+    if (waited >= RATING_MAX_WAIT) {
+        return INFINITY;
+    }
+    return RATING_INITIAL_GAP + RATING_GAP_PER_SECOND * waited / 1000.0;
+}
+
+/**
+ * Does a waiting player come before a position in the rating order
+ *
+ * player (WaitingPlayer*): the waiting player
+ * rating (double): the rating of the position
+ * order (unsigned long): the order of the position
+ *
+ * Returns true if the player is ordered before the position
+ *
+ */
+static bool comes_before(WaitingPlayer* player, double rating,
+        unsigned long order) {
+    return player->rating < rating
+            || (player->rating == rating && player->order < order);
+}
+
+/**
+ * Find the last player before a position on every level of the skip list
+ *
+ * index (RatingIndex*): the index
+ * rating (double): the rating of the position
+ * order (unsigned long): the order of the position
+ * previous (WaitingPlayer**): set to the last player before the position on
+ * each level, or the head
+ *
+ */
+static void find_previous(RatingIndex* index, double rating,
+        unsigned long order, WaitingPlayer** previous) {
+    WaitingPlayer* current = index->head;
+    for (int level = RATING_MAX_LEVEL - 1; level >= 0; level--) {
+        while (current->next[level] != NULL
+                && comes_before(current->next[level], rating, order)) {
+            current = current->next[level];
+        }
+        previous[level] = current;
+    }
+}
+
+void init_rating_index(RatingIndex* index) {
+    index->head = calloc(1, sizeof(WaitingPlayer)
+            + sizeof(WaitingPlayer*) * RATING_MAX_LEVEL);
+    index->head->level = RATING_MAX_LEVEL;
+    index->oldest = index->newest = NULL;
+    index->numWaiting = 0;
+    index->nextOrder = 0;
+    index->seed = 1;
+}
+
+/**
+ * Add a request to the index
+ *
+ * index (RatingIndex*): the index
+ * request (Request*): the request, which is copied
+ * rating (double): the rating of the player
+ * now (struct timespec*): the current time
+ *
+ */
+static void add_waiting(RatingIndex* index, Request* request, double rating,
+        struct timespec* now) {
+    int level = 1;
+    while (level < RATING_MAX_LEVEL && rand_r(&index->seed) % 4 == 0) {
+        level++;
+    }
+
+    WaitingPlayer* player = calloc(1, sizeof(WaitingPlayer)
+            + sizeof(WaitingPlayer*) * level);
+    player->request = *request;
+    player->rating = rating;
+    player->order = index->nextOrder++;
+    player->arrived = *now;
+    player->level = level;
+
+    WaitingPlayer* previous[RATING_MAX_LEVEL];
+    find_previous(index, rating, player->order, previous);
+    for (int i = 0; i < level; i++) {
+        player->next[i] = previous[i]->next[i];
+        previous[i]->next[i] = player;
+    }
+
+    player->older = index->newest;
+    if (index->newest != NULL) {
+        index->newest->newer = player;
+    } else {
+        index->oldest = player;
+    }
+    index->newest = player;
+    index->numWaiting++;
+}
+
+/**
+ * Remove a player from the index and free them
+ *
+ * index (RatingIndex*): the index
+ * player (WaitingPlayer*): the player to remove
+ *
+ */
+static void remove_waiting(RatingIndex* index, WaitingPlayer* player) {
+    WaitingPlayer* previous[RATING_MAX_LEVEL];
+    find_previous(index, player->rating, player->order, previous);
+    for (int i = 0; i < player->level; i++) {
+        previous[i]->next[i] = player->next[i];
+    }
+
+    if (player->older != NULL) {
+        player->older->newer = player->newer;
+    } else {
+        index->oldest = player->newer;
+    }
+    if (player->newer != NULL) {
+        player->newer->older = player->older;
+    } else {
+        index->newest = player->older;
+    }
+    index->numWaiting--;
+    free(player);
+}
+
+/**
+ * Find the waiting players rated either side of a position
+ *
+ * index (RatingIndex*): the index
+ * rating (double): the rating of the position
+ * order (unsigned long): the order of the position
+ * exclude (WaitingPlayer*): a player to skip (the one at the position)
+ * below (WaitingPlayer**): set to the nearest player rated below, or NULL
+ * above (WaitingPlayer**): set to the nearest player rated above, or NULL
+ *
+ */
+static void find_neighbours(RatingIndex* index, double rating,
+        unsigned long order, WaitingPlayer* exclude, WaitingPlayer** below,
+        WaitingPlayer** above) {
+    WaitingPlayer* previous[RATING_MAX_LEVEL];
+    find_previous(index, rating, order, previous);
+
+    *below = previous[0] == index->head ? NULL : previous[0];
+    *above = previous[0]->next[0];
+    if (exclude != NULL && *above == exclude) {
+        *above = exclude->next[0];
+    }
+}
+
+/**
+ * Pick the nearer of two candidate opponents that will accept a rating
+ *
+ * rating (double): the rating of the player looking for an opponent
+ * gap (double): the gap the player accepts
+ * below (WaitingPlayer*): the nearest candidate rated below, or NULL
+ * above (WaitingPlayer*): the nearest candidate rated above, or NULL
+ * now (struct timespec*): the current time
+ *
+ * Returns the chosen opponent, or NULL if neither is close enough
+ *
+ */
+static WaitingPlayer* pick_opponent(double rating, double gap,
+        WaitingPlayer* below, WaitingPlayer* above, struct timespec* now) {
+    WaitingPlayer* best = NULL;
+    double bestDistance = INFINITY;
+    WaitingPlayer* candidates[2] = {below, above};
+
+    for (int i = 0; i < 2; i++) {
+        if (candidates[i] == NULL) {
+            continue;
+        }
+        double distance = fabs(candidates[i]->rating - rating);
+        double allowed = fmax(gap, accepted_gap(candidates[i], now));
+        if (distance <= allowed && distance < bestDistance) {
+            best = candidates[i];
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+/**
+ * Check every waiting player, longest waiting first, against their nearest
+ * rated neighbours now that their accepted gaps have widened
+ *
+ * info (ServerInfo*): the server
+ * index (RatingIndex*): the index
+ * match (int*): the id of the next match, incremented for each match
+ * now (struct timespec*): the current time
+ *
+ */
+static void sweep_waiting(ServerInfo* info, RatingIndex* index, int* match,
+        struct timespec* now) {
+    WaitingPlayer* player = index->oldest;
+    while (player != NULL) {
+        WaitingPlayer* below;
+        WaitingPlayer* above;
+        find_neighbours(index, player->rating, player->order, player, &below,
+                &above);
+        WaitingPlayer* opponent = pick_opponent(player->rating,
+                accepted_gap(player, now), below, above, now);
+
+        WaitingPlayer* next = player->newer;
+        if (opponent != NULL) {
+            if (next == opponent) {
+                next = opponent->newer;
+            }
+            start_match(info, &player->request, &opponent->request,
+                    (*match)++);
+            remove_waiting(index, opponent);
+            remove_waiting(index, player);
+        }
+        player = next;
+    }
+}
+
+void match_by_rating(ServerInfo* info) {
+    RatingIndex index;
+    init_rating_index(&index);
+    Request request;
+    int match = 1;
+    struct timespec now, lastSweep;
+    clock_gettime(CLOCK_MONOTONIC, &lastSweep);
+
+    while (1) {
+        if (read_channel_timed(&info->requests, (void**) &request,
+                RATING_SWEEP_INTERVAL)) {
+            double rating = player_id_rating(&info->results.standings,
+                    request.player);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            // the new player comes after everyone already waiting
+            WaitingPlayer* below;
+            WaitingPlayer* above;
+            find_neighbours(&index, rating, index.nextOrder, NULL, &below,
+                    &above);
+            WaitingPlayer* opponent = pick_opponent(rating,
+                    RATING_INITIAL_GAP, below, above, &now);
+            if (opponent != NULL) {
+                start_match(info, &opponent->request, &request, match++);
+                remove_waiting(&index, opponent);
+            } else {
+                add_waiting(&index, &request, rating, &now);
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (millis_between(&lastSweep, &now) >= RATING_SWEEP_INTERVAL) {
+            sweep_waiting(info, &index, &match, &now);
+            lastSweep = now;
+
+            // the odd player out goes to another node once they have waited
+            WaitingPlayer* oldest = index.oldest;
+            if (info->federation != NULL && index.numWaiting == 1
+                    && millis_between(&oldest->arrived, &now)
+                    >= FEDERATION_OFFER_WAIT
+                    && offer_request(info->federation, &oldest->request)) {
+                remove_waiting(&index, oldest);
+            }
+        }
+    }
+}
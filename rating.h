@@ -0,0 +1,75 @@
+#include <stdbool.h>
+#include <time.h>
+
+#include "server.h"
+
+#ifndef RATING_H
+#define RATING_H
+
+// The most levels a node in the rating skip list can have
+#define RATING_MAX_LEVEL 20
+// The rating gap a player will accept as soon as they arrive
+#define RATING_INITIAL_GAP 50.0
+// How much the accepted rating gap widens for every second spent waiting
+#define RATING_GAP_PER_SECOND 200.0
+// After waiting this long (ms) a player will accept any opponent
+#define RATING_MAX_WAIT 2000
+// How often (ms) waiting players are checked against their widened gaps
+#define RATING_SWEEP_INTERVAL 50
+
+/**
+ * A request waiting to be matched, in the rating index
+ *
+ * request (Request): the request
+ * rating (double): the Elo rating of the player when they arrived
+ * order (unsigned long): breaks ties between equal ratings
+ * arrived (struct timespec): when the player started waiting
+ * older (struct WaitingPlayer*): the player who arrived before this one
+ * newer (struct WaitingPlayer*): the player who arrived after this one
+ * level (int): the number of skip list levels this player is on
+ * next (struct WaitingPlayer*[]): the next player by rating on each level
+ *
+ */
+typedef struct WaitingPlayer {
+    Request request;
+    double rating;
+    unsigned long order;
+    struct timespec arrived;
+    struct WaitingPlayer* older;
+    struct WaitingPlayer* newer;
+    int level;
+    struct WaitingPlayer* next[];
+} WaitingPlayer;
+
+/**
+ * Every request waiting to be matched, ordered by rating in a skip list (so
+ * the nearest rated opponent can be found in O(log n)) and by arrival in a
+ * linked list (so the longest waiting players can be checked first).
+ *
+ * head (WaitingPlayer*): the head of the skip list, not a real player
+ * oldest (WaitingPlayer*): the player who has waited longest
+ * newest (WaitingPlayer*): the player who arrived last
+ * numWaiting (size_t): the number of players waiting
+ * nextOrder (unsigned long): the order given to the next player
+ * seed (unsigned int): the seed used to choose skip list levels
+ *
+ */
+typedef struct RatingIndex {
+    WaitingPlayer* head;
+    WaitingPlayer* oldest;
+    WaitingPlayer* newest;
+    size_t numWaiting;
+    unsigned long nextOrder;
+    unsigned int seed;
+} RatingIndex;
+
+// Initialises an empty rating index.
+void init_rating_index(RatingIndex* index);
+
+// Pairs requests by rating until the server stops. Each arrival is matched
+// with the nearest rated waiting player whose accepted gap covers it, and
+// waiting players are regularly rechecked as their gaps widen. Does not
+// return.
+void match_by_rating(ServerInfo* info);
+
+#endif
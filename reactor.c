@@ -0,0 +1,809 @@
+#define _GNU_SOURCE
+
+#include "reactor.h"
+#include "referee.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// The longest line we will buffer before giving up on a client
+#define MAX_LINE_LENGTH 4096
+
+/**
+ * Where a connection is in the MR -> MATCH -> RESULT exchange, or the
+ * MR -> MATCH -> MOVE... exchange of a refereed match
+ */
+typedef enum ConnectionState {
+    AWAITING_REQUEST,
+    AWAITING_MATCH,
+    AWAITING_RESULT,
+    AWAITING_MOVE,
+    CLOSED
+} ConnectionState;
+
+/**
+ * A client connection owned by a single reactor thread. Connections come
+ * from the server's connectionSlab and go back to it once released, keeping
+ * their buffers and some of their name tables' memory for the next
+ * connection.
+ *
+ * fd (int): the client socket
+ * epollFd (int): the epoll instance of the owning reactor thread
+ * input (char*): bytes read but not yet parsed
+ * inputLength (size_t): the number of bytes in input
+ * inputSize (size_t): the capacity of input
+ * output (char*): bytes that could not be written yet
+ * outputLength (size_t): the number of bytes in output
+ * outputSize (size_t): the capacity of output
+ * player (PlayerId): the player from the last MR
+ * opponent (PlayerId): the opponent in the current match
+ * match (int): the id of the current match
+ * state (ConnectionState): where this client is in the protocol
+ * features (int): the Features agreed with the client
+ * names (NameTable): the names the client sent us in NAME frames
+ * sentNames (NameTable): the names we sent the client in NAME frames
+ * referee (struct Referee*): the referee of the refereed match being played,
+ * which this connection holds a reference to
+ * seat (int): which player of the referee this client is
+ * timeline (Timeline): when the client's current request reached each stage
+ * refs (int): references held by the reactor, any queued request and any
+ * referee
+ * lock (pthread_mutex_t): guards state, output and fd against the matchmaker
+ * info (ServerInfo*): the server this client is connected to
+ *
+ */
+struct Connection {
+    int fd;
+    int epollFd;
+    char* input;
+    size_t inputLength;
+    size_t inputSize;
+    char* output;
+    size_t outputLength;
+    size_t outputSize;
+    PlayerId player;
+    PlayerId opponent;
+    int match;
+    ConnectionState state;
+    int features;
+    NameTable names;
+    NameTable sentNames;
+    struct Referee* referee;
+    int seat;
+    Timeline timeline;
+    int refs;
+    pthread_mutex_t lock;
+    ServerInfo* info;
+};
+
+/**
+ * A reactor thread and the epoll instance it owns
+ *
+ * epollFd (int): the epoll instance
+ * id (pthread_t): the thread running this reactor
+ * info (ServerInfo*): the server
+ *
+ */
+typedef struct Reactor {
+    int epollFd;
+    pthread_t id;
+    ServerInfo* info;
+} Reactor;
+
+/**
+ * Put a file descriptor into non-blocking mode
+ *
+ * fd (int): the file descriptor
+ *
+ * Returns true on success
+ *
+ */
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+/**
+ * Drop a reference to a connection, giving it back to the connectionSlab
+ * when none are left
+ *
+ * conn (struct Connection*): the connection
+ *
+ */
+static void release_connection(struct Connection* conn) {
+    if (__atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    pthread_mutex_destroy(&conn->lock);
+    reset_names(&conn->names);
+    reset_names(&conn->sentNames);
+    release_slab_record(&conn->info->connectionSlab, conn);
+}
+
+/**
+ * Write as much pending output as the socket will take, waiting for
+ * EPOLLOUT if some is left over. Must be called with the lock held.
+ *
+ * conn (struct Connection*): the connection
+ *
+ * Returns false if the socket failed
+ *
+ */
+static bool flush_output(struct Connection* conn) {
+    size_t written = 0;
+    while (written < conn->outputLength) {
+        ssize_t count = send(conn->fd, conn->output + written,
+                conn->outputLength - written, MSG_NOSIGNAL);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        written += count;
+    }
+    memmove(conn->output, conn->output + written,
+            conn->outputLength - written);
+    conn->outputLength -= written;
+
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP,
+            .data.ptr = conn};
+    if (conn->outputLength > 0) {
+        event.events |= EPOLLOUT;
+    }
+    return epoll_ctl(conn->epollFd, EPOLL_CTL_MOD, conn->fd, &event) == 0;
+}
+
+/**
+ * Queue a message to a connection and try to send it straight away. Must be
+ * called with the lock held.
+ *
+ * conn (struct Connection*): the connection
+ * message (char*): the message to send
+ * length (size_t): the length of the message
+ *
+ * Returns false if the socket failed
+ *
+ */
+static bool queue_output(struct Connection* conn, char* message,
+        size_t length) {
+    if (conn->outputLength + length > conn->outputSize) {
+        size_t size = conn->outputSize == 0 ? INITIAL_BUFFER_SIZE
+                : conn->outputSize;
+        while (size < conn->outputLength + length) {
+            size *= 2;
+        }
+        conn->output = realloc(conn->output, size);
+        conn->outputSize = size;
+    }
+    memcpy(conn->output + conn->outputLength, message, length);
+    conn->outputLength += length;
+    return flush_output(conn);
+}
+
+/**
+ * Record the end of a client's match, which is also where the wait for its
+ * next MR starts. Must be called with the lock held.
+ *
+ * conn (struct Connection*): the client's connection
+ *
+ */
+static void finish_timeline(struct Connection* conn) {
+    unsigned long now = monotonic_nanos();
+    record_result_latency(&conn->info->latencies, &conn->timeline, now);
+    conn->timeline = (Timeline) {.accepted = now};
+}
+
+/**
+ * Drop a reference to a referee, freeing it (and dropping its references to
+ * the players' connections) when none are left
+ *
+ * referee (Referee*): the referee
+ *
+ */
+static void release_referee(Referee* referee) {
+    if (__atomic_sub_fetch(&referee->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    // the connections are gone, but the server they were on is not
+    ServerInfo* info = referee->conns[0]->info;
+    release_connection(referee->conns[0]);
+    release_connection(referee->conns[1]);
+    destroy_referee(referee);
+    release_slab_record(&info->refereeSlab, referee);
+}
+
+/**
+ * Send a player what the referee made of a round, leaving the refereed
+ * match if it is over. Nothing is sent to a player who has already left the
+ * match. Must be called with the lock held.
+ *
+ * conn (struct Connection*): the player's connection
+ * referee (Referee*): the referee the message is from
+ * message (char*): the message, or NULL if there is nothing to send
+ * length (int): the length of the message
+ * over (bool): whether the match is over
+ *
+ * Returns false if the socket failed
+ *
+ */
+static bool send_call(struct Connection* conn, Referee* referee,
+        char* message, int length, bool over) {
+    if (message == NULL || conn->referee != referee
+            || conn->state != AWAITING_MOVE) {
+        return true;
+    }
+    bool sent = queue_output(conn, message, length);
+    if (over) {
+        finish_timeline(conn);
+        conn->referee = NULL;
+        conn->state = AWAITING_REQUEST;
+        release_referee(referee);
+    }
+    return sent;
+}
+
+/**
+ * Send the player in a seat what the referee made of a round, from a thread
+ * that does not hold the player's lock
+ *
+ * referee (Referee*): the referee, which the caller holds a reference to
+ * seat (int): the player to tell
+ * calls (Calls*): the messages for both players
+ * over (bool): whether the match is over
+ *
+ */
+static void tell_player(Referee* referee, int seat, Calls* calls,
+        bool over) {
+    struct Connection* conn = referee->conns[seat];
+    pthread_mutex_lock(&conn->lock);
+    if (!send_call(conn, referee, calls->message[seat], calls->length[seat],
+            over)) {
+        // let the owning reactor see the hangup and clean up
+        shutdown(conn->fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&conn->lock);
+}
+
+/**
+ * Forfeit a refereed match for a player who has gone away, telling the
+ * opponent, and drop the player's reference to the referee. Must be called
+ * without any connection locks held.
+ *
+ * referee (Referee*): the referee
+ * seat (int): the player who went away
+ *
+ */
+static void abandon_match(Referee* referee, int seat) {
+    Calls calls = {{NULL}};
+    if (referee_forfeit(referee, seat, &calls)) {
+        tell_player(referee, 1 - seat, &calls, true);
+    }
+    free_calls(&calls);
+    release_referee(referee);
+}
+
+/**
+ * Take a move in a refereed match, telling both players what the referee
+ * made of the round if it is over. Must be called with the lock held.
+ *
+ * conn (struct Connection*): the connection the MOVE came from
+ * move (MoveType): the move
+ *
+ * Returns false if the connection should be closed
+ *
+ */
+static bool play_move(struct Connection* conn, MoveType move) {
+    Referee* referee = conn->referee;
+    int seat = conn->seat;
+    Calls calls = {{NULL}};
+    Call call = referee_move(referee, seat, move, &calls);
+    if (call == CALL_FOUL) {
+        return false;
+    }
+
+    bool open = true;
+    if (call != CALL_WAIT) {
+        // the opponent first, as leaving the match ourselves may drop the
+        // last reference to the referee. Only the player who finishes a
+        // round takes the other's lock, so the two cannot deadlock.
+        tell_player(referee, 1 - seat, &calls, call == CALL_OVER);
+        open = send_call(conn, referee, calls.message[seat],
+                calls.length[seat], call == CALL_OVER);
+    }
+    free_calls(&calls);
+    return open;
+}
+
+/**
+ * Close a connection from its owning reactor thread
+ *
+ * conn (struct Connection*): the connection to close
+ *
+ */
+static void close_connection(struct Connection* conn) {
+    pthread_mutex_lock(&conn->lock);
+    if (conn->state != CLOSED) {
+        count_event(COUNTER_CONNECTIONS_CLOSED);
+        conn->state = CLOSED;
+        epoll_ctl(conn->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+    }
+    // a player who goes away in the middle of a refereed match forfeits it
+    Referee* referee = conn->referee;
+    int seat = conn->seat;
+    conn->referee = NULL;
+    pthread_mutex_unlock(&conn->lock);
+
+    if (referee != NULL) {
+        abandon_match(referee, seat);
+    }
+    release_connection(conn);
+}
+
+bool reactor_send_match(struct Connection* conn, Match* match) {
+    char* message = NULL;
+    int length = 0;
+    unsigned char frames[2 * MAX_FRAME_LENGTH];
+
+    bool sent = false;
+    bool joined = false;
+    pthread_mutex_lock(&conn->lock);
+    if (conn->features & FEATURE_BINARY) {
+        // the names sent are guarded by the lock
+        length = encode_match(frames, match, &conn->sentNames);
+    } else {
+        length = format_match(&message, match);
+    }
+    if (conn->state == AWAITING_MATCH && length >= 0) {
+        conn->state = AWAITING_RESULT;
+        conn->opponent = match->opponent;
+        conn->match = match->id;
+        if (match->referee != NULL) {
+            conn->state = AWAITING_MOVE;
+            conn->referee = match->referee;
+            conn->seat = match->seat;
+            joined = true;
+        }
+        sent = queue_output(conn, message != NULL ? message : (char*) frames,
+                length);
+        conn->timeline = match->timeline;
+        conn->timeline.matched = monotonic_nanos();
+        record_stage(&conn->info->latencies, STAGE_MATCH,
+                conn->timeline.paired, conn->timeline.matched);
+
+        char* result;
+        int resultLength;
+        if (sent && joined && (resultLength = referee_result(match->referee,
+                match->seat, &result)) > 0) {
+            // the opponent went away before we could tell this player
+            sent = send_call(conn, match->referee, result, resultLength,
+                    true);
+            free(result);
+        }
+        if (!sent) {
+            // let the owning reactor see the hangup and clean up
+            shutdown(conn->fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    free(message);
+    if (match->referee == NULL) {
+        release_connection(conn);
+    } else if (!joined) {
+        // our reference to the connection belongs to the referee, and a
+        // player who went away before the match started forfeits it
+        abandon_match(match->referee, match->seat);
+    }
+    return sent;
+}
+
+/**
+ * Answer a HELLO from a client with the features we agree to. Must be called
+ * with the lock held.
+ *
+ * conn (struct Connection*): the connection the HELLO came from
+ * features (int): the features the client asked for
+ *
+ * Returns false if the socket failed
+ *
+ */
+static bool agree_features(struct Connection* conn, int features) {
+    conn->features = negotiate_features(conn->info->features, features)
+            | (conn->features & FEATURE_BINARY);
+
+    if (conn->features & FEATURE_BINARY) {
+        unsigned char frame[MAX_FRAME_LENGTH];
+        Message message = {.type = MESSAGE_HELLO, .value = conn->features};
+        return queue_output(conn, (char*) frame,
+                encode_message(&message, frame));
+    }
+    char hello[MAX_HELLO_LENGTH];
+    return queue_output(conn, hello, format_hello(hello, conn->features));
+}
+
+/**
+ * Queue a match request from a client for the matchmaker. Must be called with
+ * the lock held.
+ *
+ * conn (struct Connection*): the connection the MR came from, whose name has
+ * been set
+ * port (char*): the port in the MR, shorter than MAX_PORT_LENGTH
+ *
+ * Returns false if the request could not be queued
+ *
+ */
+static bool request_match(struct Connection* conn, char* port) {
+    ServerInfo* info = conn->info;
+    conn->timeline.parsed = monotonic_nanos();
+    record_stage(&info->latencies, STAGE_REQUEST, conn->timeline.accepted,
+            conn->timeline.parsed);
+
+    conn->timeline.enqueued = monotonic_nanos();
+    Request request = {.player = conn->player, .stream = NULL,
+            .client = NULL, .conn = conn, .results = &info->results,
+            .features = conn->features, .latencies = &info->latencies,
+            .timeline = conn->timeline};
+    memcpy(request.port, port, strlen(port) + 1);
+    conn->state = AWAITING_MATCH;
+    __atomic_add_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL);
+    if (!write_channel(&info->requests, (void*) &request)) {
+        count_event(COUNTER_DROPPED_WRITES);
+        __atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL);
+        return false;
+    }
+    record_stage(&info->latencies, STAGE_ENQUEUE, conn->timeline.parsed,
+            monotonic_nanos());
+    return true;
+}
+
+/**
+ * Record the result a client reported. Must be called with the lock held.
+ *
+ * conn (struct Connection*): the connection the RESULT came from
+ * result (GameResult): the result for the client
+ *
+ * Returns false if the connection should be closed
+ *
+ */
+static bool finish_match(struct Connection* conn, GameResult result) {
+    finish_timeline(conn);
+    add_result(&conn->info->results, conn->match, conn->player,
+            conn->opponent, result);
+    // we are done with this client once it reports back, unless it is a
+    // session which goes on to its next MR
+    conn->state = AWAITING_REQUEST;
+    return conn->features & FEATURE_SESSION;
+}
+
+/**
+ * Handle a single complete line from a client. Must be called with the lock
+ * held.
+ *
+ * conn (struct Connection*): the connection the line came from
+ * line (char*): the line, terminated in place of its newline
+ * length (size_t): the length of the line
+ *
+ * Returns false if the connection should be closed
+ *
+ */
+static bool handle_line(struct Connection* conn, char* line, size_t length) {
+    Fields fields;
+    split_line(line, length, &fields);
+
+    MoveType move;
+    if (conn->state == AWAITING_REQUEST) {
+        if (fields.tag == TAG_MOVE) {
+            // a move that crossed the RESULT of a forfeited refereed match
+            return true;
+        }
+        int features = parse_hello(&fields);
+        if (features != -1) {
+            return agree_features(conn, features);
+        }
+
+        Slice name, port;
+        if (!parse_match_request(&fields, &name, &port)) {
+            count_event(COUNTER_PARSE_ERRORS);
+            return false;
+        }
+        conn->player = intern_player(name.start);
+        if (conn->player == NO_PLAYER) {
+            return false;
+        }
+        // the fields are terminated in place, so the port is a string
+        return request_match(conn, port.start);
+    }
+
+    if (conn->state == AWAITING_MOVE) {
+        if (!parse_move_message(&fields, &move)) {
+            count_event(COUNTER_PARSE_ERRORS);
+            return false;
+        }
+        return play_move(conn, move);
+    }
+
+    // AWAITING_RESULT
+    if (fields.tag != TAG_RESULT) {
+        count_event(COUNTER_PARSE_ERRORS);
+    }
+    return finish_match(conn, parse_result_message(&fields,
+            player_name(conn->player)));
+}
+
+/**
+ * Handle a single complete frame from a client. Must be called with the lock
+ * held.
+ *
+ * conn (struct Connection*): the connection the frame came from
+ * message (Message*): the frame
+ *
+ * Returns false if the connection should be closed
+ *
+ */
+static bool handle_message(struct Connection* conn, Message* message) {
+    if (message->type == MESSAGE_NAME) {
+        if (!learn_name(&conn->names, message->id, message->name)) {
+            count_event(COUNTER_PARSE_ERRORS);
+            return false;
+        }
+        return true;
+    }
+
+    MoveType move;
+    if (conn->state == AWAITING_REQUEST) {
+        if (message->type == MESSAGE_HELLO) {
+            return agree_features(conn, message->value);
+        }
+        if (message->type == MESSAGE_MOVE) {
+            // a move that crossed the RESULT of a forfeited refereed match
+            return true;
+        }
+
+        char port[MAX_PORT_LENGTH];
+        if (message->type != MESSAGE_MR || !parse_match_frame(message,
+                &conn->names, &conn->player, port)) {
+            count_event(COUNTER_PARSE_ERRORS);
+            return false;
+        }
+        return request_match(conn, port);
+    }
+
+    if (conn->state == AWAITING_MOVE) {
+        if (!parse_move_frame(message, &move)) {
+            count_event(COUNTER_PARSE_ERRORS);
+            return false;
+        }
+        return play_move(conn, move);
+    }
+
+    // AWAITING_RESULT
+    if (message->type != MESSAGE_RESULT) {
+        count_event(COUNTER_PARSE_ERRORS);
+        return false;
+    }
+    return finish_match(conn, parse_result_frame(message));
+}
+
+/**
+ * Parse every complete line or frame buffered on a connection. Input that
+ * arrives while we are waiting on the matchmaker is left buffered.
+ *
+ * conn (struct Connection*): the connection
+ *
+ * Returns false if the connection should be closed
+ *
+ */
+static bool process_input(struct Connection* conn) {
+    size_t start = 0;
+    bool open = true;
+
+    pthread_mutex_lock(&conn->lock);
+    if (!(conn->features & FEATURE_BINARY)
+            && (unsigned char) conn->input[0] == FRAME_MAGIC) {
+        // the client is switching to frames, once its newline arrives
+        if (conn->inputLength < 2) {
+            pthread_mutex_unlock(&conn->lock);
+            return true;
+        }
+        conn->features |= FEATURE_BINARY;
+        open = conn->input[1] == '\n';
+        start = 2;
+        if (!open) {
+            count_event(COUNTER_PARSE_ERRORS);
+        }
+    }
+
+    while (open && conn->state != AWAITING_MATCH) {
+        if (conn->features & FEATURE_BINARY) {
+            Message message;
+            int length = decode_message((unsigned char*) conn->input + start,
+                    conn->inputLength - start, &message);
+            if (length == 0) {
+                break;
+            } else if (length < 0) {
+                count_event(COUNTER_PARSE_ERRORS);
+            }
+            open = length > 0 && handle_message(conn, &message);
+            start += length > 0 ? length : 0;
+            continue;
+        }
+
+        char* newline = memchr(conn->input + start, '\n',
+                conn->inputLength - start);
+        if (newline == NULL) {
+            break;
+        }
+        *newline = '\0';
+        open = handle_line(conn, conn->input + start,
+                newline - conn->input - start);
+        start = newline - conn->input + 1;
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    memmove(conn->input, conn->input + start, conn->inputLength - start);
+    conn->inputLength -= start;
+    if (conn->inputLength >= MAX_LINE_LENGTH) {
+        // a line this long is never going to be a valid message
+        count_event(COUNTER_PARSE_ERRORS);
+        return false;
+    }
+    return open;
+}
+
+/**
+ * Read everything available on a connection and act on it
+ *
+ * conn (struct Connection*): the connection
+ *
+ * Returns false if the connection should be closed
+ *
+ */
+static bool read_input(struct Connection* conn) {
+    while (1) {
+        if (conn->inputLength == conn->inputSize) {
+            conn->inputSize *= 2;
+            conn->input = realloc(conn->input, conn->inputSize);
+        }
+        ssize_t count = recv(conn->fd, conn->input + conn->inputLength,
+                conn->inputSize - conn->inputLength, 0);
+        if (count == 0) {
+            return false;
+        } else if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn->inputLength += count;
+        if (!process_input(conn)) {
+            return false;
+        }
+    }
+}
+
+/**
+ * Accept every pending connection and register it with this reactor
+ *
+ * reactor (Reactor*): the reactor accepting the connections
+ *
+ */
+static void accept_connections(Reactor* reactor) {
+    while (1) {
+        int fd = accept4(reactor->info->socketFd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+
+        struct Connection* conn = slab_record(
+                &reactor->info->connectionSlab);
+        if (conn == NULL) {
+            count_event(COUNTER_CONNECTIONS_CLOSED);
+            close(fd);
+            continue;
+        }
+        if (conn->input == NULL) {
+            conn->inputSize = INITIAL_BUFFER_SIZE;
+            conn->input = malloc(conn->inputSize);
+        }
+        // a recycled connection keeps its buffers and name tables, but
+        // nothing else of the last client
+        conn->fd = fd;
+        conn->epollFd = reactor->epollFd;
+        conn->inputLength = conn->outputLength = 0;
+        conn->player = conn->opponent = NO_PLAYER;
+        conn->match = 0;
+        conn->features = 0;
+        conn->referee = NULL;
+        conn->seat = 0;
+        conn->state = AWAITING_REQUEST;
+        conn->timeline.accepted = monotonic_nanos();
+        conn->refs = 1;
+        conn->info = reactor->info;
+        pthread_mutex_init(&conn->lock, NULL);
+        count_event(COUNTER_CONNECTIONS_OPENED);
+
+        struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP,
+                .data.ptr = conn};
+        if (epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, fd, &event)) {
+            count_event(COUNTER_CONNECTIONS_CLOSED);
+            close(fd);
+            release_connection(conn);
+        }
+    }
+}
+
+/**
+ * Run the event loop of a single reactor thread
+ *
+ * reactorArg (void*): the Reactor to run
+ *
+ * Returns NULL
+ *
+ */
+static void* reactor_loop(void* reactorArg) {
+    Reactor* reactor = (Reactor*) reactorArg;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    while (1) {
+        int ready = epoll_wait(reactor->epollFd, events, REACTOR_MAX_EVENTS,
+                -1);
+        for (int i = 0; i < ready; i++) {
+            struct Connection* conn = events[i].data.ptr;
+            if (conn == NULL) {
+                accept_connections(reactor);
+                continue;
+            }
+
+            bool open = !(events[i].events & EPOLLERR);
+            if (open && (events[i].events & EPOLLOUT)) {
+                pthread_mutex_lock(&conn->lock);
+                open = flush_output(conn);
+                pthread_mutex_unlock(&conn->lock);
+            }
+            if (open && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+                open = read_input(conn);
+            }
+            if (!open) {
+                close_connection(conn);
+            }
+        }
+    }
+    return NULL;
+}
+
+void run_reactor(ServerInfo* info) {
+    set_nonblocking(info->socketFd);
+
+    init_slab_pool(&info->connectionSlab, sizeof(struct Connection));
+    Reactor* reactors = calloc(info->reactorThreads, sizeof(Reactor));
+    for (int i = 0; i < info->reactorThreads; i++) {
+        reactors[i].info = info;
+        reactors[i].epollFd = epoll_create1(0);
+
+        // every reactor waits on the listening socket, EPOLLEXCLUSIVE stops
+        // them all waking up for the same connection
+        struct epoll_event event = {.events = EPOLLIN | EPOLLEXCLUSIVE,
+                .data.ptr = NULL};
+        epoll_ctl(reactors[i].epollFd, EPOLL_CTL_ADD, info->socketFd, &event);
+        if (i > 0) {
+            pthread_create(&reactors[i].id, NULL, reactor_loop,
+                    (void*) &reactors[i]);
+        }
+    }
+    reactor_loop((void*) &reactors[0]);
+}
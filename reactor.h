@@ -0,0 +1,24 @@
+#include <stdbool.h>
+
+#include "server.h"
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+// The most events a reactor thread handles per epoll_wait
+#define REACTOR_MAX_EVENTS 64
+
+// Run the server in reactor mode. Every client fd (and the listening socket)
+// is owned by a fixed set of info->reactorThreads epoll threads, which parse
+// MR and RESULT lines (and the MOVE lines of refereed matches) as the bytes
+// arrive. Does not return.
+void run_reactor(ServerInfo* info);
+
+// Send a MATCH message to a reactor connection which is waiting on a match,
+// after which the reactor will wait for its RESULT, or its MOVEs if the match
+// has a referee. Consumes the reference to the connection held by the
+// request, which passes to the referee if there is one. Returns false if the
+// client has since disconnected.
+bool reactor_send_match(struct Connection* conn, Match* match);
+
+#endif
@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+
+#include "referee.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Encode a frame into a newly allocated message
+ *
+ * frame (Message*): the frame to encode
+ * message (char**): set to the allocated message
+ *
+ * Returns the length of the message, or -1 if it could not be allocated
+ *
+ */
+static int encode_call(Message* frame, char** message) {
+    *message = malloc(MAX_FRAME_LENGTH);
+    if (*message == NULL) {
+        return -1;
+    }
+    return encode_message(frame, (unsigned char*) *message);
+}
+
+/**
+ * Format the opponent's move this round for a player. Must be called with
+ * the lock held.
+ *
+ * referee (Referee*): the referee
+ * seat (int): the player to tell
+ * message (char**): set to the allocated message
+ *
+ * Returns the length of the message, or -1 if it could not be allocated
+ *
+ */
+static int format_move(Referee* referee, int seat, char** message) {
+    MoveType move = referee->moves[1 - seat];
+    if (referee->features[seat] & FEATURE_BINARY) {
+        Message frame = {.type = MESSAGE_MOVE, .value = move};
+        return encode_call(&frame, message);
+    }
+    return asprintf(message, "MOVE:%s\n", move_as_string(move));
+}
+
+/**
+ * Format the RESULT of the match for a player, in the same form as a player
+ * would have reported it. Must be called with the lock held.
+ *
+ * referee (Referee*): the referee
+ * seat (int): the player to tell
+ * message (char**): set to the allocated message
+ *
+ * Returns the length of the message, or -1 if it could not be allocated
+ *
+ */
+static int format_result(Referee* referee, int seat, char** message) {
+    if (referee->features[seat] & FEATURE_BINARY) {
+        Message frame = {.type = MESSAGE_RESULT, .id = referee->id,
+                .value = referee->winner == -1 ? TIE
+                : referee->winner == seat ? WIN : LOSE};
+        return encode_call(&frame, message);
+    }
+    return asprintf(message, "RESULT:%d:%s\n", referee->id,
+            referee->winner == -1 ? "TIE"
+            : player_name(referee->players[referee->winner]));
+}
+
+/**
+ * End the match and record its result for both players. Must be called with
+ * the lock held.
+ *
+ * referee (Referee*): the referee
+ * winner (int): the seat of the winner, -1 for a tie
+ *
+ */
+static void end_refereed_match(Referee* referee, int winner) {
+    referee->over = true;
+    referee->winner = winner;
+    for (int seat = 0; seat < 2; seat++) {
+        add_result(referee->results, referee->id, referee->players[seat],
+                referee->players[1 - seat], winner == -1 ? TIE
+                : winner == seat ? WIN : LOSE);
+    }
+}
+
+void init_referee(Referee* referee, Match* match) {
+    memset(referee, 0, sizeof(Referee));
+    referee->id = match->id;
+    referee->players[0] = match->player;
+    referee->players[1] = match->opponent;
+    referee->features[0] = match->features;
+    referee->features[1] = match->opponentFeatures;
+    referee->results = match->results;
+    referee->winner = -1;
+    pthread_mutex_init(&referee->lock, NULL);
+}
+
+void destroy_referee(Referee* referee) {
+    pthread_mutex_destroy(&referee->lock);
+}
+
+Call referee_move(Referee* referee, int seat, MoveType move, Calls* calls) {
+    Call call = CALL_WAIT;
+    pthread_mutex_lock(&referee->lock);
+    if (referee->over) {
+        // the opponent forfeited while this move was on its way
+        pthread_mutex_unlock(&referee->lock);
+        return CALL_WAIT;
+    }
+    if (referee->moved[seat]) {
+        pthread_mutex_unlock(&referee->lock);
+        return CALL_FOUL;
+    }
+    referee->moves[seat] = move;
+    referee->moved[seat] = true;
+
+    if (referee->moved[1 - seat]) {
+        GameResult result = compare_moves(referee->moves[0],
+                referee->moves[1]);
+        if (result != TIE) {
+            referee->scores[result == WIN ? 0 : 1]++;
+        }
+        referee->rounds++;
+        referee->moved[0] = referee->moved[1] = false;
+
+        call = CALL_ROUND;
+        if (match_decided(referee->rounds, referee->scores[0],
+                referee->scores[1])) {
+            call = CALL_OVER;
+            end_refereed_match(referee, referee->scores[0]
+                    == referee->scores[1] ? -1
+                    : referee->scores[0] > referee->scores[1] ? 0 : 1);
+        }
+        for (int player = 0; player < 2; player++) {
+            calls->length[player] = call == CALL_OVER
+                    ? format_result(referee, player, &calls->message[player])
+                    : format_move(referee, player, &calls->message[player]);
+            if (calls->length[player] == -1) {
+                calls->message[player] = NULL;
+            }
+        }
+    }
+    pthread_mutex_unlock(&referee->lock);
+    return call;
+}
+
+bool referee_forfeit(Referee* referee, int seat, Calls* calls) {
+    pthread_mutex_lock(&referee->lock);
+    bool forfeited = !referee->over;
+    if (forfeited) {
+        end_refereed_match(referee, 1 - seat);
+        calls->length[1 - seat] = format_result(referee, 1 - seat,
+                &calls->message[1 - seat]);
+        if (calls->length[1 - seat] == -1) {
+            calls->message[1 - seat] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&referee->lock);
+    return forfeited;
+}
+
+int referee_result(Referee* referee, int seat, char** message) {
+    int length = 0;
+    pthread_mutex_lock(&referee->lock);
+    if (referee->over) {
+        length = format_result(referee, seat, message);
+    }
+    pthread_mutex_unlock(&referee->lock);
+    return length == -1 ? 0 : length;
+}
+
+void free_calls(Calls* calls) {
+    for (int seat = 0; seat < 2; seat++) {
+        free(calls->message[seat]);
+        calls->message[seat] = NULL;
+    }
+}
+
+bool parse_move_message(Fields* line, MoveType* move) {
+    return line->tag == TAG_MOVE && line->count == 1
+            && parse_move(line->field[0].start, move);
+}
+
+bool parse_move_frame(Message* message, MoveType* move) {
+    if (message->type != MESSAGE_MOVE || message->value > SCISSORS) {
+        return false;
+    }
+    *move = (MoveType) message->value;
+    return true;
+}
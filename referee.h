@@ -0,0 +1,103 @@
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "server.h"
+
+#ifndef REFEREE_H
+#define REFEREE_H
+
+/** What a move means for a refereed match */
+typedef enum Call {
+    // the other player has not moved this round yet, or the match is already
+    // over, so there is nothing to tell anyone
+    CALL_WAIT,
+    // the round is over and the match goes on
+    CALL_ROUND,
+    // the round is over and so is the match
+    CALL_OVER,
+    // the player moved twice in one round
+    CALL_FOUL
+} Call;
+
+/**
+ * The messages telling each player what the referee made of a round, owned
+ * by whoever sends them
+ *
+ * message (char*[2]): the message for each player, or NULL if there is
+ * nothing to tell them
+ * length (int[2]): the length of each message
+ *
+ */
+typedef struct Calls {
+    char* message[2];
+    int length[2];
+} Calls;
+
+/**
+ * A match played through the server. Both players send their moves to the
+ * referee, which scores each round and records the result of the match
+ * itself. Players are known by their seat, 0 or 1. Thread safe.
+ *
+ * id (int): the id of the match
+ * players (PlayerId[2]): each player
+ * features (int[2]): the Features agreed with each player
+ * results (Results*): where the result of the match goes
+ * moves (MoveType[2]): the move of each player this round
+ * moved (bool[2]): whether each player has moved this round
+ * scores (int[2]): the rounds won by each player
+ * rounds (int): the number of rounds played
+ * over (bool): whether the match is over
+ * winner (int): the seat of the winner once the match is over, -1 for a tie
+ * lock (pthread_mutex_t): guards everything above
+ * refs (int): references held by the players' connections (reactor mode)
+ * conns (struct Connection*[2]): the connection of each player, each
+ * referenced by the referee (reactor mode)
+ *
+ */
+typedef struct Referee {
+    int id;
+    PlayerId players[2];
+    int features[2];
+    Results* results;
+    MoveType moves[2];
+    bool moved[2];
+    int scores[2];
+    int rounds;
+    bool over;
+    int winner;
+    pthread_mutex_t lock;
+    int refs;
+    struct Connection* conns[2];
+} Referee;
+
+// Sets up a referee for a match, from the perspective of the player in seat
+// 0.
+void init_referee(Referee* referee, Match* match);
+
+// Frees anything the referee holds, but not the referee itself.
+void destroy_referee(Referee* referee);
+
+// Takes a move from the player in seat. When it finishes a round, calls is
+// filled in with the opponent's move for both players or, if that was the
+// last round, the RESULT for both, which has also been recorded.
+Call referee_move(Referee* referee, int seat, MoveType move, Calls* calls);
+
+// Ends the match in favour of the opponent of the player in seat, who has
+// gone away, recording the result and filling in the RESULT for the
+// opponent. Returns false (and does nothing) if the match was already over.
+bool referee_forfeit(Referee* referee, int seat, Calls* calls);
+
+// Formats the RESULT for the player in seat. Returns the length of the
+// message, or 0 if the match is not over yet.
+int referee_result(Referee* referee, int seat, char** message);
+
+// Frees the messages in calls.
+void free_calls(Calls* calls);
+
+// Parses a MOVE line. Returns false if it is not a valid MOVE.
+bool parse_move_message(Fields* line, MoveType* move);
+
+// Gets the move from a MOVE frame. Returns false if it is not a valid MOVE.
+bool parse_move_frame(Message* message, MoveType* move);
+
+#endif
@@ -1,84 +1,79 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <netdb.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/signalfd.h>
 #include <stdbool.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/time.h>
 
 #include "shared.h"
+#include "server.h"
+#include "reactor.h"
+#include "rating.h"
+#include "referee.h"
+#include "metrics.h"
+#include "journal.h"
+#include "export.h"
+#include "tally.h"
+#include "federation.h"
 
 #define BACKLOG 128
 #define MAX_INPUT 80
-
-// A global results struct used when handling signal hangup
-struct Channel* globalResults;
-
-/** Exit codes defined on spec */
-typedef enum ServerError {
-    INCORRECT_ARG_COUNT = 1
-} ServerError;
-
-/**
- * A match request
- *
- * name (char*): the player name
- * port (char*): the port they are listening on
- * stream (FILE*): so we can send a message to this client
- *
- */
-typedef struct Request {
-    char* name;
-    char* port;
-    FILE* stream;
-    struct Channel* results;
-} Request;
-
-typedef struct Match {
-    char* playerPort;
-    char* opponentPort;
-    int id;
-    char* opponentName;
-    char* playerName;
-    FILE* stream;
-    struct Channel* results;
-} Match;
+// The number of elements a lock-free channel can hold
+#define CHANNEL_CAPACITY 1024
+// The most requests the batch matchmaker drains at once
+#define MATCH_BATCH_SIZE 4096
+// How long (ms) a match session waits on a player's RESULT or MOVE before
+// they forfeit, so a stalled client cannot hold a worker forever
+#define SESSION_READ_TIMEOUT 10000
 
 /**
- * Represents a client connected to the server
+ * The thread which prints reports when signalled
  *
- * stream (FILE*): the input stream
- * id (pthread_t): the thread we want a MR from
- * requests (struct Channel*): points to the requests queue
+ * id (pthread_t): the reporter thread
+ * signalFd (int): the signalfd the report signals arrive on
+ * info (ServerInfo*): the server to report on
+ * snapshot (Snapshot): the standings being reported, copied out under the
+ * standings lock so they are formatted without holding it, and reused for
+ * every report
+ * global (Snapshot): the standings of every node of the federation, when
+ * there is one
  *
  */
-typedef struct Client {
-    FILE* stream;
-    struct Channel* requests;
+typedef struct Reporter {
     pthread_t id;
-    Request request;
-} Client;
+    int signalFd;
+    ServerInfo* info;
+    Snapshot snapshot;
+    Snapshot global;
+} Reporter;
 
 /**
- * The information related to a server
+ * Both sides of a match, run together on a pool worker
  *
- * players (Player*): the players and their results (to be printed on SIGHUP)
- * requests (struct Channel): the match requests queued
- * results (struct Channel): the results queued
- * clients (Client*): the clients connected to this server
- * numClients (int): the number of clients connected
- * socketFd (int): the fd of this servers socket
+ * players (Match[2]): the match from the perspective of each player
+ * pool (SlabPool*): the slab this session goes back to once it is over
+ * referee (Referee): the referee, if the match is refereed
  *
  */
-typedef struct ServerInfo {
-    Player* players;
-    struct Channel requests;
-    struct Channel results;
-    Client** clients;
-    int numClients;
-    int socketFd;
-} ServerInfo;
+typedef struct MatchSession {
+    Match players[2];
+    SlabPool* pool;
+    Referee referee;
+} MatchSession;
+
+/** Exit codes defined on spec */
+typedef enum ServerError {
+    INCORRECT_ARG_COUNT = 1
+} ServerError;
 
 /**
  * Exit from the server
@@ -89,11 +84,43 @@ typedef struct ServerInfo {
 void exit_server(ServerError err) {
     switch (err) {
         case INCORRECT_ARG_COUNT:
-            fprintf(stderr, "Usage: rpsserver\n");
+            fprintf(stderr, "Usage: rpsserver [-a acceptors] [-c] "
+                    "[-r reactorthreads] [-l] "
+                    "[-q requestlimit] [-t timeoutms] [-b] "
+                    "[-p workers[:maxworkers]] [-e] [-s] "
+                    "[-m metricsport] [-j journaldir] "
+                    "[-x exportfile] [-f federationport] "
+                    "[-n host:port]...\n");
     }
     exit(err);
 }
 
+/**
+ * Create a socket and bind it to an address
+ *
+ * address (struct sockaddr*): the address
+ * length (socklen_t): the length of the address
+ * reusePort (bool): whether other sockets may bind the same port, so that
+ * the kernel spreads connections across them
+ *
+ * Returns the socket, or -1 if it could not be bound
+ *
+ */
+static int bind_socket(struct sockaddr* address, socklen_t length,
+        bool reusePort) {
+    int fd = socket(address->sa_family, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int on = 1;
+    if ((reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on,
+            sizeof(on))) || bind(fd, address, length)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
 /**
  * Create and initialise a server with a struct
  *
@@ -120,21 +147,50 @@ int create_server(ServerInfo* info) {
         return 1;
     }
 
-    // get the socket descriptor
-    int serv = socket(ai->ai_family, ai->ai_socktype, 0);
-    info->socketFd = serv;
-    info->requests = new_channel(sizeof(Request));
-    info->results = new_channel(sizeof(Result)); 
-    info->numClients = 0;
-    info->clients = malloc(info->numClients);
+    if (info->lockFree) {
+        info->requests = new_ring_channel(sizeof(Request), CHANNEL_CAPACITY);
+    } else {
+        info->requests = new_channel(sizeof(Request));
+    }
+    init_standings(&info->results.standings);
+    info->results.journal = NULL;
+    if (info->journalDir != NULL) {
+        info->results.journal = open_journal(info->journalDir,
+                &info->results.standings);
+        if (info->results.journal == NULL) {
+            freeaddrinfo(ai);
+            perror("Journal");
+            return 8;
+        }
+    }
+    info->results.exportLog = NULL;
+    if (info->exportPath != NULL) {
+        info->results.exportLog = malloc(sizeof(ExportLog));
+        if (info->results.exportLog == NULL
+                || !init_export(info->results.exportLog, info->exportPath)) {
+            freeaddrinfo(ai);
+            perror("Export");
+            return 11;
+        }
+    }
+    init_latencies(&info->latencies);
+    set_channel_limit(&info->requests, info->requestLimit,
+            info->requestTimeout > 0 ? WRITE_TIMED : WRITE_BLOCKING,
+            info->requestTimeout);
+    init_slab_pool(&info->matchSlab, sizeof(Match));
+    init_slab_pool(&info->sessionSlab, sizeof(MatchSession));
+    init_slab_pool(&info->refereeSlab, sizeof(Referee));
 
-    // bind the socket to the port from the getaddrinfo
-    if (bind(serv, (struct sockaddr*)ai->ai_addr, sizeof(struct sockaddr))) {
-        freeaddrinfo(ai);
+    // bind the first socket to the port from the getaddrinfo
+    bool sharded = info->acceptorThreads > 1;
+    info->acceptors = calloc(info->acceptorThreads, sizeof(Acceptor));
+    int serv = bind_socket(ai->ai_addr, ai->ai_addrlen, sharded);
+    freeaddrinfo(ai);
+    if (serv == -1) {
         perror("Binding");
         return 3;
     }
-    freeaddrinfo(ai);
+    info->socketFd = serv;
 
     struct sockaddr_in ad;
     memset(&ad, 0, sizeof(struct sockaddr_in));
@@ -143,71 +199,142 @@ int create_server(ServerInfo* info) {
         perror("sockname");
         return 4;
     }
+
+    // then every other acceptor's to the port the first was given
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < info->acceptorThreads; i++) {
+        Acceptor* acceptor = &info->acceptors[i];
+        acceptor->socketFd = i == 0 ? serv
+                : bind_socket((struct sockaddr*) &ad, len, true);
+        if (acceptor->socketFd == -1) {
+            perror("Binding");
+            return 3;
+        }
+        acceptor->cpu = info->pinAcceptors && cpus > 0 ? i % cpus : -1;
+        acceptor->info = info;
+        init_slab_pool(&acceptor->clientSlab, sizeof(Client));
+    }
     printf("%u\n", ntohs(ad.sin_port));
     fflush(stdout);
 
-    if (listen(serv, BACKLOG)) {
-        return -1;
+    for (int i = 0; i < info->acceptorThreads; i++) {
+        if (listen(info->acceptors[i].socketFd, BACKLOG)) {
+            return -1;
+        }
     }
 
     return 0;
 }
 
+/**
+ * Read frames up to and including a MR, answering any HELLO and remembering
+ * any names on the way
+ *
+ * client (Client*): the client to read from and store data in
+ *
+ * Returns true if a valid MR was read
+ *
+ */
+bool read_match_frame(Client* client) {
+    Message message;
+    while (scan_message(&client->scanner, &message)) {
+        switch (message.type) {
+            case MESSAGE_HELLO:
+                client->features = negotiate_features(client->offered,
+                        message.value) | FEATURE_BINARY;
+                message.value = client->features;
+                write_message(client->stream, &message);
+                fflush(client->stream);
+                break;
+            case MESSAGE_NAME:
+                if (!learn_name(&client->names, message.id, message.name)) {
+                    count_event(COUNTER_PARSE_ERRORS);
+                    return false;
+                }
+                break;
+            case MESSAGE_MR:
+                if (!parse_match_frame(&message, &client->names,
+                        &client->request.player, client->request.port)) {
+                    count_event(COUNTER_PARSE_ERRORS);
+                    return false;
+                }
+                return true;
+            default:
+                count_event(COUNTER_PARSE_ERRORS);
+                return false;
+        }
+    }
+    return false;
+}
+
 /**
  * Read and parse a MR and keep the relevant data
  *
- * stream (FILE*): the stream to read from
- * client (Client*): the client to store data in
+ * client (Client*): the client to read from and store data in
  *
  * Returns true if the message was valid
  *
  */
-bool read_match_message(FILE* stream, Client* client) {
-    char* line = read_line(stream);
-    int location = 0;
-    int count = 0;
+bool read_match_message(Client* client) {
+    if (!(client->features & FEATURE_BINARY)
+            && scan_magic(&client->scanner)) {
+        client->features = FEATURE_BINARY;
+    }
+    if (client->features & FEATURE_BINARY) {
+        return read_match_frame(client);
+    }
 
-    if (!check_tag("MR:", line)) {
+    Slice line;
+    Fields fields;
+    if (!scan_line(&client->scanner, &line)) {
         return false;
     }
-    location += strlen("MR:");
-
-    char* name = malloc(0);
-    int nameLength = 0;
-
-    char* port = malloc(0);
-    int portLength = 0;
-    while (line[location] != '\0') {
-        if (line[location] == ':') {
-            location++;
-            count++;
-            continue;
-        }
+    split_line(line.start, line.length, &fields);
 
-        if (count == 0) {
-            name = realloc(name, sizeof(char) * ++nameLength);
-            name[nameLength - 1] = line[location++];
-        } else if (count == 1) {
-            port = realloc(port, sizeof(char) * ++portLength);
-            port[portLength - 1] = line[location++];
-        } else {
+    int features = parse_hello(&fields);
+    if (features != -1) {
+        // agree to what we can, then expect the MR
+        char hello[MAX_HELLO_LENGTH];
+        client->features = negotiate_features(client->offered, features);
+        format_hello(hello, client->features);
+        fputs(hello, client->stream);
+        fflush(client->stream);
+        if (!scan_line(&client->scanner, &line)) {
             return false;
         }
+        split_line(line.start, line.length, &fields);
     }
-    free(line);
 
-    name = realloc(name, nameLength + 1);
-    name[nameLength] = '\0';
-    port = realloc(port, portLength + 1);
-    port[portLength] = '\0';
- 
-    client->request.name = strdup(name);
-    client->request.port = strdup(port);
-    free(name);
-    free(port);
+    Slice name, port;
+    if (!parse_match_request(&fields, &name, &port)) {
+        count_event(COUNTER_PARSE_ERRORS);
+        return false;
+    }
+    // the fields are terminated in place, so the name is already a string
+    client->request.player = intern_player(name.start);
+    if (client->request.player == NO_PLAYER) {
+        return false;
+    }
+    memcpy(client->request.port, port.start, port.length);
+    client->request.port[port.length] = '\0';
     return true;
 }
 
+/**
+ * Hang up on a client and give it back to its acceptor's clientSlab, keeping
+ * its scanner's buffer for the next client
+ *
+ * client (Client*): the client
+ *
+ */
+void close_client(Client* client) {
+    count_event(COUNTER_CONNECTIONS_CLOSED);
+    fclose(client->stream);
+    reset_names(&client->names);
+    reset_names(&client->sentNames);
+    release_slab_record(client->slab, client);
+}
+
 /**
  * Wait for a match request from a client
  *
@@ -219,105 +346,605 @@ bool read_match_message(FILE* stream, Client* client) {
  */
 void* wait_for_request(void* clientArg) {
     Client* client = (Client*) clientArg;
-    if (!(read_match_message(client->stream, client))) {
-        fclose(client->stream);
+    if (!(read_match_message(client))) {
+        close_client(client);
     } else {
-        Request* current = malloc(sizeof(Request));
-        current->name = strdup(client->request.name);
-        current->port = strdup(client->request.port);
-        current->stream = client->stream;
-        current->results = client->request.results;
-        write_channel(client->requests, (void*) current);
+        Latencies* latencies = client->request.latencies;
+        Timeline* timeline = &client->request.timeline;
+        timeline->parsed = monotonic_nanos();
+        record_stage(latencies, STAGE_REQUEST, timeline->accepted,
+                timeline->parsed);
+
+        // the channel copies the request, so it can live on our stack
+        timeline->enqueued = monotonic_nanos();
+        Request current = client->request;
+        current.stream = client->stream;
+        current.client = client;
+        current.conn = NULL;
+        current.features = client->features;
+        if (!write_channel(client->requests, (void*) &current)) {
+            // the matchmaker is too far behind, turn the client away
+            count_event(COUNTER_DROPPED_WRITES);
+            close_client(client);
+        } else {
+            record_stage(latencies, STAGE_ENQUEUE, timeline->parsed,
+                    monotonic_nanos());
+        }
     }
     return NULL;
 }
 
 /**
- * Add a result to the results queue
+ * Run a routine on a new detached thread
+ *
+ * routine (void* (*)(void*)): the routine
+ * arg (void*): its argument
+ *
+ * Returns false if no more threads can be started
+ *
+ */
+static bool start_detached(void* (*routine)(void*), void* arg) {
+    pthread_t id;
+    if (pthread_create(&id, NULL, routine, arg)) {
+        return false;
+    }
+    pthread_detach(id);
+    return true;
+}
+
+/**
+ * Once a session client has reported its result, wait for its next MR on a
+ * new thread. Clients without sessions are hung up on.
+ *
+ * match (Match*): the match the client just finished
+ *
+ */
+void end_match(Match* match) {
+    Client* client = match->client;
+    if (!(match->features & FEATURE_SESSION)) {
+        close_client(client);
+        return;
+    }
+
+    // the wait for the next MR starts now
+    client->request.timeline.accepted = monotonic_nanos();
+    // the id is not kept, as the client may be recycled before it is stored
+    if (!start_detached(wait_for_request, (void*) client)) {
+        close_client(client);
+    }
+}
+
+/**
+ * Add a result to the standings, the journal and export (if any). The result
+ * is tallied by the calling thread and merged within TALLY_MERGE_INTERVAL,
+ * so no lock is shared with other threads recording results.
  *
- * results (struct Channel*): the results queue
- * player (char*): the player to add
+ * results (Results*): where the result goes
+ * match (int): the id of the match
+ * player (PlayerId): the player the result is for
+ * opponent (PlayerId): the opponent, NO_PLAYER if unknown
  * results (GameResult): the result to add
  *
  */
-void add_result(struct Channel* results, char* player, GameResult result) {
-    Result* newResult = malloc(sizeof(Result));
-    newResult->player = player;
-    newResult->result = result;
-    write_channel(results, (void*) newResult);
+void add_result(Results* results, int match, PlayerId player,
+        PlayerId opponent, GameResult result) {
+    count_event(COUNTER_RESULTS);
+    tally_result(results, match, player, opponent, result);
 }
 
 /**
- * Read a RESULT message from the client
+ * Read a RESULT message from the player in a match
+ *
+ * match (Match*): the match, from the perspective of the player
  *
- * stream (FILE*): the input stream
- * results (struct Channel*): the results queue
- * player (char*): the player
+ * Returns false if the player went away without a RESULT
  *
  */
-void read_result_message(FILE* stream, struct Channel* results, char* player) {
-    char* line = read_line(stream);
-    int count = 0;
-    int location = sizeof("RESULT:");
+bool read_result_message(Match* match) {
+    Scanner* scanner = &match->client->scanner;
+    GameResult result;
+    if (match->features & FEATURE_BINARY) {
+        Message message;
+        if (!scan_message(scanner, &message)) {
+            return false;
+        }
+        if (message.type != MESSAGE_RESULT) {
+            count_event(COUNTER_PARSE_ERRORS);
+        }
+        result = parse_result_frame(&message);
+    } else {
+        Slice line;
+        Fields fields;
+        if (!scan_line(scanner, &line)) {
+            return false;
+        }
+        split_line(line.start, line.length, &fields);
+        if (fields.tag != TAG_RESULT) {
+            count_event(COUNTER_PARSE_ERRORS);
+        }
+        result = parse_result_message(&fields, player_name(match->player));
+    }
+    record_result_latency(match->latencies, &match->timeline,
+            monotonic_nanos());
+    add_result(match->results, match->id, match->player, match->opponent,
+            result);
+    return true;
+}
 
-    int resultLength = 0;
-    char* result = malloc(0);
-    while (line[location] != '\0') {
-        if (line[location] == ':') {
-            count++;
-            location++;
-            continue;
+/**
+ * Send a player the MATCH line for their match. A thread already waiting for
+ * the player's RESULT may be done with the match as soon as it is sent, so
+ * the match is not touched once the line is flushed.
+ *
+ * match (Match*): the match from the perspective of the player
+ *
+ */
+void send_match(Match* match) {
+    match->timeline.matched = monotonic_nanos();
+    record_stage(match->latencies, STAGE_MATCH, match->timeline.paired,
+            match->timeline.matched);
+
+    FILE* stream = match->stream;
+    if (match->features & FEATURE_BINARY) {
+        unsigned char buffer[2 * MAX_FRAME_LENGTH];
+        fwrite(buffer, 1, encode_match(buffer, match,
+                &match->client->sentNames), stream);
+    } else {
+        char* message;
+        if (format_match(&message, match) == -1) {
+            return;
+        }
+        fputs(message, stream);
+        free(message);
+    }
+    fflush(stream);
+}
+
+/**
+ * Wait for the RESULT of a player who has been sent their MATCH, on the
+ * player's own thread.
+ *
+ * matchArg (void*): the match, from the matchSlab
+ *
+ * Returns NULL
+ *
+ */
+void* wait_for_result(void* matchArg) {
+    Match* match = (Match*) matchArg;
+    // the client may be gone once the match is over
+    SlabPool* slab = &match->client->info->matchSlab;
+
+    read_result_message(match);
+    end_match(match);
+    release_slab_record(slab, match);
+    return NULL;
+}
+
+/**
+ * Read a MOVE from a player in a refereed match
+ *
+ * match (Match*): the match, from the perspective of the player
+ * move (MoveType*): set to the move
+ *
+ * Returns false if the player went away or sent anything else
+ *
+ */
+bool read_move_message(Match* match, MoveType* move) {
+    Scanner* scanner = &match->client->scanner;
+    bool valid;
+    if (match->features & FEATURE_BINARY) {
+        Message message;
+        if (!scan_message(scanner, &message)) {
+            return false;
+        }
+        valid = parse_move_frame(&message, move);
+    } else {
+        Slice line;
+        Fields fields;
+        if (!scan_line(scanner, &line)) {
+            return false;
+        }
+        split_line(line.start, line.length, &fields);
+        valid = parse_move_message(&fields, move);
+    }
+    if (!valid) {
+        count_event(COUNTER_PARSE_ERRORS);
+    }
+    return valid;
+}
+
+/**
+ * Send both players what the referee made of a round
+ *
+ * session (MatchSession*): the match
+ * calls (Calls*): the messages for each player, which are freed
+ *
+ */
+void send_calls(MatchSession* session, Calls* calls) {
+    for (int seat = 0; seat < 2; seat++) {
+        if (calls->message[seat] != NULL) {
+            FILE* stream = session->players[seat].stream;
+            fwrite(calls->message[seat], 1, calls->length[seat], stream);
+            fflush(stream);
         }
+    }
+    free_calls(calls);
+}
 
-        if (count == 1) {
-            result = realloc(result, ++resultLength * sizeof(char));
-            result[resultLength - 1] = line[location];
+/**
+ * Referee a match, telling both players about it and then judging each round
+ * as their moves arrive. Both moves of a round are read before it is judged,
+ * so a player who goes away forfeits without leaving the opponent's move
+ * unread.
+ *
+ * session (MatchSession*): the match
+ *
+ */
+void referee_session(MatchSession* session) {
+    Referee* referee = &session->referee;
+    init_referee(referee, &session->players[0]);
+    for (int seat = 0; seat < 2; seat++) {
+        send_match(&session->players[seat]);
+    }
+
+    Call call = CALL_WAIT;
+    while (call != CALL_OVER) {
+        MoveType moves[2];
+        bool moved[2];
+        for (int seat = 0; seat < 2; seat++) {
+            moved[seat] = read_move_message(&session->players[seat],
+                    &moves[seat]);
+        }
+
+        Calls calls = {{NULL}};
+        if (moved[0] && moved[1]) {
+            referee_move(referee, 0, moves[0], &calls);
+            call = referee_move(referee, 1, moves[1], &calls);
+        } else {
+            referee_forfeit(referee, moved[0] ? 1 : 0, &calls);
+            call = CALL_OVER;
         }
-        location++;
+        send_calls(session, &calls);
+    }
+    unsigned long over = monotonic_nanos();
+    for (int seat = 0; seat < 2; seat++) {
+        Match* match = &session->players[seat];
+        record_result_latency(match->latencies, &match->timeline, over);
+    }
+    destroy_referee(referee);
+}
+
+/**
+ * Set how long reads from a player may block before they fail with EAGAIN
+ *
+ * match (Match*): the match, from the perspective of the player
+ * millis (int): the timeout, 0 for none
+ *
+ */
+static void set_read_timeout(Match* match, int millis) {
+    struct timeval timeout = {.tv_sec = millis / 1000,
+            .tv_usec = (millis % 1000) * 1000};
+    setsockopt(match->client->scanner.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+            sizeof(timeout));
+}
+
+/**
+ * Run both sides of a match on one thread, telling both players about the
+ * match and then waiting for both of their RESULTs, or refereeing it if both
+ * players agreed to that. A player who sends nothing for
+ * SESSION_READ_TIMEOUT forfeits and is hung up on.
+ *
+ * sessionArg (void*): the MatchSession, which goes back to its pool after
+ *
+ */
+void run_session(void* sessionArg) {
+    MatchSession* session = (MatchSession*) sessionArg;
+    Match* first = &session->players[0];
+    for (int i = 0; i < 2; i++) {
+        set_read_timeout(&session->players[i], SESSION_READ_TIMEOUT);
     }
-    result[resultLength] = '\0';
-    if (!strcmp("TIE", result)) {
-        add_result(results, player, TIE);
-    } else if (!strcmp(player, result)) {
-        add_result(results, player, WIN);
+
+    if (first->features & first->opponentFeatures & FEATURE_REFEREE) {
+        // the referee already forfeits a player whose MOVE times out
+        referee_session(session);
     } else {
-        add_result(results, player, LOSE);
+        for (int i = 0; i < 2; i++) {
+            send_match(&session->players[i]);
+        }
+        for (int i = 0; i < 2; i++) {
+            Match* match = &session->players[i];
+            errno = 0;
+            if (!read_result_message(match)
+                    && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                add_result(match->results, match->id, match->player,
+                        match->opponent, LOSE);
+                // hang up rather than wait on them for another MR
+                match->features &= ~FEATURE_SESSION;
+            }
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        // the wait for the next MR has no deadline
+        set_read_timeout(&session->players[i], 0);
+        end_match(&session->players[i]);
     }
 
-    free(result);
-    free(line);
+    release_slab_record(session->pool, session);
 }
 
 /**
- * Start a new match on a new thread. From the perspective
- * of a single agent, waits for a RESULT.
+ * Run a match session on its own thread
  *
- * matchArg (void*): the match
+ * sessionArg (void*): the MatchSession, from the sessionSlab
  *
  * Returns NULL
  *
  */
-void* new_match(void* matchArg) {
-    Match* match = (Match*) matchArg;
-    
-    fprintf(match->stream, "MATCH:%d:%s:%s\n", match->id, match->opponentName,
-            match->opponentPort);
-    fflush(match->stream);
-    read_result_message(match->stream, match->results, match->playerName);
-    fclose(match->stream);
+void* session_thread(void* sessionArg) {
+    run_session(sessionArg);
     return NULL;
 }
 
+/**
+ * Start a thread to wait for a player's RESULT, before the player is sent
+ * their MATCH, so that a player no thread can be started for is never told
+ * about a match nobody will wait on
+ *
+ * info (ServerInfo*): the server
+ * match (Match*): the match, from the perspective of the player
+ *
+ * Returns the thread's own copy of the match, to send the MATCH from, or
+ * NULL if no thread could be started
+ *
+ */
+static Match* start_waiting(ServerInfo* info, Match* match) {
+    Match* copy = slab_record(&info->matchSlab);
+    *copy = *match;
+    if (!start_detached(wait_for_result, (void*) copy)) {
+        release_slab_record(&info->matchSlab, copy);
+        return NULL;
+    }
+    return copy;
+}
+
+/**
+ * Start one side of a match whose other side is played on another node. A
+ * reactor client is told about the match and left to the reactor, otherwise
+ * a new thread waits for their RESULT, even with a worker pool, as a session
+ * needs both players. A player no thread can be started for is hung up on.
+ *
+ * info (ServerInfo*): the server
+ * request (Request*): the player's request
+ * match (Match*): the match, from the perspective of the player
+ *
+ */
+void start_player(ServerInfo* info, Request* request, Match* match) {
+    if (request->conn != NULL) {
+        reactor_send_match(request->conn, match);
+        return;
+    }
+    Match* waiting = start_waiting(info, match);
+    if (waiting == NULL) {
+        close_client(match->client);
+        return;
+    }
+    send_match(waiting);
+}
+
+/**
+ * Start a match between two requests, either of which may be from another
+ * node, which is told about the match instead. Reactor clients are told
+ * about the match and left to the reactor, the match is queued on the worker
+ * pool if there is one, otherwise a new thread waits for each player's RESULT
+ * (or one thread referees the match) and both are sent their MATCH from here.
+ * If a thread cannot be started, both players are hung up on instead.
+ *
+ * info (ServerInfo*): the server
+ * requestOne (Request*): the first player
+ * requestTwo (Request*): the second player
+ * match (int): the id of the match
+ *
+ */
+void start_match(ServerInfo* info, Request* requestOne, Request* requestTwo,
+        int match) {
+    Match matchOne = {.player = requestOne->player,
+            .opponent = requestTwo->player, .id = match,
+            .stream = requestOne->stream, .client = requestOne->client,
+            .results = requestOne->results,
+            .features = requestOne->features,
+            .opponentFeatures = requestTwo->features,
+            .latencies = &info->latencies, .timeline = requestOne->timeline};
+    Match matchTwo = {.player = requestTwo->player,
+            .opponent = requestOne->player, .id = match,
+            .stream = requestTwo->stream, .client = requestTwo->client,
+            .results = requestTwo->results,
+            .features = requestTwo->features,
+            .opponentFeatures = requestOne->features, .seat = 1,
+            .latencies = &info->latencies, .timeline = requestTwo->timeline};
+    memcpy(matchOne.playerPort, requestOne->port, MAX_PORT_LENGTH);
+    memcpy(matchOne.opponentPort, requestTwo->port, MAX_PORT_LENGTH);
+    memcpy(matchTwo.playerPort, requestTwo->port, MAX_PORT_LENGTH);
+    memcpy(matchTwo.opponentPort, requestOne->port, MAX_PORT_LENGTH);
+    bool refereed = requestOne->features & requestTwo->features
+            & FEATURE_REFEREE;
+    count_event(COUNTER_MATCHES_STARTED);
+    matchOne.timeline.paired = matchTwo.timeline.paired = monotonic_nanos();
+
+    if (requestOne->peer != NULL || requestTwo->peer != NULL) {
+        Request* requests[2] = {requestOne, requestTwo};
+        Match* matches[2] = {&matchOne, &matchTwo};
+        start_remote_match(info->federation, requests, matches);
+        return;
+    }
+
+    record_stage(&info->latencies, STAGE_PAIR, matchOne.timeline.enqueued,
+            matchOne.timeline.paired);
+    record_stage(&info->latencies, STAGE_PAIR, matchTwo.timeline.enqueued,
+            matchTwo.timeline.paired);
+
+    if (requestOne->conn != NULL) {
+        if (refereed) {
+            // shared by both connections, which each hold a reference
+            Referee* referee = slab_record(&info->refereeSlab);
+            init_referee(referee, &matchOne);
+            referee->refs = 2;
+            referee->conns[0] = requestOne->conn;
+            referee->conns[1] = requestTwo->conn;
+            matchOne.referee = matchTwo.referee = referee;
+        }
+        // reactor connections are driven by the reactor threads, so we
+        // only need to tell both players about the match
+        reactor_send_match(requestOne->conn, &matchOne);
+        reactor_send_match(requestTwo->conn, &matchTwo);
+        return;
+    }
+
+    if (info->maxWorkers > 0) {
+        MatchSession* session = slab_record(&info->sessionSlab);
+        session->players[0] = matchOne;
+        session->players[1] = matchTwo;
+        session->pool = &info->sessionSlab;
+        submit_task(&info->pool, run_session, (void*) session);
+        return;
+    }
+
+    if (refereed) {
+        MatchSession* session = slab_record(&info->sessionSlab);
+        session->players[0] = matchOne;
+        session->players[1] = matchTwo;
+        session->pool = &info->sessionSlab;
+        if (!start_detached(session_thread, (void*) session)) {
+            close_client(matchOne.client);
+            close_client(matchTwo.client);
+            release_slab_record(&info->sessionSlab, session);
+        }
+        return;
+    }
+
+    // both threads are started before either player hears of the match, so
+    // if one cannot be, neither player is left waiting on the other
+    Match* waiting[2] = {start_waiting(info, &matchOne), NULL};
+    if (waiting[0] != NULL) {
+        waiting[1] = start_waiting(info, &matchTwo);
+    }
+    if (waiting[1] == NULL) {
+        if (waiting[0] != NULL) {
+            // its thread hangs up once its read fails
+            shutdown(matchOne.client->scanner.fd, SHUT_RDWR);
+        } else {
+            close_client(matchOne.client);
+        }
+        close_client(matchTwo.client);
+        return;
+    }
+    send_match(waiting[0]);
+    send_match(waiting[1]);
+}
+
+/**
+ * Pair up requests in batches, draining every pending request from the
+ * channel at once and starting all of their matches, which sends each of
+ * their MATCHes from this thread, before draining again. An odd request out
+ * waits for the next batch.
+ *
+ * info (ServerInfo*): the server
+ *
+ */
+void match_batches(ServerInfo* info) {
+    Request* batch = malloc(sizeof(Request) * MATCH_BATCH_SIZE);
+    MatchmakerStats* stats = &info->matchStats;
+    size_t waiting = 0;
+    int match = 1;
+    struct timespec start, end;
+
+    while (1) {
+        size_t count;
+        if (waiting == 1 && info->federation != NULL) {
+            // the odd request out goes to another node if nobody turns up
+            if (!read_channel_timed(&info->requests, (void**) &batch[1],
+                    FEDERATION_OFFER_WAIT)) {
+                if (offer_request(info->federation, &batch[0])) {
+                    waiting = 0;
+                }
+                continue;
+            }
+            count = 1;
+        } else {
+            count = drain_channel(&info->requests, batch + waiting,
+                    MATCH_BATCH_SIZE - waiting);
+        }
+        if (count == 0) {
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        waiting += count;
+        for (size_t i = 0; i + 1 < waiting; i += 2) {
+            start_match(info, &batch[i], &batch[i + 1], match++);
+        }
+        if (waiting % 2 == 1) {
+            batch[0] = batch[waiting - 1];
+        }
+        waiting %= 2;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        unsigned long nanos = (end.tv_sec - start.tv_sec) * 1000000000UL
+                + end.tv_nsec - start.tv_nsec;
+        __atomic_add_fetch(&stats->batches, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->requests, count, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->totalNanos, nanos, __ATOMIC_RELAXED);
+        if (count > stats->largestBatch) {
+            __atomic_store_n(&stats->largestBatch, count, __ATOMIC_RELAXED);
+        }
+        if (nanos > stats->largestNanos) {
+            __atomic_store_n(&stats->largestNanos, nanos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * Wait for an opponent for a request. In a federation, a request left
+ * waiting for FEDERATION_OFFER_WAIT is offered to another node instead.
+ *
+ * info (ServerInfo*): the server
+ * waiting (Request*): the request waiting for an opponent
+ * opponent (Request*): set to the opponent
+ *
+ * Returns false if the request was offered to another node
+ *
+ */
+static bool read_opponent(ServerInfo* info, Request* waiting,
+        Request* opponent) {
+    while (1) {
+        if (info->federation == NULL) {
+            if (read_channel(&info->requests, (void**) opponent)) {
+                return true;
+            }
+        } else if (read_channel_timed(&info->requests, (void**) opponent,
+                FEDERATION_OFFER_WAIT)) {
+            return true;
+        } else if (offer_request(info->federation, waiting)) {
+            return false;
+        }
+    }
+}
+
 /**
  * Read from the channel and pair up clients as appropriate (on a new thread)
  *
- * args (void*): will be cast to a Channel*
+ * args (void*): will be cast to a ServerInfo*
  *
  * Returns NULL
  *
  */
 void* match_clients(void* args) {
-    struct Channel* requests = (struct Channel*) args;
+    ServerInfo* info = (ServerInfo*) args;
+    struct Channel* requests = &info->requests;
+    if (info->ratingMatching) {
+        match_by_rating(info);
+    } else if (info->batchMatching) {
+        match_batches(info);
+    }
 
     Request requestOne, requestTwo;
     int match = 1;
@@ -327,28 +954,11 @@ void* match_clients(void* args) {
                 break;
             }
         }
-        while (1) {
-            if (read_channel(requests, (void**) &requestTwo)) {
-                break;
-            }
+        if (!read_opponent(info, &requestOne, &requestTwo)) {
+            continue;
         }
-        
-        Match matchOne = {.playerPort = requestOne.port, 
-                .opponentPort = requestTwo.port, 
-                .playerName = requestOne.name,
-                .opponentName = requestTwo.name, .id = match,
-                .stream = requestOne.stream, 
-                .results = requestOne.results}; 
-        Match matchTwo = {.playerPort = requestTwo.port,
-                .opponentPort = requestOne.port,
-                .playerName = requestTwo.name,
-                .opponentName = requestOne.name, .id = match,
-                .stream = requestTwo.stream,
-                .results = requestTwo.results};
-
-        pthread_t playerOne, playerTwo;
-        pthread_create(&playerOne, NULL, new_match, (void*) &matchOne);
-        pthread_create(&playerTwo, NULL, new_match, (void*) &matchTwo);
+
+        start_match(info, &requestOne, &requestTwo, match);
         match++;
     }
 
@@ -356,63 +966,433 @@ void* match_clients(void* args) {
 }
 
 /**
- * Begin accepting connections that a listen()ed to in the main thread.
- * This function will create a new thread for every accept()ed client
- * and listen for a MR.
+ * Print the server's own counters, and the latency of each stage of a match
+ * request
  *
- * info (ServerInfo*): the info of this server
+ * info (ServerInfo*): the server
+ * stream (FILE*): where to print them
  *
  */
-void take_connections(ServerInfo* info) {
+void print_server_stats(ServerInfo* info, FILE* stream) {
+    MatchmakerStats* stats = &info->matchStats;
+    unsigned long batches = __atomic_load_n(&stats->batches, __ATOMIC_RELAXED);
+    unsigned long requests = __atomic_load_n(&stats->requests,
+            __ATOMIC_RELAXED);
+    unsigned long nanos = __atomic_load_n(&stats->totalNanos,
+            __ATOMIC_RELAXED);
+
+    fprintf(stream, "matchmaker batches %lu\n", batches);
+    fprintf(stream, "matchmaker requests %lu\n", requests);
+    fprintf(stream, "matchmaker mean_batch %.2f\n",
+            batches == 0 ? 0.0 : (double) requests / batches);
+    fprintf(stream, "matchmaker largest_batch %lu\n",
+            __atomic_load_n(&stats->largestBatch, __ATOMIC_RELAXED));
+    fprintf(stream, "matchmaker mean_batch_ns %lu\n",
+            batches == 0 ? 0 : nanos / batches);
+    fprintf(stream, "matchmaker largest_batch_ns %lu\n",
+            __atomic_load_n(&stats->largestNanos, __ATOMIC_RELAXED));
+    if (info->maxWorkers > 0) {
+        print_pool_stats(&info->pool, stream);
+    }
+    if (info->reactorThreads > 0) {
+        print_slab_stats(&info->connectionSlab, "connections", stream);
+        print_slab_stats(&info->refereeSlab, "referees", stream);
+    } else {
+        for (int i = 0; i < info->acceptorThreads; i++) {
+            Acceptor* acceptor = &info->acceptors[i];
+            char name[32] = "clients";
+            if (info->acceptorThreads > 1) {
+                snprintf(name, sizeof(name), "clients%d", i);
+            }
+            print_slab_stats(&acceptor->clientSlab, name, stream);
+            fprintf(stream, "acceptor accepted%d %lu\n", i,
+                    __atomic_load_n(&acceptor->accepted, __ATOMIC_RELAXED));
+        }
+        print_slab_stats(&info->matchSlab, "matches", stream);
+        print_slab_stats(&info->sessionSlab, "sessions", stream);
+    }
+    print_latencies(&info->latencies, stream);
+    print_tally_stats(stream);
+    if (info->federation != NULL) {
+        print_federation_stats(info->federation, stream);
+    }
+    if (info->results.journal != NULL) {
+        print_journal_stats(info->results.journal, stream);
+    }
+    fprintf(stream, "---\n");
+    fflush(stream);
+}
+
+/**
+ * Accept clients on one acceptor's socket until the server exits, creating
+ * a new thread for every accept()ed client to listen for a MR.
+ *
+ * acceptorArg (void*): the Acceptor
+ *
+ * Returns NULL
+ *
+ */
+void* accept_clients(void* acceptorArg) {
+    Acceptor* acceptor = (Acceptor*) acceptorArg;
+    ServerInfo* info = acceptor->info;
+    if (acceptor->cpu != -1) {
+        // client threads inherit this, so each shard's clients share a CPU
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(acceptor->cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    }
+
     // we'll continue to loop and create threads as we pair up players
     // note that we never need to worry about terminating since that will
     // be handled by the SIGHUP
-    FILE* current;
     while (true) {
-        int clientFd = accept(info->socketFd, 0, 0);
-        info->numClients++;
-        info->clients = realloc(info->clients, 
-                sizeof(Client*) * info->numClients);
-        current = fdopen(clientFd, "w+");
-        info->clients[info->numClients - 1] = malloc(sizeof(Client));
-        info->clients[info->numClients - 1]->stream = current;
-        info->clients[info->numClients - 1]->requests = &info->requests;
-        info->clients[info->numClients - 1]->request.results = &info->results;
-        pthread_create(&info->clients[info->numClients - 1]->id, NULL, 
-                wait_for_request, 
-                (void*) info->clients[info->numClients - 1]);
+        int clientFd = accept(acceptor->socketFd, 0, 0);
+        if (clientFd == -1) {
+            continue; // interrupted, e.g. by a SIGHUP
+        }
+        count_event(COUNTER_CONNECTIONS_OPENED);
+        __atomic_add_fetch(&acceptor->accepted, 1, __ATOMIC_RELAXED);
+        Client* client = slab_record(&acceptor->clientSlab);
+        if (client == NULL) {
+            count_event(COUNTER_CONNECTIONS_CLOSED);
+            close(clientFd);
+            continue;
+        }
+        // a recycled client keeps its scanner's buffer and name tables
+        client->stream = fdopen(clientFd, "w");
+        setvbuf(client->stream, client->output, _IOFBF, CLIENT_OUTPUT_SIZE);
+        client->requests = &info->requests;
+        client->request.results = &info->results;
+        client->request.latencies = &info->latencies;
+        client->request.timeline = (Timeline) {.accepted = monotonic_nanos()};
+        client->features = 0;
+        client->offered = info->features;
+        client->info = info;
+        client->slab = &acceptor->clientSlab;
+        reset_scanner(&client->scanner, clientFd);
+        if (!start_detached(wait_for_request, (void*) client)) {
+            close_client(client);
+        }
     }
+    return NULL;
 }
 
 /**
- * Handles a signal hangup, prints out the game results
+ * Begin accepting connections that were listen()ed to in create_server, on
+ * a thread for each acceptor other than the first, which runs on the calling
+ * thread.
+ *
+ * info (ServerInfo*): the info of this server
  *
  */
-void handle_sighup() {
-    print_results(globalResults);
+void take_connections(ServerInfo* info) {
+    for (int i = 1; i < info->acceptorThreads; i++) {
+        pthread_create(&info->acceptors[i].id, NULL, accept_clients,
+                (void*) &info->acceptors[i]);
+    }
+    accept_clients((void*) &info->acceptors[0]);
 }
 
-int main(int argc, char** argv) {
-    if (argc != 1) {
-        exit_server(INCORRECT_ARG_COUNT);
+/**
+ * Wait for report signals and print the standings as they arrive. Reports are
+ * formatted from a snapshot, so the standings are only locked while the
+ * snapshot is copied. SIGHUP prints the standings (and asks the exporter to
+ * write the export file, if any), SIGUSR1 prints them as JSON and SIGUSR2 prints the server's
+ * own counters.
+ *
+ * reporterArg (void*): the Reporter
+ *
+ * Returns NULL
+ *
+ */
+void* report_results(void* reporterArg) {
+    Reporter* reporter = (Reporter*) reporterArg;
+    struct signalfd_siginfo signal;
+
+    while (1) {
+        ssize_t count = read(reporter->signalFd, &signal, sizeof(signal));
+        if (count != sizeof(signal)) {
+            continue;
+        }
+        if (signal.ssi_signo == SIGUSR2) {
+            print_server_stats(reporter->info, stdout);
+            continue;
+        }
+
+        // fold in every result so far, so none are missed by the report
+        merge_results(&reporter->info->results);
+        take_snapshot(&reporter->info->results.standings,
+                &reporter->snapshot);
+
+        Snapshot* report = &reporter->snapshot;
+        if (reporter->info->federation != NULL) {
+            // report the standings of every node, not just our own
+            merge_standings(reporter->info->federation, report,
+                    &reporter->global);
+            report = &reporter->global;
+        }
+        if (signal.ssi_signo == SIGUSR1) {
+            print_snapshot_json(report, stdout);
+        } else {
+            print_snapshot(report, stdout);
+            if (reporter->info->results.exportLog != NULL) {
+                request_export(reporter->info->results.exportLog);
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Route the report signals to a signalfd read by a new reporter thread. Must
+ * be called before any other threads are created, so that they all inherit
+ * the blocked signals.
+ *
+ * reporter (Reporter*): the reporter to start
+ * info (ServerInfo*): the server to report on
+ *
+ * Returns true on success
+ *
+ */
+bool start_reporter(Reporter* reporter, ServerInfo* info) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL)) {
+        return false;
+    }
+    // writes to clients that have gone away should fail, not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(reporter, 0, sizeof(Reporter));
+    reporter->info = info;
+    if ((reporter->signalFd = signalfd(-1, &signals, SFD_CLOEXEC)) == -1) {
+        return false;
+    }
+    return pthread_create(&reporter->id, NULL, report_results,
+            (void*) reporter) == 0;
+}
+
+/**
+ * Parse a strictly positive integer argument
+ *
+ * arg (char*): the argument
+ * value (int*): set to the value of the argument
+ *
+ * Returns true if the argument was a positive integer
+ *
+ */
+bool parse_positive(char* arg, int* value) {
+    char* end;
+    long parsed = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || parsed <= 0 || (int) parsed != parsed) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+/**
+ * Parse the worker pool bounds, either a fixed size or min:max
+ *
+ * arg (char*): the argument
+ * info (ServerInfo*): the server to configure
+ *
+ * Returns true if the argument was valid
+ *
+ */
+bool parse_workers(char* arg, ServerInfo* info) {
+    char* separator = strchr(arg, ':');
+    if (separator == NULL) {
+        if (!parse_positive(arg, &info->minWorkers)) {
+            return false;
+        }
+        info->maxWorkers = info->minWorkers;
+        return true;
+    }
+
+    *separator = '\0';
+    return parse_positive(arg, &info->minWorkers)
+            && parse_positive(separator + 1, &info->maxWorkers)
+            && info->maxWorkers >= info->minWorkers;
+}
+
+/**
+ * Parse the address of a node to dial, adding it to the server's peers
+ *
+ * arg (char*): the argument, host:port
+ * info (ServerInfo*): the server to configure
+ *
+ * Returns true if the argument was valid
+ *
+ */
+bool parse_peer(char* arg, ServerInfo* info) {
+    char* separator = strrchr(arg, ':');
+    int port;
+    if (separator == NULL || separator == arg
+            || !parse_positive(separator + 1, &port) || port > 65535) {
+        return false;
     }
+    info->peerAddresses = realloc(info->peerAddresses,
+            sizeof(char*) * (info->numPeerAddresses + 1));
+    info->peerAddresses[info->numPeerAddresses++] = arg;
+    return true;
+}
+
+/**
+ * Parse the optional command line arguments of the server
+ *
+ * argc (int): the number of arguments
+ * argv (char**): the arguments
+ * info (ServerInfo*): the server to configure
+ *
+ * Returns true if the arguments were valid
+ *
+ */
+bool parse_args(int argc, char** argv, ServerInfo* info) {
+    info->acceptorThreads = 1;
+    info->pinAcceptors = false;
+    info->reactorThreads = 0;
+    info->lockFree = false;
+    info->requestLimit = 0;
+    info->requestTimeout = 0;
+    info->batchMatching = false;
+    info->ratingMatching = false;
+    memset(&info->matchStats, 0, sizeof(MatchmakerStats));
+    info->minWorkers = 0;
+    info->maxWorkers = 0;
+    info->features = SERVER_FEATURES;
+    info->metricsPort = 0;
+    info->journalDir = NULL;
+    info->exportPath = NULL;
+    info->federationPort = 0;
+    info->peerAddresses = NULL;
+    info->numPeerAddresses = 0;
+    info->federation = NULL;
 
+    int opt;
+    bool valid = true;
+    while (valid && (opt = getopt(argc, argv, "a:cr:lq:t:bp:esm:j:x:f:n:")) != -1) {
+        switch (opt) {
+            case 'a':
+                valid = parse_positive(optarg, &info->acceptorThreads);
+                break;
+            case 'c':
+                info->pinAcceptors = true;
+                break;
+            case 'r':
+                valid = parse_positive(optarg, &info->reactorThreads);
+                break;
+            case 'l':
+                info->lockFree = true;
+                break;
+            case 'q':
+                valid = parse_positive(optarg, &info->requestLimit);
+                break;
+            case 't':
+                valid = parse_positive(optarg, &info->requestTimeout);
+                break;
+            case 'b':
+                info->batchMatching = true;
+                break;
+            case 'p':
+                valid = parse_workers(optarg, info);
+                break;
+            case 'e':
+                info->ratingMatching = true;
+                break;
+            case 's':
+                info->features |= FEATURE_REFEREE;
+                break;
+            case 'm':
+                valid = parse_positive(optarg, &info->metricsPort)
+                        && info->metricsPort <= 65535;
+                break;
+            case 'j':
+                info->journalDir = optarg;
+                break;
+            case 'x':
+                info->exportPath = optarg;
+                break;
+            case 'f':
+                valid = parse_positive(optarg, &info->federationPort)
+                        && info->federationPort <= 65535;
+                break;
+            case 'n':
+                valid = parse_peer(optarg, info);
+                break;
+            default:
+                return false;
+        }
+    }
+    if (!valid) {
+        return false;
+    }
+    // the reactors share one socket, so acceptors only shard thread mode
+    if (info->reactorThreads > 0 && (info->acceptorThreads > 1
+            || info->pinAcceptors)) {
+        return false;
+    }
+    return optind == argc;
+}
+
+int main(int argc, char** argv) {
     ServerInfo info;
+    if (!parse_args(argc, argv, &info)) {
+        exit_server(INCORRECT_ARG_COUNT);
+    }
 
     int err;
     if ((err = create_server(&info)) != 0) {
         return err;
     }
     
-    globalResults = &info.results;
-   
-    struct sigaction sa;
-    sa.sa_handler = handle_sighup;
-    sigaction(SIGHUP, &sa, 0);
+    Reporter reporter;
+    if (!start_reporter(&reporter, &info)) {
+        perror("Reporter");
+        return 5;
+    }
+    if (info.results.journal != NULL && !start_journal(info.results.journal)) {
+        perror("Journal");
+        return 8;
+    }
+    if (!start_merger(&info.results)) {
+        perror("Merger");
+        return 9;
+    }
+    if (info.results.exportLog != NULL
+            && !start_exporter(info.results.exportLog)) {
+        perror("Export");
+        return 11;
+    }
+    if (info.metricsPort > 0 && !start_metrics(&info, info.metricsPort)) {
+        perror("Metrics");
+        return 7;
+    }
+    if ((info.federationPort > 0 || info.numPeerAddresses > 0)
+            && (info.federation = start_federation(&info,
+            info.federationPort, info.peerAddresses,
+            info.numPeerAddresses)) == NULL) {
+        perror("Federation");
+        return 10;
+    }
+
+    if (info.maxWorkers > 0 && !start_pool(&info.pool, info.minWorkers,
+            info.maxWorkers)) {
+        perror("Worker pool");
+        return 6;
+    }
 
     pthread_t id;
-    pthread_create(&id, NULL, match_clients, (void*) &info.requests);
-    take_connections(&info);
+    pthread_create(&id, NULL, match_clients, (void*) &info);
+    if (info.reactorThreads > 0) {
+        run_reactor(&info);
+    } else {
+        take_connections(&info);
+    }
 
     return 0;
 }
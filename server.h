@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "shared.h"
+#include "pool.h"
+#include "frame.h"
+#include "arena.h"
+#include "latency.h"
+
+#ifndef SERVER_H
+#define SERVER_H
+
+struct Connection;
+struct Referee;
+struct Journal;
+struct ExportLog;
+struct ServerInfo;
+struct Peer;
+struct Federation;
+
+// The Features this server will agree to in a HELLO. FEATURE_BINARY is
+// agreed to by sending FRAME_MAGIC instead, and FEATURE_REFEREE only when
+// refereeing is turned on.
+#define SERVER_FEATURES (FEATURE_SESSION | FEATURE_READY | FEATURE_PIPELINE)
+// The longest port a MR can give, with its terminator
+#define MAX_PORT_LENGTH 6
+// The size of the buffer each thread mode client's stream writes through
+#define CLIENT_OUTPUT_SIZE 1024
+
+/**
+ * Everything the server keeps about finished matches
+ *
+ * standings (Standings): the running totals of every player
+ * journal (struct Journal*): where results are logged durably, NULL for
+ * nowhere
+ * exportLog (struct ExportLog*): every result in columns for the export
+ * file, NULL for no export
+ *
+ */
+typedef struct Results {
+    Standings standings;
+    struct Journal* journal;
+    struct ExportLog* exportLog;
+} Results;
+
+/**
+ * A match request
+ *
+ * player (PlayerId): the player
+ * port (char[]): the port they are listening on
+ * stream (FILE*): so we can send a message to this client (thread mode)
+ * client (struct Client*): the client that sent the request (thread mode)
+ * conn (struct Connection*): the reactor connection (reactor mode)
+ * results (Results*): where the result of the match goes
+ * features (int): the Features agreed with the client
+ * latencies (Latencies*): where the time spent in each stage goes
+ * timeline (Timeline): when the request reached each stage
+ * peer (struct Peer*): the link to the node the player is on, NULL for a
+ * player of our own
+ * token (unsigned long): identifies the request to the node the player is on
+ *
+ */
+typedef struct Request {
+    PlayerId player;
+    char port[MAX_PORT_LENGTH];
+    FILE* stream;
+    struct Client* client;
+    struct Connection* conn;
+    Results* results;
+    int features;
+    Latencies* latencies;
+    Timeline timeline;
+    struct Peer* peer;
+    unsigned long token;
+} Request;
+
+/**
+ * A match from the perspective of one of its players
+ *
+ * playerPort (char[]): the port the player is listening on
+ * opponentPort (char[]): the port the opponent is listening on
+ * id (int): the id of the match
+ * opponent (PlayerId): the opponent
+ * player (PlayerId): the player
+ * stream (FILE*): so we can send a message to the player (thread mode)
+ * client (struct Client*): the player's client (thread mode)
+ * results (Results*): where the result of the match goes
+ * features (int): the Features agreed with the player
+ * opponentFeatures (int): the Features agreed with the opponent
+ * referee (struct Referee*): the referee of a refereed match (reactor mode)
+ * seat (int): which player of the referee this is, 0 or 1
+ * latencies (Latencies*): where the time spent in each stage goes
+ * timeline (Timeline): when the player's request reached each stage
+ *
+ */
+typedef struct Match {
+    char playerPort[MAX_PORT_LENGTH];
+    char opponentPort[MAX_PORT_LENGTH];
+    int id;
+    PlayerId opponent;
+    PlayerId player;
+    FILE* stream;
+    struct Client* client;
+    Results* results;
+    int features;
+    int opponentFeatures;
+    struct Referee* referee;
+    int seat;
+    Latencies* latencies;
+    Timeline timeline;
+} Match;
+
+/**
+ * Represents a client connected to the server. Clients come from the
+ * clientSlab of the acceptor that took them and go back to it when they are
+ * hung up on, keeping
+ * their scanner's buffer and some of their name tables' memory for the next
+ * client.
+ *
+ * stream (FILE*): the output stream
+ * scanner (Scanner): buffers what the client sends us
+ * requests (struct Channel*): points to the requests queue
+ * features (int): the Features agreed with the client
+ * offered (int): the Features the server will agree to
+ * names (NameTable): the names the client sent us in NAME frames
+ * sentNames (NameTable): the names we sent the client in NAME frames
+ * info (struct ServerInfo*): the server the client is connected to
+ * slab (SlabPool*): the slab the client goes back to
+ * output (char[]): the buffer stream writes through
+ *
+ */
+typedef struct Client {
+    FILE* stream;
+    Scanner scanner;
+    struct Channel* requests;
+    Request request;
+    int features;
+    int offered;
+    NameTable names;
+    NameTable sentNames;
+    struct ServerInfo* info;
+    SlabPool* slab;
+    char output[CLIENT_OUTPUT_SIZE];
+} Client;
+
+/**
+ * A shard of the thread mode server: a thread accepting clients on its own
+ * listening socket. With several acceptors every socket is bound to the same
+ * port with SO_REUSEPORT, so the kernel spreads connections across them.
+ *
+ * socketFd (int): the listening socket
+ * cpu (int): the CPU the thread is pinned to, -1 for none
+ * id (pthread_t): the thread
+ * clientSlab (SlabPool): the clients this acceptor took
+ * accepted (unsigned long): the number of clients accepted
+ * info (struct ServerInfo*): the server
+ *
+ */
+typedef struct Acceptor {
+    int socketFd;
+    int cpu;
+    pthread_t id;
+    SlabPool clientSlab;
+    unsigned long accepted;
+    struct ServerInfo* info;
+} Acceptor;
+
+/**
+ * Counters kept by the batch matchmaker, written only by the matchmaker
+ *
+ * batches (unsigned long): the number of batches drained
+ * requests (unsigned long): the number of requests drained
+ * largestBatch (unsigned long): the most requests drained at once
+ * totalNanos (unsigned long): the total time spent pairing batches
+ * largestNanos (unsigned long): the longest time spent pairing a batch
+ *
+ */
+typedef struct MatchmakerStats {
+    unsigned long batches;
+    unsigned long requests;
+    unsigned long largestBatch;
+    unsigned long totalNanos;
+    unsigned long largestNanos;
+} MatchmakerStats;
+
+/**
+ * The information related to a server
+ *
+ * players (Player*): the players and their results (to be printed on SIGHUP)
+ * requests (struct Channel): the match requests queued
+ * results (Results): the results reported so far
+ * socketFd (int): the fd of this servers socket, the first acceptor's
+ * acceptorThreads (int): the number of acceptors in thread mode
+ * pinAcceptors (bool): whether each acceptor is pinned to its own CPU
+ * acceptors (Acceptor*): the acceptors
+ * reactorThreads (int): the number of reactor threads, 0 for thread mode
+ * lockFree (bool): whether the channels are backed by lock-free rings
+ * requestLimit (int): the high-water mark of the requests channel, 0 for none
+ * requestTimeout (int): how long (ms) to wait on a full requests channel
+ * before turning a client away, 0 to wait forever
+ * batchMatching (bool): whether the matchmaker pairs requests in batches
+ * ratingMatching (bool): whether the matchmaker pairs requests by rating
+ * matchStats (MatchmakerStats): the counters of the batch matchmaker
+ * minWorkers (int): the fewest session workers, 0 for a thread per player
+ * maxWorkers (int): the most session workers
+ * pool (WorkerPool): the workers running match sessions
+ * features (int): the Features the server will agree to
+ * latencies (Latencies): the time match requests spent in each stage
+ * metricsPort (int): the port metrics are served on, 0 for none
+ * metricsFd (int): the fd of the metrics listener
+ * journalDir (char*): the directory results are logged in, NULL for none
+ * exportPath (char*): the file results are exported to, NULL for none
+ * matchSlab (SlabPool): the Matches of thread per player matches
+ * sessionSlab (SlabPool): the sessions of refereed or pooled matches
+ * refereeSlab (SlabPool): the Referees of reactor matches
+ * connectionSlab (SlabPool): the reactor's connections
+ * federationPort (int): the port other nodes dial us on, 0 for none
+ * peerAddresses (char**): the "host:port" of each node to dial
+ * numPeerAddresses (int): the number of nodes to dial
+ * federation (struct Federation*): our part in a federation of servers,
+ * NULL if we are on our own
+ *
+ */
+typedef struct ServerInfo {
+    Player* players;
+    struct Channel requests;
+    Results results;
+    int socketFd;
+    int acceptorThreads;
+    bool pinAcceptors;
+    Acceptor* acceptors;
+    int reactorThreads;
+    bool lockFree;
+    int requestLimit;
+    int requestTimeout;
+    bool batchMatching;
+    bool ratingMatching;
+    MatchmakerStats matchStats;
+    int minWorkers;
+    int maxWorkers;
+    WorkerPool pool;
+    int features;
+    Latencies latencies;
+    int metricsPort;
+    int metricsFd;
+    char* journalDir;
+    char* exportPath;
+    SlabPool matchSlab;
+    SlabPool sessionSlab;
+    SlabPool refereeSlab;
+    SlabPool connectionSlab;
+    int federationPort;
+    char** peerAddresses;
+    int numPeerAddresses;
+    struct Federation* federation;
+} ServerInfo;
+
+// The server's side of the protocol, defined in protocol.c so it can be
+// linked without the rest of the server.
+int negotiate_features(int offered, int asked);
+bool parse_match_request(Fields* line, Slice* name, Slice* port);
+bool parse_match_frame(Message* message, NameTable* names, PlayerId* player,
+        char* port);
+int format_match(char** message, Match* match);
+int encode_match(unsigned char* buffer, Match* match, NameTable* sentNames);
+GameResult parse_result_message(Fields* line, char* player);
+GameResult parse_result_frame(Message* message);
+
+void add_result(Results* results, int match, PlayerId player,
+        PlayerId opponent, GameResult result);
+
+void start_match(ServerInfo* info, Request* requestOne, Request* requestTwo,
+        int match);
+void start_player(ServerInfo* info, Request* request, Match* match);
+
+#endif
@@ -4,119 +4,533 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+void init_scanner(Scanner* scanner, int fd) {
+    scanner->fd = fd;
+    scanner->buffer = NULL;
+    scanner->size = 0;
+    scanner->start = scanner->end = 0;
+}
+
+void reset_scanner(Scanner* scanner, int fd) {
+    scanner->fd = fd;
+    scanner->start = scanner->end = 0;
+}
+
+void destroy_scanner(Scanner* scanner) {
+    free(scanner->buffer);
+    init_scanner(scanner, -1);
+}
 
 /**
- * Reads a line of input from the given input stream.
+ * Read whatever is available into a scanner, waiting for at least one byte
+ * unless flags say not to. Room is made by moving unread input to the front
+ * of the buffer, or growing it if it is full of unread input.
  *
- * stream (FILE*): the file to read from
+ * scanner (Scanner*): the scanner
+ * flags (int): the flags for recv
  *
- * Returns the line of input read. If EOF is read, returns NULL instead.
+ * Returns false on EOF or an error
  *
  */
-char* read_line(FILE* stream) {
-    int bufferSize = INITIAL_BUFFER_SIZE;
-    char* buffer = malloc(sizeof(char) * bufferSize);
-    int numRead = 0;
-    int next;
+static bool fill_scanner(Scanner* scanner, int flags) {
+    if (scanner->start == scanner->end) {
+        scanner->start = scanner->end = 0;
+    } else if (scanner->end == scanner->size && scanner->start > 0) {
+        memmove(scanner->buffer, scanner->buffer + scanner->start,
+                scanner->end - scanner->start);
+        scanner->end -= scanner->start;
+        scanner->start = 0;
+    }
+    if (scanner->end == scanner->size) {
+        scanner->size = scanner->size == 0 ? SCANNER_BUFFER_SIZE
+                : scanner->size * 2;
+        scanner->buffer = realloc(scanner->buffer, scanner->size);
+    }
 
     while (1) {
-        next = fgetc(stream);
-        if (next == EOF && numRead == 0) {
-            free(buffer);
-            return NULL;
+        ssize_t count = recv(scanner->fd, scanner->buffer + scanner->end,
+                scanner->size - scanner->end, flags);
+        if (count > 0) {
+            scanner->end += count;
+            return true;
         }
-        if (numRead == bufferSize - 1) {
-            bufferSize *= 2;
-            buffer = realloc(buffer, sizeof(char) * bufferSize);
+        if (count == 0 || errno != EINTR) {
+            return false;
         }
-        if (next == '\n' || next == EOF) {
-            buffer[numRead] = '\0';
+    }
+}
+
+bool scan_line(Scanner* scanner, Slice* line) {
+    // how far past start we know there is no newline
+    size_t searched = 0;
+    while (1) {
+        char* newline = NULL;
+        if (scanner->end - scanner->start > searched) {
+            newline = memchr(scanner->buffer + scanner->start + searched,
+                    '\n', scanner->end - scanner->start - searched);
+        }
+        if (newline != NULL) {
+            *newline = '\0';
+            line->start = scanner->buffer + scanner->start;
+            line->length = newline - line->start;
+            scanner->start += line->length + 1;
+            return true;
+        }
+        searched = scanner->end - scanner->start;
+        if (!fill_scanner(scanner, 0)) {
+            return false;
+        }
+    }
+}
+
+bool scan_bytes(Scanner* scanner, size_t count, char** bytes) {
+    while (scanner->end - scanner->start < count) {
+        if (!fill_scanner(scanner, 0)) {
+            return false;
+        }
+    }
+    *bytes = scanner->buffer + scanner->start;
+    scanner->start += count;
+    return true;
+}
+
+bool read_available(Scanner* scanner) {
+    while (1) {
+        errno = 0;
+        if (!fill_scanner(scanner, MSG_DONTWAIT)) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (scanner->end < scanner->size) {
+            // a short read took everything there was
+            return true;
+        }
+    }
+}
+
+bool take_line(Scanner* scanner, Slice* line) {
+    if (scanner->start == scanner->end) {
+        return false;
+    }
+    char* newline = memchr(scanner->buffer + scanner->start, '\n',
+            scanner->end - scanner->start);
+    if (newline == NULL) {
+        return false;
+    }
+    *newline = '\0';
+    line->start = scanner->buffer + scanner->start;
+    line->length = newline - line->start;
+    scanner->start += line->length + 1;
+    return true;
+}
+
+int peek_byte(Scanner* scanner) {
+    if (scanner->start == scanner->end && !fill_scanner(scanner, 0)) {
+        return -1;
+    }
+    return (unsigned char) scanner->buffer[scanner->start];
+}
+
+/**
+ * The tag starting each kind of text line
+ */
+static const struct {
+    const char* name;
+    LineTag tag;
+} lineTags[] = {
+    {"HELLO", TAG_HELLO},
+    {"MR", TAG_MR},
+    {"MATCH", TAG_MATCH},
+    {"RESULT", TAG_RESULT},
+    {"MOVE", TAG_MOVE},
+    {"READY", TAG_READY},
+    {"BADNAME", TAG_BADNAME}
+};
+
+LineTag split_line(char* line, size_t length, Fields* fields) {
+    char* end = line + length;
+    char* colon = memchr(line, ':', length);
+    char* current = colon == NULL ? end : colon;
+
+    fields->tag = TAG_UNKNOWN;
+    fields->count = 0;
+    int numTags = sizeof(lineTags) / sizeof(lineTags[0]);
+    for (int i = 0; i < numTags; i++) {
+        if (strlen(lineTags[i].name) == current - line
+                && !memcmp(lineTags[i].name, line, current - line)) {
+            fields->tag = lineTags[i].tag;
             break;
         }
-        buffer[numRead++] = next;
     }
-    return buffer;
+
+    while (current < end) {
+        if (fields->count == MAX_LINE_FIELDS) {
+            return fields->tag = TAG_UNKNOWN;
+        }
+        *current++ = '\0';
+        colon = memchr(current, ':', end - current);
+        Slice* field = &fields->field[fields->count++];
+        field->start = current;
+        field->length = (colon == NULL ? end : colon) - current;
+        current += field->length;
+    }
+    return fields->tag;
+}
+
+/**
+ * Get a segment to add to a queue, reusing the spare segment if there is one
+ *
+ * queue (struct Queue*): the queue
+ *
+ * Returns the segment, or NULL if one could not be allocated
+ *
+ */
+static struct Segment* take_segment(struct Queue* queue) {
+    struct Segment* segment = queue->spare;
+    if (segment != NULL) {
+        queue->spare = NULL;
+    } else {
+        segment = malloc(sizeof(struct Segment)
+                + queue->elementSize * QUEUE_SEGMENT_SIZE);
+        if (segment == NULL) {
+            return NULL;
+        }
+    }
+    segment->next = NULL;
+    return segment;
+}
+
+/**
+ * Give back a drained segment, keeping it as the spare if there is none
+ *
+ * queue (struct Queue*): the queue
+ * segment (struct Segment*): the drained segment
+ *
+ */
+static void return_segment(struct Queue* queue, struct Segment* segment) {
+    if (queue->spare == NULL) {
+        queue->spare = segment;
+    } else {
+        free(segment);
+    }
+}
+
+/**
+ * The name of each feature on the wire, in the order of their bits
+ */
+static const char* featureNames[] = {"SESSION", "READY", "BINARY",
+        "PIPELINE", "REFEREE"};
+
+/**
+ * Parse a HELLO line into the features it lists
+ *
+ * line (Fields*): the line to parse
+ *
+ * Returns the features, or -1 if the line is not a HELLO line
+ *
+ */
+int parse_hello(Fields* line) {
+    if (line->tag != TAG_HELLO) {
+        return -1;
+    }
+
+    int features = 0;
+    int numFeatures = sizeof(featureNames) / sizeof(featureNames[0]);
+    for (int field = 0; field < line->count; field++) {
+        for (int i = 0; i < numFeatures; i++) {
+            if (!strcmp(featureNames[i], line->field[field].start)) {
+                features |= 1 << i;
+            }
+        }
+    }
+    return features;
+}
+
+/**
+ * Write a HELLO line listing some features
+ *
+ * buffer (char*): where to write the line, MAX_HELLO_LENGTH long
+ * features (int): the features to list
+ *
+ * Returns the length of the line
+ *
+ */
+int format_hello(char* buffer, int features) {
+    int length = sprintf(buffer, "HELLO");
+    int numFeatures = sizeof(featureNames) / sizeof(featureNames[0]);
+    for (int i = 0; i < numFeatures; i++) {
+        if (features & (1 << i)) {
+            length += sprintf(buffer + length, ":%s", featureNames[i]);
+        }
+    }
+    length += sprintf(buffer + length, "\n");
+    return length;
+}
+
+/**
+ * Compares two moves according to the game rules.
+ *
+ * playerMove (MoveType): the first move
+ * opponentMove (MoveType): the second move
+ *
+ * Returns the result from the perspective of the player
+ *
+ */
+GameResult compare_moves(MoveType playerMove, MoveType opponentMove) {
+    switch (playerMove) {
+        case ROCK:
+            if (opponentMove == PAPER) {
+                return LOSE;
+            } else if (opponentMove == SCISSORS) {
+                return WIN;
+            }
+            break;
+        case SCISSORS:
+            if (opponentMove == ROCK) {
+                return LOSE;
+            } else if (opponentMove == PAPER) {
+                return WIN;
+            }
+            break;
+        case PAPER:
+            if (opponentMove == SCISSORS) {
+                return LOSE;
+            } else if (opponentMove == ROCK) {
+                return WIN;
+            }
+            break;
+    }
+    return TIE;
 }
 
 /**
- * Compare the tag with a line to check if it is of that type.
+ * Check whether a match is over
  *
- * tag (char*): the tag to check
- * line (char*): the line to check
+ * rounds (int): the number of rounds played
+ * playerScore (int): the rounds won by one player
+ * opponentScore (int): the rounds won by the other
  *
- * Returns true if the line begins with tag.
+ * Returns true if no more rounds are played
  *
  */
-bool check_tag(char* tag, char* line) {
-    return strncmp(tag, line, strlen(tag)) == 0;
+bool match_decided(int rounds, int playerScore, int opponentScore) {
+    return rounds >= MAX_ROUNDS
+            || (rounds >= MIN_ROUNDS && playerScore != opponentScore);
+}
+
+/** The names of the moves, indexed by MoveType */
+static char* moveNames[] = {"ROCK", "PAPER", "SCISSORS"};
+
+/**
+ * Converts a MoveType enum to string format.
+ *
+ * type (MoveType): the move to convert
+ *
+ * The string representation of this move.
+ *
+ */
+char* move_as_string(MoveType type) {
+    return moveNames[type];
+}
+
+/**
+ * Look up a move by its name
+ *
+ * name (char*): the name of the move
+ * move (MoveType*): set to the move
+ *
+ * Returns true if the name was a move
+ *
+ */
+bool parse_move(char* name, MoveType* move) {
+    for (MoveType type = ROCK; type <= SCISSORS; type++) {
+        if (!strcmp(moveNames[type], name)) {
+            *move = type;
+            return true;
+        }
+    }
+    return false;
 }
 
 struct Queue new_queue(size_t elementSize) {
     struct Queue output;
 
-    output.size = 1000;
-    output.data = malloc(elementSize * output.size);
-    output.readEnd = -1; // queue is empty
-    output.writeEnd = 0; // put first piece of data at the start of the queue
     output.elementSize = elementSize;
+    output.spare = NULL;
+    output.head = output.tail = take_segment(&output);
+    output.readEnd = 0;
+    output.writeEnd = 0;
+    output.count = 0;
 
     return output;
 }
 
 void destroy_queue(struct Queue* queue, void (*clean)(void*)) {
     
-    void* data;
-    while (read_queue(queue, &data)) {
-        clean(data);
+    char data[queue->elementSize];
+    while (read_queue(queue, (void**) data)) {
+        if (clean != NULL) {
+            clean(data);
+        }
     }
-    free(queue->data);
+    free(queue->head);
+    free(queue->spare);
 }
 
 bool write_queue(struct Queue* queue, void* data) {
     
-    if (queue->writeEnd == queue->readEnd) {
-        return false;   // queue is full
+    if (queue->writeEnd == QUEUE_SEGMENT_SIZE) {
+        // the last segment is full, link on a new one
+        struct Segment* segment = take_segment(queue);
+        if (segment == NULL) {
+            return false;
+        }
+        queue->tail->next = segment;
+        queue->tail = segment;
+        queue->writeEnd = 0;
     }
 
-    // Make a new block of memory to store our data in
-    // Then copy the new item into it
-    void* newElement = malloc(queue->elementSize);
-    memcpy(newElement, data, queue->elementSize);
-
-    // Now we put the new element into the queue
-    queue->data[queue->writeEnd] = newElement;
-
-    // if queue was empty, signal that the queue is no longer empty
-    if (queue->readEnd == -1) {
-        queue->readEnd = queue->writeEnd;
-    }
-    queue->writeEnd = (queue->writeEnd + 1) % queue->size;
+    // copy the new item straight into the segment
+    memcpy(queue->tail->data + queue->writeEnd * queue->elementSize, data,
+            queue->elementSize);
+    queue->writeEnd++;
+    queue->count++;
 
     return true;
 }
 
 bool read_queue(struct Queue* queue, void** output) {
     
-    if (queue->readEnd == -1) {
+    if (queue->count == 0) {
         // queue is empty
         return false;
     }
+
+    if (queue->readEnd == QUEUE_SEGMENT_SIZE) {
+        // we have drained the first segment, move on to the next
+        struct Segment* drained = queue->head;
+        queue->head = drained->next;
+        queue->readEnd = 0;
+        return_segment(queue, drained);
+    }
     
-    // Get the stored element from the queue
-    void* retrievedElement = queue->data[queue->readEnd];
+    // copy the stored element out of the queue
+    memcpy(output, queue->head->data + queue->readEnd * queue->elementSize,
+            queue->elementSize);
+    queue->readEnd++;
+    queue->count--;
+
+    if (queue->count == 0) {
+        // start again from the front of the one segment we have left
+        queue->readEnd = 0;
+        queue->writeEnd = 0;
+    }
+
+    return true;
+}
+
+/**
+ * Get the sequence number at the start of a ring cell
+ *
+ * ring (struct Ring*): the ring
+ * position (size_t): a position in the ring
+ *
+ * Returns a pointer to the sequence number of the cell for that position
+ *
+ */
+static size_t* ring_cell(struct Ring* ring, size_t position) {
+    return (size_t*) (ring->cells + (position & ring->mask) * ring->stride);
+}
+
+struct Ring* new_ring(size_t elementSize, size_t capacity) {
+    struct Ring* ring;
+    if (posix_memalign((void**) &ring, 64, sizeof(struct Ring))) {
+        return NULL;
+    }
 
-    // Update the pointer to point to the stored memory
-    memcpy(output, retrievedElement, queue->elementSize);
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+    ring->mask = size - 1;
+    ring->elementSize = elementSize;
+    // keep the sequence numbers of every cell aligned
+    ring->stride = (sizeof(size_t) + elementSize + sizeof(size_t) - 1)
+            / sizeof(size_t) * sizeof(size_t);
+    ring->cells = malloc(ring->stride * size);
+    for (size_t i = 0; i < size; i++) {
+        *ring_cell(ring, i) = i;
+    }
+    ring->writePos = 0;
+    ring->readPos = 0;
+    return ring;
+}
 
-    // Free the block of memory we allocated for the element
-    free(queue->data[queue->readEnd]);
+void destroy_ring(struct Ring* ring, void (*clean)(void*)) {
+    char element[ring->elementSize];
+    while (read_ring(ring, element)) {
+        if (clean != NULL) {
+            clean(element);
+        }
+    }
+    free(ring->cells);
+    free(ring);
+}
 
-    queue->readEnd = (queue->readEnd + 1) % queue->size;
+bool write_ring(struct Ring* ring, void* data) {
+    size_t position = __atomic_load_n(&ring->writePos, __ATOMIC_RELAXED);
+    size_t* cell;
+    while (1) {
+        cell = ring_cell(ring, position);
+        size_t sequence = __atomic_load_n(cell, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+        if (difference == 0) {
+            // the cell is free, try to claim it
+            if (__atomic_compare_exchange_n(&ring->writePos, &position,
+                    position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false; // ring is full
+        } else {
+            position = __atomic_load_n(&ring->writePos, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(cell + 1, data, ring->elementSize);
+    __atomic_store_n(cell, position + 1, __ATOMIC_RELEASE);
+    return true;
+}
 
-    if (queue->readEnd == queue->writeEnd) {
-        queue->readEnd = -1;
+bool read_ring(struct Ring* ring, void* output) {
+    size_t position = __atomic_load_n(&ring->readPos, __ATOMIC_RELAXED);
+    size_t* cell;
+    while (1) {
+        cell = ring_cell(ring, position);
+        size_t sequence = __atomic_load_n(cell, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+        if (difference == 0) {
+            // the cell has been written, try to claim it
+            if (__atomic_compare_exchange_n(&ring->readPos, &position,
+                    position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false; // ring is empty
+        } else {
+            position = __atomic_load_n(&ring->readPos, __ATOMIC_RELAXED);
+        }
     }
 
+    memcpy(output, cell + 1, ring->elementSize);
+    // hand the cell back to producers for the next lap around the ring
+    __atomic_store_n(cell, position + ring->mask + 1, __ATOMIC_RELEASE);
     return true;
 }
 
@@ -124,125 +538,754 @@ struct Channel new_channel(size_t elementSize) {
 
     struct Channel output;
     output.inner = new_queue(elementSize);
+    output.ring = NULL;
     pthread_mutex_init(&output.lock, NULL);
+    pthread_cond_init(&output.notFull, NULL);
     sem_init(&output.guard, 0, 1);
+    output.depth = 0;
+    set_channel_limit(&output, 0, WRITE_NONBLOCKING, 0);
     return output;
 }   
 
+struct Channel new_ring_channel(size_t elementSize, size_t capacity) {
+    struct Channel output;
+    output.ring = new_ring(elementSize, capacity);
+    output.inner.head = output.inner.tail = output.inner.spare = NULL;
+    output.inner.count = 0;
+    pthread_mutex_init(&output.lock, NULL);
+    pthread_cond_init(&output.notFull, NULL);
+    sem_init(&output.guard, 0, 0);
+    output.depth = 0;
+    set_channel_limit(&output, 0, WRITE_NONBLOCKING, 0);
+    return output;
+}
+
+void set_channel_limit(struct Channel* channel, size_t highWater,
+        WriteMode mode, int timeout) {
+    channel->highWater = highWater;
+    channel->mode = mode;
+    channel->timeout = timeout;
+}
+
+size_t channel_depth(struct Channel* channel) {
+    return __atomic_load_n(&channel->depth, __ATOMIC_RELAXED);
+}
+
+/**
+ * Work out when a timed write to a channel should give up
+ *
+ * channel (struct Channel*): the channel
+ * deadline (struct timespec*): set to the absolute realtime deadline
+ *
+ */
+static void write_deadline(struct Channel* channel,
+        struct timespec* deadline) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += channel->timeout / 1000;
+    deadline->tv_nsec += (channel->timeout % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * Write to a ring backed channel, applying its write mode when the ring (or
+ * the high-water mark) is full. Nothing ever waits on a ring, so a full
+ * ring is polled with a short sleep between attempts.
+ *
+ * channel (struct Channel*): the channel
+ * data (void*): the data being written
+ *
+ * Returns true if the data was written
+ *
+ */
+static bool write_ring_channel(struct Channel* channel, void* data) {
+    struct timespec deadline, now;
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 100000};
+    if (channel->mode == WRITE_TIMED) {
+        write_deadline(channel, &deadline);
+    }
+
+    while (1) {
+        // count the element before it is published, so a reader that takes
+        // it straight away never brings the depth below zero
+        size_t depth = __atomic_add_fetch(&channel->depth, 1,
+                __ATOMIC_RELAXED);
+        if ((channel->highWater == 0 || depth <= channel->highWater)
+                && write_ring(channel->ring, data)) {
+            return true;
+        }
+        __atomic_sub_fetch(&channel->depth, 1, __ATOMIC_RELAXED);
+        if (channel->mode == WRITE_NONBLOCKING) {
+            return false;
+        } else if (channel->mode == WRITE_TIMED) {
+            clock_gettime(CLOCK_REALTIME, &now);
+            if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec
+                    && now.tv_nsec >= deadline.tv_nsec)) {
+                return false;
+            }
+        }
+        nanosleep(&pause, NULL);
+    }
+}
+
 void destroy_channel(struct Channel* channel, void (*clean)(void*)) {
+    if (channel->ring != NULL) {
+        destroy_ring(channel->ring, clean);
+        return;
+    }
     destroy_queue(&channel->inner, clean);
 }
 
 bool write_channel(struct Channel* channel, void* data) {
+    if (channel->ring != NULL) {
+        if (!write_ring_channel(channel, data)) {
+            return false;
+        }
+        // only wakes a reader (a system call) if one is asleep
+        sem_post(&channel->guard);
+        return true;
+    }
+
+    struct timespec deadline;
+    if (channel->mode == WRITE_TIMED) {
+        write_deadline(channel, &deadline);
+    }
+
     pthread_mutex_lock(&channel->lock);
+    while (channel->highWater != 0
+            && channel->inner.count >= channel->highWater) {
+        int err = 0;
+        if (channel->mode == WRITE_BLOCKING) {
+            pthread_cond_wait(&channel->notFull, &channel->lock);
+        } else if (channel->mode == WRITE_TIMED) {
+            err = pthread_cond_timedwait(&channel->notFull, &channel->lock,
+                    &deadline);
+        }
+        if (channel->mode == WRITE_NONBLOCKING || err != 0) {
+            pthread_mutex_unlock(&channel->lock);
+            return false;
+        }
+    }
     bool output = write_queue(&channel->inner, data);
+    if (output) {
+        __atomic_add_fetch(&channel->depth, 1, __ATOMIC_RELAXED);
+    }
     pthread_mutex_unlock(&channel->lock);
 
-    sem_post(&channel->guard);
+    if (output) {
+        sem_post(&channel->guard);
+    }
     return output;
 }
 
-bool read_channel(struct Channel* channel, void** out) {
-    sem_wait(&channel->guard);
+/**
+ * Take the oldest element out of a channel, once the caller has taken a
+ * token from the channel's guard
+ *
+ * channel (struct Channel*): the channel
+ * out (void**): where to store the element
+ *
+ * Returns true if there was an element
+ *
+ */
+static bool take_channel(struct Channel* channel, void** out) {
+    if (channel->ring != NULL) {
+        struct Ring* ring = channel->ring;
+        while (!read_ring(ring, (void*) out)) {
+            // the token was posted for a later cell while another writer is
+            // still filling this one, so wait for it rather than losing the
+            // token. readPos is loaded first, as other readers may move it
+            // up to where writePos was.
+            size_t readPos = __atomic_load_n(&ring->readPos, __ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&ring->writePos, __ATOMIC_ACQUIRE)
+                    == readPos) {
+                return false;
+            }
+            sched_yield();
+        }
+        __atomic_sub_fetch(&channel->depth, 1, __ATOMIC_RELAXED);
+        return true;
+    }
 
     pthread_mutex_lock(&channel->lock);
     bool output = read_queue(&channel->inner, out);
+    if (output) {
+        __atomic_sub_fetch(&channel->depth, 1, __ATOMIC_RELAXED);
+        if (channel->highWater != 0) {
+            pthread_cond_signal(&channel->notFull);
+        }
+    }
     pthread_mutex_unlock(&channel->lock);
     return output;
 }
 
+bool read_channel(struct Channel* channel, void** out) {
+    sem_wait(&channel->guard);
+    return take_channel(channel, out);
+}
+
+bool read_channel_timed(struct Channel* channel, void** out, int timeout) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    if (sem_timedwait(&channel->guard, &deadline)) {
+        return false;
+    }
+    return take_channel(channel, out);
+}
+
+size_t drain_channel(struct Channel* channel, void* output, size_t max) {
+    sem_wait(&channel->guard);
+
+    size_t count = 0;
+    if (channel->ring != NULL) {
+        size_t elementSize = channel->ring->elementSize;
+        while (count < max && read_ring(channel->ring,
+                (char*) output + count * elementSize)) {
+            count++;
+        }
+        __atomic_sub_fetch(&channel->depth, count, __ATOMIC_RELAXED);
+    } else {
+        size_t elementSize = channel->inner.elementSize;
+        pthread_mutex_lock(&channel->lock);
+        while (count < max && read_queue(&channel->inner,
+                (void**) ((char*) output + count * elementSize))) {
+            count++;
+        }
+        __atomic_sub_fetch(&channel->depth, count, __ATOMIC_RELAXED);
+        if (count > 0 && channel->highWater != 0) {
+            pthread_cond_broadcast(&channel->notFull);
+        }
+        pthread_mutex_unlock(&channel->lock);
+    }
+
+    // we were only woken for one element, take the tokens for the rest (any
+    // still to be posted just cause a later empty read)
+    size_t extra = count > 0 ? count - 1 : 0;
+    while (extra > 0 && sem_trywait(&channel->guard) == 0) {
+        extra--;
+    }
+    return count;
+}
+
+void for_each_channel(struct Channel* channel,
+        void (*visit)(void* element, void* arg), void* arg) {
+    if (channel->ring != NULL) {
+        struct Ring* ring = channel->ring;
+        size_t end = __atomic_load_n(&ring->writePos, __ATOMIC_ACQUIRE);
+        size_t position = __atomic_load_n(&ring->readPos, __ATOMIC_ACQUIRE);
+        for (; position != end; position++) {
+            size_t* cell = ring_cell(ring, position);
+            // skip anything claimed by a writer but not yet published
+            if (__atomic_load_n(cell, __ATOMIC_ACQUIRE) == position + 1) {
+                visit((void*) (cell + 1), arg);
+            }
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    struct Queue* queue = &channel->inner;
+    struct Segment* segment = queue->head;
+    int position = queue->readEnd;
+    for (size_t i = 0; i < queue->count; i++) {
+        if (position == QUEUE_SEGMENT_SIZE) {
+            segment = segment->next;
+            position = 0;
+        }
+        visit(segment->data + position++ * queue->elementSize, arg);
+    }
+    pthread_mutex_unlock(&channel->lock);
+}
+
 /**
- * Does the player results contain this player
+ * Hash a player name (FNV-1a)
  *
- * players (Player*): the player results
- * player (char*): the player to check
- * numPlayers (int): the number of players in results
+ * name (char*): the name to hash
  *
- * Returns true if it does
+ * Returns the hash of the name
  *
  */
-bool contains_player(Player* players, char* player, int numPlayers) {
-    for (int i = 0; i < numPlayers; i++) {
-        Player current = players[i];
-        if (!(strcmp(current.name, player))) {
-            return true;
+static size_t hash_name(char* name) {
+    size_t hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (unsigned char) *name) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * A hash table of player ids by name, open addressed. Tables are replaced
+ * rather than grown, and never freed, so readers can probe one without a
+ * lock while it is replaced.
+ *
+ * numSlots (size_t): the number of slots, a power of two
+ * slots (PlayerId[]): each slot one more than the id it holds, 0 if empty
+ *
+ */
+typedef struct PlayerIdTable {
+    size_t numSlots;
+    PlayerId slots[];
+} PlayerIdTable;
+
+/**
+ * Every player name seen, each with a dense id
+ *
+ * names (char**[]): the names, in blocks of PLAYER_ID_BLOCK indexed by id.
+ * Blocks never move, so names are read without the lock.
+ * table (PlayerIdTable*): the ids by name, NULL until the first is given out
+ * numIds (size_t): the number of ids given out
+ * lock (pthread_mutex_t): held to give out ids, never to look them up
+ *
+ */
+static struct {
+    char** names[PLAYER_ID_BLOCKS];
+    PlayerIdTable* table;
+    size_t numIds;
+    pthread_mutex_t lock;
+} playerIds = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * Find the slot holding the id of a name, or the empty slot it would go in
+ *
+ * table (PlayerIdTable*): the hash table
+ * name (char*): the name
+ *
+ * Returns the slot
+ *
+ */
+static size_t find_slot(PlayerIdTable* table, char* name) {
+    size_t mask = table->numSlots - 1;
+    size_t slot = hash_name(name) & mask;
+    PlayerId held;
+    // a slot is filled after its name is stored, so the name is there to
+    // compare against as soon as the slot is seen
+    while ((held = __atomic_load_n(&table->slots[slot], __ATOMIC_ACQUIRE))
+            != 0 && strcmp(player_name(held - 1), name)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * Allocate an empty hash table of player ids
+ *
+ * numSlots (size_t): the number of slots, a power of two
+ *
+ * Returns the table
+ *
+ */
+static PlayerIdTable* new_id_table(size_t numSlots) {
+    PlayerIdTable* table = calloc(1, sizeof(PlayerIdTable)
+            + sizeof(PlayerId) * numSlots);
+    table->numSlots = numSlots;
+    return table;
+}
+
+/**
+ * Replace the hash table with one twice the size once it is half full. Must
+ * be called with the lock held. The old table is left for any reader still
+ * probing it.
+ */
+static void grow_id_table(void) {
+    PlayerIdTable* old = playerIds.table;
+    PlayerIdTable* table = new_id_table(old->numSlots * 2);
+    for (size_t i = 0; i < old->numSlots; i++) {
+        if (old->slots[i] != 0) {
+            table->slots[find_slot(table, player_name(old->slots[i] - 1))] =
+                    old->slots[i];
         }
     }
-    return false;
+    __atomic_store_n(&playerIds.table, table, __ATOMIC_RELEASE);
+}
+
+PlayerId intern_player(char* name) {
+    // almost every name has been seen before, so look without the lock first
+    PlayerIdTable* table = __atomic_load_n(&playerIds.table,
+            __ATOMIC_ACQUIRE);
+    if (table != NULL) {
+        PlayerId found = __atomic_load_n(&table->slots[find_slot(table,
+                name)], __ATOMIC_ACQUIRE);
+        if (found != 0) {
+            return found - 1;
+        }
+    }
+
+    pthread_mutex_lock(&playerIds.lock);
+    if (playerIds.table == NULL) {
+        playerIds.table = new_id_table(PLAYER_ID_INITIAL_SLOTS);
+    }
+    table = playerIds.table;
+    size_t slot = find_slot(table, name);
+    PlayerId id = NO_PLAYER;
+    if (table->slots[slot] != 0) {
+        // someone else added it since we looked
+        id = table->slots[slot] - 1;
+    } else if (playerIds.numIds < NO_PLAYER) {
+        id = playerIds.numIds;
+        if (id % PLAYER_ID_BLOCK == 0) {
+            playerIds.names[id / PLAYER_ID_BLOCK] = malloc(sizeof(char*)
+                    * PLAYER_ID_BLOCK);
+        }
+        playerIds.names[id / PLAYER_ID_BLOCK][id % PLAYER_ID_BLOCK] =
+                strdup(name);
+        __atomic_store_n(&table->slots[slot], id + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&playerIds.numIds, id + 1, __ATOMIC_RELEASE);
+        if (playerIds.numIds * 2 > table->numSlots) {
+            grow_id_table();
+        }
+    }
+    pthread_mutex_unlock(&playerIds.lock);
+    return id;
+}
+
+char* player_name(PlayerId id) {
+    return playerIds.names[id / PLAYER_ID_BLOCK][id % PLAYER_ID_BLOCK];
+}
+
+size_t count_players(void) {
+    return __atomic_load_n(&playerIds.numIds, __ATOMIC_ACQUIRE);
 }
 
 /**
- * Increase the result of a player
+ * Allocate a standings entry linked into the given number of levels
+ *
+ * level (int): the number of skip list levels
  *
- * players (Player**): the player results
- * player (char*): the player
- * result (int): the result to increase
+ * Returns the new, zeroed, entry
  *
  */
-void increase_result(Player** players, char* player, int result,
-        int numPlayers) {
-    int index = -1;
-    for (int i = 0; i < numPlayers; i++) {
-        if (!(strcmp((*players)[i].name, player))) {
-            index = i;
-            break;
+static PlayerEntry* new_entry(int level) {
+    PlayerEntry* entry = calloc(1, sizeof(PlayerEntry)
+            + sizeof(PlayerEntry*) * level);
+    entry->level = level;
+    return entry;
+}
+
+void init_standings(Standings* standings) {
+    standings->numBuckets = STANDINGS_INITIAL_BUCKETS;
+    standings->buckets = calloc(standings->numBuckets, sizeof(PlayerEntry*));
+    standings->numPlayers = 0;
+    standings->head = new_entry(STANDINGS_MAX_LEVEL);
+    standings->seed = 1;
+    standings->byId = NULL;
+    standings->byIdSize = 0;
+    pthread_mutex_init(&standings->lock, NULL);
+}
+
+/**
+ * Double the number of hash buckets once the table is fully loaded. Must be
+ * called with the lock held.
+ *
+ * standings (Standings*): the standings
+ *
+ */
+static void grow_buckets(Standings* standings) {
+    size_t numBuckets = standings->numBuckets * 2;
+    PlayerEntry** buckets = calloc(numBuckets, sizeof(PlayerEntry*));
+
+    // every player is on the bottom level of the skip list
+    for (PlayerEntry* entry = standings->head->next[0]; entry != NULL;
+            entry = entry->next[0]) {
+        size_t bucket = hash_name(entry->player.name) & (numBuckets - 1);
+        entry->chain = buckets[bucket];
+        buckets[bucket] = entry;
+    }
+    free(standings->buckets);
+    standings->buckets = buckets;
+    standings->numBuckets = numBuckets;
+}
+
+/**
+ * Add a new player to the hash table and skip list. Must be called with the
+ * lock held.
+ *
+ * standings (Standings*): the standings
+ * name (char*): the name of the player
+ * bucket (size_t): the hash bucket the player belongs in
+ *
+ * Returns the new player entry
+ *
+ */
+static PlayerEntry* insert_player(Standings* standings, char* name,
+        size_t bucket) {
+    // find the last entry before the new player on every level
+    PlayerEntry* previous[STANDINGS_MAX_LEVEL];
+    PlayerEntry* current = standings->head;
+    for (int level = STANDINGS_MAX_LEVEL - 1; level >= 0; level--) {
+        while (current->next[level] != NULL
+                && strcmp(current->next[level]->player.name, name) < 0) {
+            current = current->next[level];
         }
+        previous[level] = current;
     }
 
-    if (result == TIE) {
-        (*players)[index].ties++;
-    } else if (result == WIN) {
-        (*players)[index].wins++;
-    } else {
-        (*players)[index].losses++;
+    // each level is used by a quarter as many players as the one below
+    int level = 1;
+    while (level < STANDINGS_MAX_LEVEL && rand_r(&standings->seed) % 4 == 0) {
+        level++;
+    }
+
+    PlayerEntry* entry = new_entry(level);
+    entry->player.name = strdup(name);
+    entry->player.rating = ELO_INITIAL;
+    for (int i = 0; i < level; i++) {
+        entry->next[i] = previous[i]->next[i];
+        previous[i]->next[i] = entry;
     }
+    entry->chain = standings->buckets[bucket];
+    standings->buckets[bucket] = entry;
+    standings->numPlayers++;
+    return entry;
 }
 
 /**
- * Print out the results in the specified format
+ * Find a player in the hash table. Must be called with the lock held.
+ *
+ * standings (Standings*): the standings
+ * player (char*): the name of the player
  *
- * channel (Channel*): the results struct
+ * Returns the player's entry, or NULL if they have no results
  *
  */
-void print_results(struct Channel* channel) {
-    int numPlayers = 0;
-    Player* results = malloc(0);
-    Result* current;
+static PlayerEntry* find_player(Standings* standings, char* player) {
+    size_t bucket = hash_name(player) & (standings->numBuckets - 1);
+    PlayerEntry* entry = standings->buckets[bucket];
+    while (entry != NULL && strcmp(entry->player.name, player)) {
+        entry = entry->chain;
+    }
+    return entry;
+}
 
-    sem_wait(&channel->guard);
+/**
+ * Work out a player's new Elo rating after a result
+ *
+ * rating (double): the player's rating
+ * opponentRating (double): the opponent's rating
+ * result (GameResult): the result for the player
+ *
+ * Returns the new rating
+ *
+ */
+static double update_rating(double rating, double opponentRating,
+        GameResult result) {
+    double expected = 1.0 / (1.0 + pow(10.0,
+            (opponentRating - rating) / 400.0));
+    double score = result == WIN ? 1.0 : result == TIE ? 0.5 : 0.0;
+    return rating + ELO_K_FACTOR * (score - expected);
+}
 
-    pthread_mutex_lock(&channel->lock);
-    
-    for (int i = 0; i < channel->inner.writeEnd; i++) {
-        current = channel->inner.data[i];
-        if (!(contains_player(results, current->player, numPlayers))) {
-            numPlayers++;
-            results = realloc(results, sizeof(Player) * numPlayers);
-            Player newPlayer = {.name = current->player, .wins = 0, .ties = 0,
-                .losses = 0};
-            results[numPlayers - 1] = newPlayer;
-        }
-        increase_result(&results, current->player, current->result,
-                numPlayers);
+double player_rating(Standings* standings, char* player) {
+    pthread_mutex_lock(&standings->lock);
+    PlayerEntry* entry = find_player(standings, player);
+    double rating = entry == NULL ? ELO_INITIAL : entry->player.rating;
+    pthread_mutex_unlock(&standings->lock);
+    return rating;
+}
+
+/**
+ * Find a player in the standings, adding them if they are not there yet. Must
+ * be called with the lock held.
+ *
+ * standings (Standings*): the standings
+ * player (char*): the name of the player, copied if they are added
+ *
+ * Returns the player's entry
+ *
+ */
+static PlayerEntry* find_or_add_player(Standings* standings, char* player) {
+    PlayerEntry* entry = find_player(standings, player);
+    if (entry == NULL) {
+        size_t bucket = hash_name(player) & (standings->numBuckets - 1);
+        entry = insert_player(standings, player, bucket);
+        if (standings->numPlayers > standings->numBuckets) {
+            grow_buckets(standings);
+        }
     }
-    
-    for (int i = 0; i < numPlayers - 1; i++) {
-        for (int j = 0; j < numPlayers - 1 - i; j++) {
-            if (strcmp(results[j].name, results[j + 1].name) > 0) {
-                Player temp = results[j];
-                results[j] = results[j + 1];
-                results[j + 1] = temp;
-            }
+    return entry;
+}
+
+/**
+ * Find a player in the standings by id, caching their entry under the id.
+ * Must be called with the lock held.
+ *
+ * standings (Standings*): the standings
+ * player (PlayerId): the id of the player
+ * add (bool): whether to add the player if they are not there yet
+ *
+ * Returns the player's entry, or NULL if they have no results and add is not
+ * set
+ *
+ */
+static PlayerEntry* find_player_id(Standings* standings, PlayerId player,
+        bool add) {
+    if (player < standings->byIdSize && standings->byId[player] != NULL) {
+        return standings->byId[player];
+    }
+    // the first time this id is looked up, which is the only time its name
+    // is hashed
+    PlayerEntry* entry = add
+            ? find_or_add_player(standings, player_name(player))
+            : find_player(standings, player_name(player));
+    if (entry == NULL) {
+        return NULL;
+    }
+    if (player >= standings->byIdSize) {
+        size_t size = standings->byIdSize * 2 > player
+                ? standings->byIdSize * 2 : (size_t) player + 1;
+        standings->byId = realloc(standings->byId,
+                sizeof(PlayerEntry*) * size);
+        memset(standings->byId + standings->byIdSize, 0,
+                sizeof(PlayerEntry*) * (size - standings->byIdSize));
+        standings->byIdSize = size;
+    }
+    standings->byId[player] = entry;
+    return entry;
+}
+
+/**
+ * Add a result to a player's totals and rating. Must be called with the lock
+ * held.
+ *
+ * entry (PlayerEntry*): the player
+ * other (PlayerEntry*): the opponent, NULL if they have no results yet
+ * rated (bool): whether the opponent is known, so the rating should move
+ * result (GameResult): the result for the player
+ *
+ */
+static void apply_result(PlayerEntry* entry, PlayerEntry* other, bool rated,
+        GameResult result) {
+    if (rated) {
+        // each player reports their own result, so only their rating moves
+        entry->player.rating = update_rating(entry->player.rating,
+                other == NULL ? ELO_INITIAL : other->player.rating, result);
+    }
+
+    if (result == TIE) {
+        entry->player.ties++;
+    } else if (result == WIN) {
+        entry->player.wins++;
+    } else {
+        entry->player.losses++;
+    }
+}
+
+void record_result(Standings* standings, char* player, char* opponent,
+        GameResult result) {
+    pthread_mutex_lock(&standings->lock);
+    PlayerEntry* entry = find_or_add_player(standings, player);
+    apply_result(entry, opponent == NULL ? NULL
+            : find_player(standings, opponent), opponent != NULL, result);
+    pthread_mutex_unlock(&standings->lock);
+}
+
+void record_player_result(Standings* standings, PlayerId player,
+        PlayerId opponent, GameResult result) {
+    pthread_mutex_lock(&standings->lock);
+    PlayerEntry* entry = find_player_id(standings, player, true);
+    apply_result(entry, opponent == NO_PLAYER ? NULL
+            : find_player_id(standings, opponent, false),
+            opponent != NO_PLAYER, result);
+    pthread_mutex_unlock(&standings->lock);
+}
+
+double player_id_rating(Standings* standings, PlayerId player) {
+    pthread_mutex_lock(&standings->lock);
+    PlayerEntry* entry = find_player_id(standings, player, false);
+    double rating = entry == NULL ? ELO_INITIAL : entry->player.rating;
+    pthread_mutex_unlock(&standings->lock);
+    return rating;
+}
+
+void restore_player(Standings* standings, Player* player) {
+    pthread_mutex_lock(&standings->lock);
+    PlayerEntry* entry = find_or_add_player(standings, player->name);
+    entry->player.wins = player->wins;
+    entry->player.losses = player->losses;
+    entry->player.ties = player->ties;
+    entry->player.rating = player->rating;
+    pthread_mutex_unlock(&standings->lock);
+}
+
+void take_snapshot(Standings* standings, Snapshot* snapshot) {
+    pthread_mutex_lock(&standings->lock);
+    if (snapshot->capacity < standings->numPlayers) {
+        snapshot->capacity = standings->numPlayers * 2;
+        snapshot->players = realloc(snapshot->players,
+                sizeof(Player) * snapshot->capacity);
+    }
+    size_t numPlayers = 0;
+    for (PlayerEntry* entry = standings->head->next[0]; entry != NULL;
+            entry = entry->next[0]) {
+        snapshot->players[numPlayers++] = entry->player;
+    }
+    snapshot->numPlayers = numPlayers;
+    pthread_mutex_unlock(&standings->lock);
+}
+
+void print_snapshot(Snapshot* snapshot, FILE* stream) {
+    for (size_t i = 0; i < snapshot->numPlayers; i++) {
+        Player* current = &snapshot->players[i];
+        fprintf(stream, "%s %d %d %d\n", current->name, current->wins,
+                current->losses, current->ties);
+    }
+    fprintf(stream, "---\n");
+    fflush(stream);
+}
+
+/**
+ * Print a string as a quoted JSON string
+ *
+ * value (char*): the string to print
+ * stream (FILE*): where to print it
+ *
+ */
+static void print_json_string(char* value, FILE* stream) {
+    fputc('"', stream);
+    for (; *value != '\0'; value++) {
+        unsigned char next = *value;
+        if (next == '"' || next == '\\') {
+            fprintf(stream, "\\%c", next);
+        } else if (next < 0x20) {
+            fprintf(stream, "\\u%04x", next);
+        } else {
+            fputc(next, stream);
         }
     }
+    fputc('"', stream);
+}
 
-    for (int i = 0; i < numPlayers; i++) {
-        printf("%s %d %d %d\n", results[i].name, results[i].wins,
-                results[i].losses, results[i].ties);
-        fflush(stdout);
+void print_snapshot_json(Snapshot* snapshot, FILE* stream) {
+    fprintf(stream, "{\"players\":[");
+    for (size_t i = 0; i < snapshot->numPlayers; i++) {
+        Player* current = &snapshot->players[i];
+        fprintf(stream, "%s{\"name\":", i == 0 ? "" : ",");
+        print_json_string(current->name, stream);
+        fprintf(stream, ",\"wins\":%d,\"losses\":%d,\"ties\":%d,"
+                "\"rating\":%.1f}", current->wins, current->losses,
+                current->ties, current->rating);
     }
-    printf("---\n");
-    fflush(stdout);
-    pthread_mutex_unlock(&channel->lock);
+    fprintf(stream, "]}\n");
+    fflush(stream);
 }
 
+/**
+ * Print out the results in the specified format
+ *
+ * standings (Standings*): the standings to print
+ *
+ */
+void print_results(Standings* standings) {
+    Snapshot snapshot = {.players = NULL, .numPlayers = 0, .capacity = 0};
+    take_snapshot(standings, &snapshot);
+    print_snapshot(&snapshot, stdout);
+    free(snapshot.players);
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <semaphore.h>
 
@@ -8,56 +9,345 @@
 
 #define INITIAL_BUFFER_SIZE 80
 
+// Optional protocol features. A client lists the features it wants in a
+// HELLO:<feature>:<feature>... line before its first MR, and the server
+// answers with a HELLO line listing the ones it agreed to. A server that does
+// not understand HELLO hangs up, and the client goes back to plain MRs.
+typedef enum Feature {
+    // many MR/MATCH/RESULT exchanges over a single connection
+    FEATURE_SESSION = 1 << 0,
+    // MATCH lines may end in :READY, after which both players confirm their
+    // connections to each other with a READY line before any moves
+    FEATURE_READY = 1 << 1,
+    // binary frames rather than text lines (see frame.h). This is never
+    // listed in a text HELLO, it is agreed by sending a magic byte instead.
+    FEATURE_BINARY = 1 << 2,
+    // MATCH lines may end in :PIPELINE, after which both players send their
+    // moves a window of rounds at a time rather than one per round trip
+    FEATURE_PIPELINE = 1 << 3,
+    // MATCH lines may end in :REFEREE, after which both players send their
+    // MOVEs to the server, which answers each round with the opponent's MOVE
+    // or, once the match is over, the RESULT
+    FEATURE_REFEREE = 1 << 4
+} Feature;
+
+// The longest HELLO line format_hello can produce
+#define MAX_HELLO_LENGTH 80
+
+// The buffer a Scanner starts with once it is first read into, it grows to
+// fit longer lines
+#define SCANNER_BUFFER_SIZE 4096
+// The most fields split_line will split a line into
+#define MAX_LINE_FIELDS 8
+
+// Buffers the input of one connection, read with recv in bulk. Lines and
+// bytes are handed out as pointers into the buffer rather than copies.
+typedef struct Scanner {
+    int fd;
+    char* buffer;
+    size_t size;
+    size_t start; // the first byte not handed out yet
+    size_t end; // one past the last byte read
+} Scanner;
+
+// A run of bytes inside a buffer, valid until the buffer is next read into
+typedef struct Slice {
+    char* start;
+    size_t length;
+} Slice;
+
+// The kind of a text line, from the tag before its first colon
+typedef enum LineTag {
+    TAG_UNKNOWN,
+    TAG_HELLO,
+    TAG_MR,
+    TAG_MATCH,
+    TAG_RESULT,
+    TAG_MOVE,
+    TAG_READY,
+    TAG_BADNAME
+} LineTag;
+
+// A text line split at its colons. Each field is also terminated in place, so
+// can be used as a string.
+typedef struct Fields {
+    LineTag tag;
+    int count;
+    Slice field[MAX_LINE_FIELDS];
+} Fields;
+
 typedef enum GameResult {
     WIN,
     LOSE,
     TIE
 } GameResult;
 
+/** The possible moves */
+typedef enum MoveType {
+    ROCK,
+    PAPER,
+    SCISSORS
+} MoveType;
+
+// The most rounds a match can last
+#define MAX_ROUNDS 20
+// The rounds every match lasts, after which the first round that leaves the
+// scores apart ends it
+#define MIN_ROUNDS 5
+
+// Players are known by a dense id, given out in the order their names are
+// first seen. Ids are never reused and their names never freed.
+typedef uint32_t PlayerId;
+
+// The number of names in each block of the player id table
+#define PLAYER_ID_BLOCK 65536
+// The most blocks in the player id table, enough for 2^30 players
+#define PLAYER_ID_BLOCKS 16384
+// The id of no player, which also fits in the 30 bits a Result has for one
+#define NO_PLAYER 0x3FFFFFFF
+// The number of slots the player id hash table starts with
+#define PLAYER_ID_INITIAL_SLOTS 1024
+
+// Returns the id of a player name, giving it the next id the first time it is
+// seen. Returns NO_PLAYER once every id has been given out. Thread safe.
+PlayerId intern_player(char* name);
+
+// Returns the name of a player id. Never takes a lock.
+char* player_name(PlayerId id);
+
+// Returns the number of player ids given out so far, every id below which has
+// a name.
+size_t count_players(void);
+
+// A single player's result of a match, packed into 8 bytes
 typedef struct Result {
-    char* player;
-    GameResult result;
+    PlayerId player;
+    // the opponent, NO_PLAYER if unknown
+    unsigned int opponent : 30;
+    // the GameResult for the player
+    unsigned int result : 2;
 } Result;
 
+// The number of elements stored in each segment of a queue
+#define QUEUE_SEGMENT_SIZE 256
+
+// A fixed size block of queue elements, linked to the next block in the queue.
+struct Segment {
+    struct Segment* next;
+    // QUEUE_SEGMENT_SIZE elements stored inline
+    char data[];
+};
+
 // A first in, first out (FIFO) queue. 
 // This data structure (by itself) is not thread safe.
+// The queue is a linked list of segments, so it grows a segment at a time
+// without copying old data, and frees segments as they are drained.
 struct Queue {
-    // An offset within that array that points to the beginning of the queue
-    // (where new data should be written).
+    // The segment that new data is written to.
+    struct Segment* tail;
+    // The segment that old data is read from.
+    struct Segment* head;
+    // An offset within the tail segment that points to where new data should
+    // be written.
     int writeEnd;
-    // An offset within that array that points to the end of the queue (where
-    // old data should be read).
+    // An offset within the head segment that points to where old data should
+    // be read.
     int readEnd;
-    // The data contained in the queue - as an array.
-    void** data;
+    // A drained segment kept around so a queue hovering around a segment
+    // boundary does not allocate on every write.
+    struct Segment* spare;
     // How large the elements are that we are storing
     // We need this to prevent ourselves from moving into bad memory
     size_t elementSize;
-    // the size of the queue
-    int size;
+    // The number of elements in the queue
+    size_t count;
+};
+
+// What a write to a channel does when the channel is at its high-water mark
+typedef enum WriteMode {
+    // fail straight away
+    WRITE_NONBLOCKING,
+    // wait until there is room
+    WRITE_BLOCKING,
+    // wait until there is room, failing after the channel's timeout
+    WRITE_TIMED
+} WriteMode;
+
+// A bounded, lock-free, multi-producer multi-consumer ring buffer.
+// Elements are copied inline into a preallocated slab of cells, each of which
+// carries a sequence number saying whether it is ready to be written to (the
+// sequence equals the position) or read from (the sequence is one past it).
+struct Ring {
+    // The position the next element will be written to. Kept on its own
+    // cache line so producers and consumers do not contend.
+    size_t writePos __attribute__((aligned(64)));
+    // The position the next element will be read from.
+    size_t readPos __attribute__((aligned(64)));
+    // The number of cells minus one, the number of cells is a power of two.
+    size_t mask __attribute__((aligned(64)));
+    // How large the elements are that we are storing.
+    size_t elementSize;
+    // The distance in bytes between the start of consecutive cells.
+    size_t stride;
+    // The cells - a sequence number followed by elementSize bytes of data.
+    char* cells;
 };
 
 // A threadsafe channel. 
 // Data can be written to the channel or read from the
 // channel at different times, by different threads - safely.
+// If ring is not NULL the channel is backed by the lock-free ring instead of
+// the mutex protected queue.
 struct Channel {
     struct Queue inner;
+    struct Ring* ring;
     pthread_mutex_t lock;
     sem_t guard;
+    // Signalled when a read takes a channel back under its high-water mark.
+    pthread_cond_t notFull;
+    // The number of elements in the channel, readable without the lock.
+    size_t depth;
+    // The most elements the channel will hold, 0 for no limit.
+    size_t highWater;
+    // What a write does at the high-water mark.
+    WriteMode mode;
+    // How long a WRITE_TIMED write waits, in milliseconds.
+    int timeout;
 };
 
+// The Elo rating a player starts with
+#define ELO_INITIAL 1500.0
+// How far a single result can move an Elo rating
+#define ELO_K_FACTOR 32.0
+
 typedef struct Player {
     char* name;
     int wins;
     int ties;
     int losses;
+    double rating;
 } Player;
 
-void print_results(struct Channel* channel);
+// The most levels a node in the standings skip list can have, enough for
+// millions of players
+#define STANDINGS_MAX_LEVEL 24
+// The number of hash buckets a new standings table starts with
+#define STANDINGS_INITIAL_BUCKETS 64
+
+// A player in the standings. Each entry is in a hash table bucket (found by
+// name) and in a skip list ordered by name, so results can be recorded in
+// constant time and the standings walked in order without sorting.
+typedef struct PlayerEntry {
+    Player player;
+    // The next entry in the same hash bucket.
+    struct PlayerEntry* chain;
+    // The number of skip list levels this entry is linked into.
+    int level;
+    // The next entry (by name) on each level of the skip list.
+    struct PlayerEntry* next[];
+} PlayerEntry;
+
+// The running totals of every player that has reported a result.
+// Thread safe.
+typedef struct Standings {
+    // The hash table, indexed by the hash of a player name.
+    PlayerEntry** buckets;
+    // The number of buckets, always a power of two.
+    size_t numBuckets;
+    // The number of players in the standings.
+    size_t numPlayers;
+    // The head of the skip list, which holds no player.
+    PlayerEntry* head;
+    // The seed used to choose skip list levels.
+    unsigned int seed;
+    // Entries indexed by PlayerId, NULL for players not yet looked up by id.
+    PlayerEntry** byId;
+    // How many ids fit in byId before it must grow.
+    size_t byIdSize;
+    pthread_mutex_t lock;
+} Standings;
+
+// Initialises an empty set of standings.
+void init_standings(Standings* standings);
+
+// Adds a single result for a player against an opponent to the standings,
+// adding the player if this is their first result, and updates the player's
+// Elo rating. The name is copied. The opponent may be NULL if unknown, in
+// which case the rating is left alone.
+void record_result(Standings* standings, char* player, char* opponent,
+        GameResult result);
+
+// Records a result like record_result, but finds the players by id, so
+// without hashing or comparing their names once each has been seen. The
+// opponent may be NO_PLAYER if unknown.
+void record_player_result(Standings* standings, PlayerId player,
+        PlayerId opponent, GameResult result);
+
+// Sets the totals and rating of a player to those of a saved copy, adding
+// the player if they have no results yet. The name is copied.
+void restore_player(Standings* standings, Player* player);
+
+// Returns the Elo rating of a player, or ELO_INITIAL for a player with no
+// results yet.
+double player_rating(Standings* standings, char* player);
+
+// Returns the Elo rating of a player found by id, like player_rating.
+double player_id_rating(Standings* standings, PlayerId player);
+
+// A copy of the standings at a point in time, ordered by player name. The
+// names point into the standings, which never forget a player.
+typedef struct Snapshot {
+    Player* players;
+    size_t numPlayers;
+    // How many players fit in players before it must grow.
+    size_t capacity;
+} Snapshot;
+
+// Copies the standings into a snapshot, reusing the snapshot's memory. The
+// standings are only locked for the copy, never while anything is printed.
+// A zeroed Snapshot is a valid empty snapshot.
+void take_snapshot(Standings* standings, Snapshot* snapshot);
+
+// Prints a snapshot, ordered by player name, in the format
+// "name wins losses ties" followed by a "---" line.
+void print_snapshot(Snapshot* snapshot, FILE* stream);
+
+// Prints a snapshot as a single line of JSON, for other programs to read.
+void print_snapshot_json(Snapshot* snapshot, FILE* stream);
+
+// Prints the standings to stdout in the format of print_snapshot.
+void print_results(Standings* standings);
 
 // Creates (and returns) a new, empty channel, with no data in it.
 struct Channel new_channel(size_t elementSize);
 
+// Creates (and returns) a new, empty channel backed by a lock-free ring with
+// room for at least capacity elements. Has the same semantics as a channel
+// created by new_channel, but writes and reads never take a lock.
+struct Channel new_ring_channel(size_t elementSize, size_t capacity);
+
+// Reads up to max elements from the channel into output, an array of
+// elements, in one locked operation. Waits until the channel has been
+// written to, but (like read_channel) may still return 0 if it was empty.
+// Returns the number of elements read.
+size_t drain_channel(struct Channel* channel, void* output, size_t max);
+
+// Limits a channel to highWater elements (0 for no limit, the default for a
+// queue backed channel) and sets how writes behave once it is reached. A ring
+// backed channel is always limited to the capacity of its ring. timeout is
+// only used by WRITE_TIMED, and is in milliseconds.
+void set_channel_limit(struct Channel* channel, size_t highWater,
+        WriteMode mode, int timeout);
+
+// Returns the number of elements currently in the channel. Does not take any
+// locks, so is only a snapshot.
+size_t channel_depth(struct Channel* channel);
+
+// Calls visit on every element currently in the channel, oldest first, with
+// a pointer to the element and arg. The elements are not removed.
+void for_each_channel(struct Channel* channel,
+        void (*visit)(void* element, void* arg), void* arg);
+
 // Destroys an old channel. Takes as arguments a pointer to the channel, as
 // well as a function to use to clean up any elements left in the channel (for
 // example free). If the function provided is NULL, no clean up will be
@@ -66,8 +356,8 @@ void destroy_channel(struct Channel* channel, void (*clean)(void*));
 
 // Attempts to write a piece of data to the channel. Takes as arguments a
 // pointer to the channel, and the data being written. Returns true if the
-// attempt was successful, and false if the channel was full and unable to be
-// written to.
+// attempt was successful, and false if the channel was full (according to its
+// high-water mark and write mode) and unable to be written to.
 bool write_channel(struct Channel* channel, void* data);
 
 // Attempts to read a piece of data from the channel. Takes as arguments a
@@ -77,6 +367,10 @@ bool write_channel(struct Channel* channel, void* data);
 // *output.
 bool read_channel(struct Channel* channel, void** output);
 
+// As read_channel, but gives up and returns false if nothing has been written
+// to the channel within timeout milliseconds.
+bool read_channel_timed(struct Channel* channel, void** output, int timeout);
+
 // Creates (and returns) a new, empty queue, with no data in it.
 struct Queue new_queue(size_t elementSize);
 
@@ -88,7 +382,7 @@ void destroy_queue(struct Queue* queue, void (*clean)(void*));
 
 // Attempts to write a piece of data to the queue. Takes as arguments a pointer
 // to the queue, and the data being written. Returns true if the attempt was
-// successful, and false if the queue was full and unable to be written to.
+// successful, and false if a new segment could not be allocated.
 bool write_queue(struct Queue* queue, void* data);
 
 // Attempts to read a piece of data from the queue. Takes as arguments a
@@ -98,7 +392,75 @@ bool write_queue(struct Queue* queue, void* data);
 // *output.
 bool read_queue(struct Queue* queue, void** output);
 
-char* read_line(FILE*);
-bool check_tag(char*, char*);
+// Creates (and returns) a new, empty ring with room for at least capacity
+// elements.
+struct Ring* new_ring(size_t elementSize, size_t capacity);
+
+// Destroys an old ring, calling clean (if not NULL) on a pointer to each
+// element left in it.
+void destroy_ring(struct Ring* ring, void (*clean)(void*));
+
+// Attempts to copy an element into the ring. Returns false if the ring was
+// full. Safe to call from any number of threads at once.
+bool write_ring(struct Ring* ring, void* data);
+
+// Attempts to copy the oldest element out of the ring into output. Returns
+// false if the ring was empty. Safe to call from any number of threads at
+// once.
+bool read_ring(struct Ring* ring, void* output);
+
+// Parses a HELLO line into the set of Features it lists, ignoring any it does
+// not know. Returns -1 if the line is not a HELLO line.
+int parse_hello(Fields* line);
+
+// Writes a HELLO line (with its newline) listing features into buffer, which
+// should hold MAX_HELLO_LENGTH characters. Returns the length of the line.
+int format_hello(char* buffer, int features);
+
+// Returns the result of a round from the perspective of the player who made
+// playerMove.
+GameResult compare_moves(MoveType playerMove, MoveType opponentMove);
+
+// Returns true if a match is over after rounds rounds with these scores.
+bool match_decided(int rounds, int playerScore, int opponentScore);
+
+// Returns the name of a move, as sent in MOVE lines.
+char* move_as_string(MoveType type);
+
+// Looks up a move by its name. Returns false if there is no such move.
+bool parse_move(char* name, MoveType* move);
+
+// Starts scanning fd. No buffer is allocated until the first read.
+void init_scanner(Scanner* scanner, int fd);
+
+// Starts scanning another fd, keeping the buffer and dropping any input left
+// from the last one.
+void reset_scanner(Scanner* scanner, int fd);
+
+// Frees the scanner's buffer. The fd is left open.
+void destroy_scanner(Scanner* scanner);
+
+// Reads up to the next newline, which is replaced with a terminator. Returns
+// false on EOF or an error.
+bool scan_line(Scanner* scanner, Slice* line);
+
+// Reads exactly count bytes. Returns false on EOF or an error.
+bool scan_bytes(Scanner* scanner, size_t count, char** bytes);
+
+// Returns the next byte without taking it, or -1 on EOF or an error.
+int peek_byte(Scanner* scanner);
+
+// Reads whatever has arrived without waiting for more, even if the fd
+// blocks. Returns false on EOF or an error, after keeping anything read.
+bool read_available(Scanner* scanner);
+
+// Takes the next line if all of it has been read in, without reading more.
+// The newline is replaced with a terminator.
+bool take_line(Scanner* scanner, Slice* line);
+
+// Splits a line (terminated at length) at its colons and looks up its tag.
+// Returns the tag, which is TAG_UNKNOWN if it is not known or the line has
+// too many fields.
+LineTag split_line(char* line, size_t length, Fields* fields);
 
 #endif
@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+
+#include "tally.h"
+#include "journal.h"
+#include "export.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+/**
+ * The results tallied by a single thread, a ring which only that thread
+ * writes to and only the merger reads from. Blocks are never freed: a
+ * thread's block goes back to the spare list when it exits, results and all,
+ * for the next thread to carry on with.
+ *
+ * head (unsigned long): the number of results ever tallied into the block,
+ * written only by the thread that owns it, on its own cache line
+ * tail (unsigned long): the number of results ever merged out of the block,
+ * written only by whoever holds the merge lock
+ * results (TalliedResult[]): the ring of results
+ * next (struct TallyBlock*): the block created before this one
+ * nextSpare (struct TallyBlock*): the next block on the spare list
+ *
+ */
+typedef struct TallyBlock {
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+    TalliedResult results[TALLY_BLOCK_RESULTS] __attribute__((aligned(64)));
+    struct TallyBlock* next;
+    struct TallyBlock* nextSpare;
+} TallyBlock;
+
+/**
+ * Every thread's tally
+ *
+ * lock (pthread_mutex_t): guards spare
+ * mergeLock (pthread_mutex_t): held while merging, so one merge runs at once
+ * blocks (TallyBlock*): every block, newest first, only ever pushed onto
+ * spare (TallyBlock*): the blocks of threads that have exited
+ * key (pthread_key_t): gives back a thread's block when it exits
+ * once (pthread_once_t): creates the key
+ * merges (unsigned long): the number of merges that found results
+ * merged (unsigned long): the number of results merged
+ * largestMerge (unsigned long): the most results merged at once
+ *
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_mutex_t mergeLock;
+    TallyBlock* blocks;
+    TallyBlock* spare;
+    pthread_key_t key;
+    pthread_once_t once;
+    unsigned long merges;
+    unsigned long merged;
+    unsigned long largestMerge;
+} tally = {.lock = PTHREAD_MUTEX_INITIALIZER,
+        .mergeLock = PTHREAD_MUTEX_INITIALIZER, .once = PTHREAD_ONCE_INIT};
+
+/** The calling thread's block, NULL until it first tallies something */
+static __thread TallyBlock* threadTally;
+
+/**
+ * Put the block of a thread that has exited on the spare list. Its results
+ * stay in it until the next merge.
+ *
+ * blockArg (void*): the TallyBlock of the thread
+ *
+ */
+static void retire_tally(void* blockArg) {
+    TallyBlock* block = (TallyBlock*) blockArg;
+    pthread_mutex_lock(&tally.lock);
+    block->nextSpare = tally.spare;
+    tally.spare = block;
+    pthread_mutex_unlock(&tally.lock);
+}
+
+/**
+ * Create the key which gives back each thread's block when it exits
+ */
+static void create_tally_key(void) {
+    pthread_key_create(&tally.key, retire_tally);
+}
+
+/**
+ * Give the calling thread a block to tally into
+ *
+ * Returns the block, or NULL if one could not be allocated
+ *
+ */
+static TallyBlock* claim_tally(void) {
+    pthread_once(&tally.once, create_tally_key);
+    pthread_mutex_lock(&tally.lock);
+    TallyBlock* block = tally.spare;
+    if (block != NULL) {
+        tally.spare = block->nextSpare;
+    }
+    pthread_mutex_unlock(&tally.lock);
+
+    if (block == NULL) {
+        if (posix_memalign((void**) &block, 64, sizeof(TallyBlock))) {
+            return NULL;
+        }
+        block->head = block->tail = 0;
+        // the merger walks the blocks without the lock, so publish it whole
+        block->next = __atomic_load_n(&tally.blocks, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&tally.blocks, &block->next,
+                block, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_setspecific(tally.key, block);
+    return block;
+}
+
+/**
+ * Add a merged result to the standings (through the journal, if there is
+ * one) and the export. Only called with the merge lock held.
+ *
+ * results (Results*): where the result goes
+ * tallied (TalliedResult*): the result
+ *
+ */
+static void store_result(Results* results, TalliedResult* tallied) {
+    PlayerId opponent = tallied->result.opponent;
+    if (results->journal != NULL) {
+        journal_result(results->journal, tallied->result.player, opponent,
+                tallied->result.result);
+    } else {
+        record_player_result(&results->standings, tallied->result.player,
+                opponent, tallied->result.result);
+    }
+    if (results->exportLog != NULL) {
+        export_result(results->exportLog, tallied->match,
+                tallied->result.player, opponent, tallied->result.result);
+    }
+}
+
+void tally_result(Results* results, int match, PlayerId player,
+        PlayerId opponent, GameResult result) {
+    TallyBlock* block = threadTally;
+    if (block == NULL) {
+        block = threadTally = claim_tally();
+    }
+    if (block == NULL) {
+        // no block to tally into, so store it the slow way
+        TalliedResult tallied = {.match = match, .result = {.player = player,
+                .opponent = opponent, .result = result}};
+        pthread_mutex_lock(&tally.mergeLock);
+        store_result(results, &tallied);
+        pthread_mutex_unlock(&tally.mergeLock);
+        return;
+    }
+
+    unsigned long head = block->head;
+    if (head - __atomic_load_n(&block->tail, __ATOMIC_ACQUIRE)
+            == TALLY_BLOCK_RESULTS) {
+        // the merger is behind, so do its work for it
+        merge_results(results);
+    }
+    TalliedResult* tallied = &block->results[head % TALLY_BLOCK_RESULTS];
+    tallied->match = match;
+    tallied->result = (Result) {.player = player, .opponent = opponent,
+            .result = result};
+    __atomic_store_n(&block->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void merge_results(Results* results) {
+    pthread_mutex_lock(&tally.mergeLock);
+    unsigned long merged = 0;
+    for (TallyBlock* block = __atomic_load_n(&tally.blocks,
+            __ATOMIC_ACQUIRE); block != NULL; block = block->next) {
+        unsigned long head = __atomic_load_n(&block->head, __ATOMIC_ACQUIRE);
+        unsigned long tail = block->tail;
+        for (; tail != head; tail++) {
+            store_result(results,
+                    &block->results[tail % TALLY_BLOCK_RESULTS]);
+        }
+        merged += head - block->tail;
+        __atomic_store_n(&block->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    if (merged > 0) {
+        // only written with the merge lock held, but read without it
+        __atomic_store_n(&tally.merges, tally.merges + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&tally.merged, tally.merged + merged,
+                __ATOMIC_RELAXED);
+        if (merged > tally.largestMerge) {
+            __atomic_store_n(&tally.largestMerge, merged, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&tally.mergeLock);
+}
+
+/**
+ * Merge results every TALLY_MERGE_INTERVAL until the server exits
+ *
+ * resultsArg (void*): the Results to merge into
+ *
+ * Returns NULL
+ *
+ */
+static void* run_merger(void* resultsArg) {
+    Results* results = (Results*) resultsArg;
+    struct timespec interval = {.tv_sec = 0,
+            .tv_nsec = TALLY_MERGE_INTERVAL * 1000000L};
+    while (1) {
+        nanosleep(&interval, NULL);
+        merge_results(results);
+    }
+    return NULL;
+}
+
+bool start_merger(Results* results) {
+    pthread_t merger;
+    if (pthread_create(&merger, NULL, run_merger, (void*) results)) {
+        return false;
+    }
+    pthread_detach(merger);
+    return true;
+}
+
+size_t pending_results(void) {
+    size_t pending = 0;
+    for (TallyBlock* block = __atomic_load_n(&tally.blocks,
+            __ATOMIC_ACQUIRE); block != NULL; block = block->next) {
+        // the tail first, as it never passes the head
+        unsigned long tail = __atomic_load_n(&block->tail, __ATOMIC_ACQUIRE);
+        pending += __atomic_load_n(&block->head, __ATOMIC_ACQUIRE) - tail;
+    }
+    return pending;
+}
+
+void print_tally_stats(FILE* stream) {
+    unsigned long merges = __atomic_load_n(&tally.merges, __ATOMIC_RELAXED);
+    unsigned long merged = __atomic_load_n(&tally.merged, __ATOMIC_RELAXED);
+
+    fprintf(stream, "tally merges %lu\n", merges);
+    fprintf(stream, "tally merged %lu\n", merged);
+    fprintf(stream, "tally mean_merge %.2f\n",
+            merges == 0 ? 0.0 : (double) merged / merges);
+    fprintf(stream, "tally largest_merge %lu\n",
+            __atomic_load_n(&tally.largestMerge, __ATOMIC_RELAXED));
+    fprintf(stream, "tally pending %zu\n", pending_results());
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "server.h"
+
+#ifndef TALLY_H
+#define TALLY_H
+
+// How often (ms) the merger folds every thread's results into the standings
+#define TALLY_MERGE_INTERVAL 1
+// The results a thread can tally before they must be merged
+#define TALLY_BLOCK_RESULTS 1024
+
+/**
+ * A result waiting in a thread's tally to be merged
+ *
+ * match (int): the id of the match
+ * result (Result): the result, from the perspective of its player
+ *
+ */
+typedef struct TalliedResult {
+    int match;
+    Result result;
+} TalliedResult;
+
+// Tallies a result in the calling thread's own block, to be merged into the
+// standings, journal and export within TALLY_MERGE_INTERVAL. Never waits on
+// another thread unless the block is full, in which case the caller merges.
+void tally_result(Results* results, int match, PlayerId player,
+        PlayerId opponent, GameResult result);
+
+// Merges every result tallied so far, by every thread, into the standings,
+// journal and export. Threads go on tallying while it runs.
+void merge_results(Results* results);
+
+// Starts the thread merging results every TALLY_MERGE_INTERVAL. Must be
+// called after the report signals are blocked. Returns false if the thread
+// could not be started.
+bool start_merger(Results* results);
+
+// Returns the number of results tallied but not yet merged. Takes no locks,
+// so is only a snapshot.
+size_t pending_results(void);
+
+// Prints the merger's counters, in the format "tally <key> <value>".
+void print_tally_stats(FILE* stream);
+
+#endif